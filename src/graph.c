@@ -9,6 +9,8 @@
  * Copyright (c) 2015, Joyent, Inc.
  */
 
+#include <stdlib.h>
+#include <strings.h>
 #include "graph_impl.h"
 #include "graph_provider.h"
 
@@ -89,6 +91,10 @@ graph_edge_bnd(selem_t e, selem_t min, selem_t max)
 	return (0);
 }
 
+/*
+ * Weighted edges are keyed by their endpoints alone. The weight is just a
+ * payload, which lets lg_wupdate() change it without moving the edge.
+ */
 int
 w_edge_cmp(selem_t e1, selem_t e2)
 {
@@ -100,34 +106,411 @@ w_edge_cmp(selem_t e1, selem_t e2)
 	if (edge1->wed_from.ge_u > edge2->wed_from.ge_u) {
 		return (1);
 	}
-	if (edge1->wed_weight.ge_u < edge2->wed_weight.ge_u) {
+	if (edge1->wed_to.ge_u < edge2->wed_to.ge_u) {
+		return (-1);
+	}
+	if (edge1->wed_to.ge_u > edge2->wed_to.ge_u) {
+		return (1);
+	}
+	return (0);
+}
+
+int
+w_edge_bnd(selem_t e, selem_t min, selem_t max)
+{
+	if (w_edge_cmp(e, min) < 0) {
+		return (-1);
+	}
+	if (w_edge_cmp(e, max) > 0) {
+		return (1);
+	}
+	return (0);
+}
+
+/*
+ * The incoming-edge index (see lg_in_neighbors) shares its edges with
+ * `gr_edges`, but sorts them by `to` first, and by `from` second.
+ */
+int
+in_edge_cmp(selem_t e1, selem_t e2)
+{
+	edge_t *edge1 = e1.sle_p;
+	edge_t *edge2 = e2.sle_p;
+	if (edge1->ed_to.ge_u < edge2->ed_to.ge_u) {
+		return (-1);
+	}
+	if (edge1->ed_to.ge_u > edge2->ed_to.ge_u) {
+		return (1);
+	}
+	if (edge1->ed_from.ge_u < edge2->ed_from.ge_u) {
+		return (-1);
+	}
+	if (edge1->ed_from.ge_u > edge2->ed_from.ge_u) {
+		return (1);
+	}
+	return (0);
+}
+
+int
+in_edge_bnd(selem_t e, selem_t min, selem_t max)
+{
+	if (in_edge_cmp(e, min) < 0) {
 		return (-1);
 	}
-	if (edge1->wed_weight.ge_u > edge2->wed_weight.ge_u) {
+	if (in_edge_cmp(e, max) > 0) {
 		return (1);
 	}
+	return (0);
+}
+
+int
+in_w_edge_cmp(selem_t e1, selem_t e2)
+{
+	w_edge_t *edge1 = e1.sle_p;
+	w_edge_t *edge2 = e2.sle_p;
 	if (edge1->wed_to.ge_u < edge2->wed_to.ge_u) {
 		return (-1);
 	}
 	if (edge1->wed_to.ge_u > edge2->wed_to.ge_u) {
 		return (1);
 	}
+	if (edge1->wed_from.ge_u < edge2->wed_from.ge_u) {
+		return (-1);
+	}
+	if (edge1->wed_from.ge_u > edge2->wed_from.ge_u) {
+		return (1);
+	}
 	return (0);
-
 }
 
 int
-w_edge_bnd(selem_t e, selem_t min, selem_t max)
+in_w_edge_bnd(selem_t e, selem_t min, selem_t max)
 {
-	if (w_edge_cmp(e, min) < 0) {
+	if (in_w_edge_cmp(e, min) < 0) {
 		return (-1);
 	}
-	if (w_edge_cmp(e, max) > 0) {
+	if (in_w_edge_cmp(e, max) > 0) {
 		return (1);
 	}
 	return (0);
 }
 
+/*
+ * Packed edges (EDGE_INLINE and EDGE_DENSE) store a 32-bit key for each
+ * endpoint, instead of the node itself. With EDGE_INLINE the key is the node,
+ * and with EDGE_DENSE it is the id that the node dictionary assigned to the
+ * node. node_key() converts a node into its key, and returns -1 if the node
+ * can't be (or isn't) in the graph. key_node() does the opposite.
+ */
+int
+node_key(lg_graph_t *g, gelem_t n, uint64_t *k)
+{
+	uint32_t id;
+	switch (g->gr_edgestrat) {
+
+	case EDGE_PTR:
+		*k = n.ge_u;
+		return (0);
+	case EDGE_INLINE:
+		if (n.ge_u > UINT32_MAX) {
+			return (-1);
+		}
+		*k = n.ge_u;
+		return (0);
+	case EDGE_DENSE:
+		if (dict_find(g->gr_dict, n, &id) != 0) {
+			return (-1);
+		}
+		*k = id;
+		return (0);
+	}
+	return (-1);
+}
+
+gelem_t
+key_node(lg_graph_t *g, uint64_t k)
+{
+	gelem_t n;
+	if (g->gr_edgestrat == EDGE_DENSE) {
+		return (dict_node(g->gr_dict, k));
+	}
+	n.ge_u = k;
+	return (n);
+}
+
+/*
+ * Like node_key(), but gives `n` an id if the graph is dense and `n` has none
+ * yet. Called on both endpoints before connecting them.
+ */
+static int
+node_intern(lg_graph_t *g, gelem_t n)
+{
+	uint32_t id;
+	uint64_t k;
+	if (g->gr_edgestrat == EDGE_DENSE) {
+		return (dict_intern(g->gr_dict, n, &id));
+	}
+	return (node_key(g, n, &k));
+}
+
+/*
+ * Decodes the edge `e`, as stored in `gr_edges`, into its endpoints and its
+ * weight. For unweighted graphs, the weight is always 0.
+ */
+void
+edge_get(lg_graph_t *g, selem_t e, gelem_t *from, gelem_t *to, gelem_t *w)
+{
+	edge_t *edge;
+	w_edge_t *w_edge;
+	if (EDGE_PACKED(g)) {
+		*from = key_node(g, EDGE_PFROM(e.sle_u));
+		*to = key_node(g, EDGE_PTO(e.sle_u));
+		w->ge_u = 0;
+		return;
+	}
+	if (g->gr_type == GRAPH || g->gr_type == DIGRAPH) {
+		edge = e.sle_p;
+		*from = edge->ed_from;
+		*to = edge->ed_to;
+		w->ge_u = 0;
+	} else {
+		w_edge = e.sle_p;
+		*from = w_edge->wed_from;
+		*to = w_edge->wed_to;
+		*w = w_edge->wed_weight;
+	}
+}
+
+/*
+ * Returns a slablist element that can be used to look up the edge from->to
+ * (with weight `w`, if the graph is weighted) in `gr_edges`. The element may
+ * point into `k`, so `k` has to outlive it. If the edge can't possibly exist
+ * in a packed graph, the element is EDGE_NONE, which matches no edge.
+ */
+selem_t
+edge_key(lg_graph_t *g, ekey_t *k, gelem_t from, gelem_t to, gelem_t w)
+{
+	selem_t key;
+	uint64_t kf;
+	uint64_t kt;
+	if (EDGE_PACKED(g)) {
+		if (node_key(g, from, &kf) != 0 ||
+		    node_key(g, to, &kt) != 0) {
+			key.sle_u = EDGE_NONE;
+			return (key);
+		}
+		key.sle_u = EDGE_PACK(kf, kt);
+		return (key);
+	}
+	if (g->gr_type == GRAPH || g->gr_type == DIGRAPH) {
+		k->ek_e.ed_from = from;
+		k->ek_e.ed_to = to;
+		key.sle_p = &k->ek_e;
+	} else {
+		k->ek_we.wed_from = from;
+		k->ek_we.wed_to = to;
+		k->ek_we.wed_weight = w;
+		key.sle_p = &k->ek_we;
+	}
+	return (key);
+}
+
+/*
+ * Sets `min` and `max` to the smallest and largest edges that could possibly
+ * originate from the node `n`, for use in ranged folds and searches. Returns
+ * non-zero if `n` can't have any edges in this graph at all.
+ */
+int
+edge_range(lg_graph_t *g, gelem_t n, ekey_t *kmin, ekey_t *kmax, selem_t *min,
+    selem_t *max)
+{
+	gelem_t lo;
+	gelem_t hi;
+	uint64_t k;
+	lo.ge_u = 0;
+	hi.ge_u = UINT64_MAX;
+	if (EDGE_PACKED(g)) {
+		if (node_key(g, n, &k) != 0) {
+			return (-1);
+		}
+		min->sle_u = EDGE_PACK(k, 0);
+		max->sle_u = EDGE_PACK(k, UINT32_MAX);
+		return (0);
+	}
+	*min = edge_key(g, kmin, n, lo, lo);
+	*max = edge_key(g, kmax, n, hi, hi);
+	return (0);
+}
+
+/*
+ * Sets `min` and `max` to the smallest and largest entries of the mirror that
+ * could possibly point to `n`. Returns non-zero if there can't be any.
+ */
+int
+mirror_range(lg_graph_t *g, gelem_t n, ekey_t *kmin, ekey_t *kmax,
+    selem_t *min, selem_t *max)
+{
+	gelem_t lo;
+	gelem_t hi;
+	uint64_t k;
+	lo.ge_u = 0;
+	hi.ge_u = UINT64_MAX;
+	if (EDGE_PACKED(g)) {
+		if (node_key(g, n, &k) != 0) {
+			return (-1);
+		}
+		min->sle_u = EDGE_PACK(k, 0);
+		max->sle_u = EDGE_PACK(k, UINT32_MAX);
+		return (0);
+	}
+	*min = edge_key(g, kmin, lo, n, lo);
+	*max = edge_key(g, kmax, hi, n, hi);
+	return (0);
+}
+
+/*
+ * Creates the slablist element for a new edge, allocating an edge_t for it,
+ * unless the graph packs its edges. For dense graphs, both endpoints have to
+ * have been interned already.
+ */
+static selem_t
+edge_new(lg_graph_t *g, gelem_t from, gelem_t to)
+{
+	selem_t se;
+	edge_t *e;
+	uint64_t kf;
+	uint64_t kt;
+	if (EDGE_PACKED(g)) {
+		(void) node_key(g, from, &kf);
+		(void) node_key(g, to, &kt);
+		se.sle_u = EDGE_PACK(kf, kt);
+		return (se);
+	}
+	e = lg_mk_edge(g);
+	e->ed_from = from;
+	e->ed_to = to;
+	se.sle_p = e;
+	return (se);
+}
+
+/*
+ * Frees an edge that has been removed from `g`, or was never added. Shared
+ * edges (see graph_cow.c) aren't freed, since other graphs still have them.
+ */
+void
+edge_free(lg_graph_t *g, selem_t se)
+{
+	if (EDGE_PACKED(g) || edge_shared(g, se)) {
+		return;
+	}
+	if (g->gr_type == GRAPH_WE || g->gr_type == DIGRAPH_WE) {
+		lg_rm_w_edge(se.sle_p);
+		return;
+	}
+	lg_rm_edge(se.sle_p);
+}
+
+/*
+ * Converts an element of `gr_edges` into the corresponding element of
+ * `gr_in_edges`. Pointers are shared between the two lists, but packed edges
+ * have their halves swapped, so that they sort by `to` first.
+ */
+static selem_t
+in_elem(lg_graph_t *g, selem_t e)
+{
+	selem_t r = e;
+	if (EDGE_PACKED(g)) {
+		r.sle_u = EDGE_PACK(EDGE_PTO(e.sle_u), EDGE_PFROM(e.sle_u));
+	}
+	return (r);
+}
+
+/*
+ * Puts the endpoints of an edge of an undirected graph into canonical order,
+ * i.e. with the smaller key in `from`. Both endpoints have to have a key. For
+ * directed graphs, this does nothing.
+ */
+static void
+edge_canon(lg_graph_t *g, gelem_t *from, gelem_t *to)
+{
+	uint64_t kf = from->ge_u;
+	uint64_t kt = to->ge_u;
+	if (!GRAPH_UNDIRECTED(g)) {
+		return;
+	}
+	if (g->gr_edgestrat == EDGE_DENSE) {
+		(void) node_key(g, *from, &kf);
+		(void) node_key(g, *to, &kt);
+	}
+	if (kf > kt) {
+		gelem_t tmp = *from;
+		*from = *to;
+		*to = tmp;
+	}
+}
+
+/*
+ * Every edge enters and leaves `gr_edges` (or the overlay of a graph that
+ * shares its edges, see graph_cow.c) through these two functions, so that the
+ * incoming-edge index and the node table, if they were built, stay in sync.
+ * The edge is removed from the index first, since `cb` may free it.
+ */
+static int
+edge_add(lg_graph_t *g, selem_t e)
+{
+	int r = edges_add(g, e);
+	if (r == SL_EDUP) {
+		return (r);
+	}
+	if (g->gr_in_edges != NULL) {
+		(void) slablist_add(g->gr_in_edges, in_elem(g, e), 0);
+	}
+	if (g->gr_nodes != NULL) {
+		nodes_edge_add(g, e);
+	}
+	return (r);
+}
+
+static int
+edge_rem(lg_graph_t *g, selem_t key, slablist_rem_cb_t *cb)
+{
+	if (g->gr_in_edges != NULL &&
+	    slablist_rem(g->gr_in_edges, in_elem(g, key), 0, NULL) ==
+	    SL_ENFOUND) {
+		return (SL_ENFOUND);
+	}
+	/* the key is decoded before `cb` gets a chance to free the edge */
+	gelem_t from;
+	gelem_t to;
+	gelem_t w;
+	edge_get(g, key, &from, &to, &w);
+	int r = edges_rem(g, key, cb);
+	if (r != SL_ENFOUND && g->gr_nodes != NULL) {
+		nodes_edge_rem(g, from, to);
+	}
+	return (r);
+}
+
+/*
+ * Returns the weighted edge `e` of `g` in a form that can be changed in place.
+ * A shared edge (see graph_cow.c) is replaced by a copy of its own first.
+ */
+static w_edge_t *
+edge_own(lg_graph_t *g, selem_t e)
+{
+	cow_write(g);
+	if (!edge_shared(g, e)) {
+		return (e.sle_p);
+	}
+	w_edge_t *we = lg_mk_w_edge(g);
+	*we = *(w_edge_t *)e.sle_p;
+	selem_t se;
+	se.sle_p = we;
+	(void) edge_rem(g, e, NULL);
+	(void) edge_add(g, se);
+	return (we);
+}
+
 int
 lg_is_graph(lg_graph_t *g)
 {
@@ -152,6 +535,56 @@ lg_is_wdigraph(lg_graph_t *g)
 	return (g->gr_type == DIGRAPH_WE);
 }
 
+/*
+ * Creates an empty slablist that sorts edges the same way `gr_edges` does. If
+ * `name` is NULL, the list is named after the type of the graph.
+ */
+slablist_t *
+edges_create(lg_graph_t *g, char *name)
+{
+	if (name == NULL) {
+		switch (g->gr_type) {
+
+		case GRAPH:
+			name = "graph_edges";
+			break;
+		case GRAPH_WE:
+			name = "wgraph_edges";
+			break;
+		case DIGRAPH:
+			name = "digraph_edges";
+			break;
+		case DIGRAPH_WE:
+			name = "wdigraph_edges";
+			break;
+		}
+	}
+	if (EDGE_PACKED(g)) {
+		return (slablist_create(name, gelem_cmp, gelem_bnd, SL_SORTED));
+	}
+	if (g->gr_type == GRAPH_WE || g->gr_type == DIGRAPH_WE) {
+		return (slablist_create(name, w_edge_cmp, w_edge_bnd,
+		    SL_SORTED));
+	}
+	return (slablist_create(name, graph_edge_cmp, graph_edge_bnd,
+	    SL_SORTED));
+}
+
+/*
+ * Sets up the arenas of a new graph, once its type is known.
+ */
+static void
+graph_arenas_init(lg_graph_t *g)
+{
+	if (g->gr_type == GRAPH_WE || g->gr_type == DIGRAPH_WE) {
+		arena_init(&g->gr_ar_edges, sizeof (w_edge_t));
+	} else {
+		arena_init(&g->gr_ar_edges, sizeof (edge_t));
+	}
+	arena_init(&g->gr_ar_changes, sizeof (change_t));
+	arena_init(&g->gr_ar_nodes, sizeof (node_t));
+}
+
 lg_graph_t *
 lg_create_graph()
 {
@@ -161,6 +594,7 @@ lg_create_graph()
 	}
 	lg_graph_t *g = lg_mk_graph();
 	g->gr_type = GRAPH;
+	graph_arenas_init(g);
 	g->gr_edges = slablist_create("graph_edges", graph_edge_cmp,
 	    graph_edge_bnd, SL_SORTED);
 	return (g);
@@ -175,6 +609,7 @@ lg_create_wgraph()
 	}
 	lg_graph_t *g = lg_mk_graph();
 	g->gr_type = GRAPH_WE;
+	graph_arenas_init(g);
 	g->gr_edges = slablist_create("wgraph_edges", w_edge_cmp, w_edge_bnd,
 	    SL_SORTED);
 	return (g);
@@ -189,6 +624,7 @@ lg_create_digraph()
 	}
 	lg_graph_t *g = lg_mk_graph();
 	g->gr_type = DIGRAPH;
+	graph_arenas_init(g);
 	g->gr_edges = slablist_create("digraph_edges", graph_edge_cmp,
 	    graph_edge_bnd, SL_SORTED);
 	return (g);
@@ -203,48 +639,212 @@ lg_create_wdigraph()
 	}
 	lg_graph_t *g = lg_mk_graph();
 	g->gr_type = DIGRAPH_WE;
+	graph_arenas_init(g);
 	g->gr_edges = slablist_create("wdigraph_edges", w_edge_cmp,
 	    w_edge_bnd, SL_SORTED);
 	return (g);
 }
 
-void
-free_edge_cb(selem_t e)
+/*
+ * Frees the edges of a CONNECT_BATCH change, but not the change itself.
+ */
+static void
+free_batch_cb(selem_t e)
 {
-	edge_t *edge = e.sle_p;
-	lg_rm_edge(edge);
+	change_t *c = e.sle_p;
+	if (c->ch_batch != NULL) {
+		lg_free(c->ch_batch, c->ch_nbatch * sizeof (w_edge_t));
+		c->ch_batch = NULL;
+	}
 }
 
-void
-free_w_edge_cb(selem_t e)
+/*
+ * Calls the snap_cb on the nodes of a change that is about to be discarded,
+ * and frees its batch, but not the change itself.
+ */
+static void
+release_change(selem_t e)
 {
-	w_edge_t *edge = e.sle_p;
-	lg_rm_w_edge(edge);
+	change_t *c = e.sle_p;
+	lg_graph_t *g = c->ch_graph;
+	gelem_t ignored;
+	uint64_t i = 0;
+	if (g->gr_snap_cb && c->ch_batch != NULL) {
+		while (i < c->ch_nbatch) {
+			g->gr_snap_cb(0, SNAP, c->ch_batch[i].wed_from,
+			    c->ch_batch[i].wed_to, c->ch_batch[i].wed_weight);
+			i++;
+		}
+	} else if (g->gr_snap_cb) {
+		g->gr_snap_cb(0, SNAP, c->ch_from, c->ch_to, ignored);
+	}
+	free_batch_cb(e);
 }
 
 /*
- * This function destroys a graph (of any type) and frees it and its
- * subordinate structures from memory.
+ * Like release_change(), but also frees the change.
  */
-void
-lg_destroy_graph(lg_graph_t *g)
+static void
+clean_change(selem_t e)
 {
-	slablist_t *edges = g->gr_edges;
-	if (g->gr_type == DIGRAPH || g->gr_type == GRAPH) {
-		slablist_destroy(edges, free_edge_cb);
-		return;
+	release_change(e);
+	lg_rm_change(e.sle_p);
+}
+
+typedef struct snap_find {
+	change_t	*sf_found;
+} snap_find_t;
+
+static selem_t
+snap_find_cb(selem_t zero, selem_t *e, uint64_t sz)
+{
+	snap_find_t *sf = zero.sle_p;
+	if (sz > 0) {
+		sf->sf_found = e[0].sle_p;
 	}
-	slablist_destroy(edges, free_w_edge_cb);
+	return (zero);
 }
 
-void
-snap_connect(lg_graph_t *g, gelem_t from, gelem_t to)
+/*
+ * Adds the single-edge change `c` to `sl`, a list of changes sorted by
+ * snap_cmp(), which holds at most one change per edge and snapshot. That
+ * change records the net effect of all of the changes made to that edge since
+ * the snapshot was taken: whether the edge was connected or disconnected, or
+ * had its weight changed. If `sl` already has a change for the edge of `c`,
+ * the two are merged, and if they cancel each other out, both are discarded.
+ * Since the net changes of different edges don't depend on each other, a
+ * rollback can undo the changes of a snapshot in any order.
+ */
+static void
+snap_merge(lg_graph_t *g, slablist_t *sl, change_t *c)
 {
-	if (g->gr_snaps == NULL) {
+	selem_t sc;
+	sc.sle_p = c;
+	edge_canon(g, &c->ch_from, &c->ch_to);
+	change_t ch_min = *c;
+	change_t ch_max = *c;
+	ch_min.ch_op = CONNECT;
+	ch_max.ch_op = DROP;
+	ch_min.ch_weight.ge_u = 0;
+	ch_max.ch_weight.ge_u = UINT64_MAX;
+	ch_min.ch_batch = NULL;
+	ch_max.ch_batch = (w_edge_t *)UINTPTR_MAX;
+	selem_t s_min;
+	selem_t s_max;
+	s_min.sle_p = &ch_min;
+	s_max.sle_p = &ch_max;
+	snap_find_t sf;
+	sf.sf_found = NULL;
+	selem_t zero;
+	zero.sle_p = &sf;
+	slablist_foldr_range(sl, snap_find_cb, s_min, s_max, zero);
+	change_t *o = sf.sf_found;
+	if (o == NULL) {
+		slablist_add(sl, sc, 0);
 		return;
 	}
-	gelem_t ignored;
-	change_t *c = lg_mk_change();
+	/* the state of the edge when the snapshot was taken, and now */
+	int was = (o->ch_op != CONNECT);
+	gelem_t ow = (o->ch_op == UPDATE) ? o->ch_oweight : o->ch_weight;
+	int is = (c->ch_op != DISCONNECT);
+	selem_t so;
+	so.sle_p = o;
+	(void) slablist_rem(sl, so, 0, clean_change);
+	if (!was && is) {
+		c->ch_op = CONNECT;
+	} else if (was && !is) {
+		c->ch_op = DISCONNECT;
+		c->ch_weight = ow;
+	} else if (was && is && (g->gr_type == GRAPH_WE ||
+	    g->gr_type == DIGRAPH_WE) && ow.ge_u != c->ch_weight.ge_u) {
+		c->ch_op = UPDATE;
+		c->ch_oweight = ow;
+	} else {
+		clean_change(sc);
+		return;
+	}
+	slablist_add(sl, sc, 0);
+}
+
+/*
+ * Adds the change `c` to the change-log. The DEDUP strategy merges it with the
+ * change that the log already has for its edge (see snap_merge()). Every
+ * change gets logged through here, so this is where `gr_gen` is bumped.
+ */
+static void
+snap_add(lg_graph_t *g, change_t *c)
+{
+	selem_t sc;
+	sc.sle_p = c;
+	g->gr_gen++;
+	if (g->gr_snapstrat == SNAP_DEDUP) {
+		snap_merge(g, g->gr_snaps, c);
+		return;
+	}
+	/* `gr_gen` never goes down, so it doubles as a sequence number */
+	c->ch_seq = g->gr_gen;
+	slablist_add(g->gr_snaps, sc, 0);
+}
+
+/*
+ * Logs a change of a single edge. Used by the DEDUP strategy to log the edges
+ * of batch changes one by one.
+ */
+static void
+snap_edge(lg_graph_t *g, graph_op_t op, gelem_t from, gelem_t to, gelem_t w)
+{
+	change_t *c = lg_mk_change(g);
+	c->ch_snap = g->gr_snap - 1;
+	c->ch_graph = g;
+	c->ch_op = op;
+	c->ch_from = from;
+	c->ch_to = to;
+	c->ch_weight = w;
+	GRAPH_CHANGE_ADD(g, c, c->ch_snap, c->ch_op, c->ch_from, c->ch_to,
+	    c->ch_weight);
+	snap_add(g, c);
+}
+
+/*
+ * This function destroys a graph (of any type) and frees it and its
+ * subordinate structures from memory. The edges, changes, and node table
+ * entries all live in the graph's arenas, so none of them have to be freed
+ * one by one; we just drop the slablists that point to them, and then the
+ * arenas.
+ */
+void
+lg_destroy_graph(lg_graph_t *g)
+{
+	lg_unshard(g);
+	lg_sequential(g);
+	lg_thaw(g);
+	cow_release(g);
+	if (g->gr_in_edges != NULL) {
+		slablist_destroy(g->gr_in_edges, NULL);
+	}
+	if (g->gr_nodes != NULL) {
+		slablist_destroy(g->gr_nodes, NULL);
+	}
+	if (g->gr_snaps != NULL) {
+		slablist_destroy(g->gr_snaps, free_batch_cb);
+	}
+	ckpt_destroy(g);
+	slablist_destroy(g->gr_edges, NULL);
+	dict_destroy(g->gr_dict);
+	arena_destroy(&g->gr_ar_edges);
+	arena_destroy(&g->gr_ar_changes);
+	arena_destroy(&g->gr_ar_nodes);
+	lg_rm_graph(g);
+}
+
+void
+snap_connect(lg_graph_t *g, gelem_t from, gelem_t to)
+{
+	if (g->gr_snaps == NULL) {
+		return;
+	}
+	gelem_t ignored;
+	change_t *c = lg_mk_change(g);
 	c->ch_snap = g->gr_snap - 1;
 	c->ch_graph = g;
 	c->ch_op = CONNECT;
@@ -260,9 +860,7 @@ snap_connect(lg_graph_t *g, gelem_t from, gelem_t to)
 		g->gr_snap_cb(1, EDGE, from, to, ignored);
 		g->gr_snap_cb(1, SNAP, from, to, ignored);
 	}
-	selem_t sc;
-	sc.sle_p = c;
-	slablist_add(g->gr_snaps, sc, 0);
+	snap_add(g, c);
 }
 
 void
@@ -271,7 +869,7 @@ snap_wconnect(lg_graph_t *g, gelem_t from, gelem_t to, gelem_t weight)
 	if (g->gr_snaps == NULL) {
 		return;
 	}
-	change_t *c = lg_mk_change();
+	change_t *c = lg_mk_change(g);
 	c->ch_snap = g->gr_snap - 1;
 	c->ch_graph = g;
 	c->ch_op = CONNECT;
@@ -288,9 +886,7 @@ snap_wconnect(lg_graph_t *g, gelem_t from, gelem_t to, gelem_t weight)
 		g->gr_snap_cb(1, EDGE, from, to, weight);
 		g->gr_snap_cb(1, SNAP, from, to, weight);
 	}
-	selem_t sc;
-	sc.sle_p = c;
-	slablist_add(g->gr_snaps, sc, 0);
+	snap_add(g, c);
 }
 
 void
@@ -300,7 +896,7 @@ snap_disconnect(lg_graph_t *g, gelem_t from, gelem_t to)
 		return;
 	}
 	gelem_t ignored;
-	change_t *c = lg_mk_change();
+	change_t *c = lg_mk_change(g);
 	c->ch_snap = g->gr_snap - 1;
 	c->ch_graph = g;
 	c->ch_op = DISCONNECT;
@@ -318,9 +914,7 @@ snap_disconnect(lg_graph_t *g, gelem_t from, gelem_t to)
 		g->gr_snap_cb(1, SNAP, from, to, ignored);
 		g->gr_snap_cb(0, EDGE, from, to, ignored);
 	}
-	selem_t sc;
-	sc.sle_p = c;
-	slablist_add(g->gr_snaps, sc, 0);
+	snap_add(g, c);
 }
 
 void
@@ -329,7 +923,7 @@ snap_wdisconnect(lg_graph_t *g, gelem_t from, gelem_t to, gelem_t weight)
 	if (g->gr_snaps == NULL) {
 		return;
 	}
-	change_t *c = lg_mk_change();
+	change_t *c = lg_mk_change(g);
 	c->ch_snap = g->gr_snap - 1;
 	c->ch_graph = g;
 	c->ch_op = DISCONNECT;
@@ -343,58 +937,77 @@ snap_wdisconnect(lg_graph_t *g, gelem_t from, gelem_t to, gelem_t weight)
 		g->gr_snap_cb(1, SNAP, from, to, weight);
 		g->gr_snap_cb(0, EDGE, from, to, weight);
 	}
-	selem_t sc;
-	sc.sle_p = c;
-	slablist_add(g->gr_snaps, sc, 0);
+	snap_add(g, c);
+}
+
+/*
+ * An update neither creates nor destroys an edge, so only the reference held
+ * by the change itself is reported to the snap_cb.
+ */
+void
+snap_wupdate(lg_graph_t *g, gelem_t from, gelem_t to, gelem_t oweight,
+    gelem_t weight)
+{
+	if (g->gr_snaps == NULL) {
+		return;
+	}
+	change_t *c = lg_mk_change(g);
+	c->ch_snap = g->gr_snap - 1;
+	c->ch_graph = g;
+	c->ch_op = UPDATE;
+	c->ch_from = from;
+	c->ch_to = to;
+	c->ch_weight = weight;
+	c->ch_oweight = oweight;
+	GRAPH_CHANGE_ADD(g, c, c->ch_snap, c->ch_op, c->ch_from, c->ch_to,
+	    c->ch_weight);
+	if (g->gr_snap_cb != NULL) {
+		g->gr_snap_cb(1, SNAP, from, to, weight);
+	}
+	snap_add(g, c);
 }
 
 int
 lg_connect(lg_graph_t *g, gelem_t from, gelem_t to)
 {
 	selem_t se1;
-	selem_t se2;
-	edge_t *e1;
-	edge_t *e2;
 	int r;
 	if (from.ge_u == to.ge_u) {
 		return (G_ERR_SELF_CONNECT);
 	}
+	if (g->gr_csr != NULL) {
+		return (G_ERR_FROZEN);
+	}
+	if (EDGE_PACKED(g) &&
+	    (node_intern(g, from) != 0 || node_intern(g, to) != 0)) {
+		return (G_ERR_NODE_RANGE);
+	}
+	if (g->gr_shards != NULL) {
+		/* as in the switch below, weighted graphs get no edge */
+		if (g->gr_type != DIGRAPH) {
+			return (0);
+		}
+		gelem_t w;
+		w.ge_u = 0;
+		return (shard_connect(g, from, to, w));
+	}
+	gelem_t cfrom = from;
+	gelem_t cto = to;
 	switch (g->gr_type) {
 
-	case DIGRAPH:
-		e1 = lg_mk_edge();
-		se1.sle_p = e1;
-		e1->ed_from = from;
-		e1->ed_to = to;
-		r = slablist_add(g->gr_edges, se1, 0);
-		if (r == SL_EDUP) {
-			lg_rm_edge(e1);
-			return (G_ERR_EDGE_EXISTS);
-		}
-		break;
 	/*
-	 * A GRAPH is just like a DIGRAPH, except all connections have to be
-	 * full duplex.
+	 * A GRAPH is just like a DIGRAPH, except that the edge is stored in
+	 * canonical order, so that connecting BAR to FOO is the same as
+	 * connecting FOO to BAR.
 	 */
 	case GRAPH:
-		e1 = lg_mk_edge();
-		e2 = lg_mk_edge();
-		se1.sle_p = e1;
-		se2.sle_p = e2;
-		e1->ed_from = from;
-		e1->ed_to = to;
-		e2->ed_from = to;
-		e2->ed_to = from;
-		r = slablist_add(g->gr_edges, se1, 0);
-		if (r == SL_EDUP) {
-			lg_rm_edge(e1);
-			lg_rm_edge(e2);
-			return (G_ERR_EDGE_EXISTS);
-		}
-		r = slablist_add(g->gr_edges, se2, 0);
+		edge_canon(g, &cfrom, &cto);
+		/* FALLTHROUGH */
+	case DIGRAPH:
+		se1 = edge_new(g, cfrom, cto);
+		r = edge_add(g, se1);
 		if (r == SL_EDUP) {
-			lg_rm_edge(e1);
-			lg_rm_edge(e2);
+			edge_free(g, se1);
 			return (G_ERR_EDGE_EXISTS);
 		}
 		break;
@@ -419,41 +1032,43 @@ int
 lg_disconnect(lg_graph_t *g, gelem_t from, gelem_t to)
 {
 	selem_t se1;
-	selem_t se2;
-	edge_t e1;
-	edge_t e2;
+	ekey_t e1;
+	gelem_t w;
 	int r;
 	if (from.ge_u == to.ge_u) {
 		return (G_ERR_SELF_DISCONNECT);
 	}
+	if (g->gr_csr != NULL) {
+		return (G_ERR_FROZEN);
+	}
+	uint64_t k;
+	if (EDGE_PACKED(g) &&
+	    (node_key(g, from, &k) != 0 || node_key(g, to, &k) != 0)) {
+		return (G_ERR_NFOUND_DISCONNECT);
+	}
+	if (g->gr_shards != NULL) {
+		/* as in the switch below, weighted edges are left alone */
+		if (g->gr_type != DIGRAPH) {
+			return (0);
+		}
+		return (shard_disconnect(g, from, to));
+	}
+	slablist_rem_cb_t *rcb = disconnect_cb;
+	if (EDGE_PACKED(g)) {
+		rcb = NULL;
+	}
+	w.ge_u = 0;
+	gelem_t cfrom = from;
+	gelem_t cto = to;
 	switch (g->gr_type) {
 
-	case DIGRAPH:
-		se1.sle_p = &e1;
-		e1.ed_from = from;
-		e1.ed_to = to;
-		r = slablist_rem(g->gr_edges, se1, 0, disconnect_cb);
-		if (r == SL_ENFOUND) {
-			return (G_ERR_NFOUND_DISCONNECT);
-		}
-		break;
-	/*
-	 * A GRAPH is just like a DIGRAPH, except all connections have to be
-	 * full duplex.
-	 */
+	/* see lg_connect() */
 	case GRAPH:
-		se1.sle_p = &e1;
-		se2.sle_p = &e2;
-		e1.ed_from = from;
-		e1.ed_to = to;
-		e2.ed_from = to;
-		e2.ed_to = from;
-		r = slablist_rem(g->gr_edges, se1, 0, disconnect_cb);
-		if (r == SL_ENFOUND) {
-			return (G_ERR_NFOUND_DISCONNECT);
-		}
-
-		r = slablist_rem(g->gr_edges, se2, 0, disconnect_cb);
+		edge_canon(g, &cfrom, &cto);
+		/* FALLTHROUGH */
+	case DIGRAPH:
+		se1 = edge_key(g, &e1, cfrom, cto, w);
+		r = edge_rem(g, se1, rcb);
 		if (r == SL_ENFOUND) {
 			return (G_ERR_NFOUND_DISCONNECT);
 		}
@@ -473,245 +1088,877 @@ int
 lg_wconnect(lg_graph_t *g, gelem_t from, gelem_t to, gelem_t weight)
 {
 	selem_t swe1;
-	selem_t swe2;
 	w_edge_t *we1;
-	w_edge_t *we2;
 	if (from.ge_u == to.ge_u) {
 		return (G_ERR_SELF_CONNECT);
 	}
+	if (g->gr_csr != NULL) {
+		return (G_ERR_FROZEN);
+	}
+	if (g->gr_shards != NULL) {
+		/* as in the switch below, unweighted graphs get no edge */
+		if (g->gr_type != DIGRAPH_WE) {
+			return (0);
+		}
+		return (shard_connect(g, from, to, weight));
+	}
 	int r;
+	gelem_t cfrom = from;
+	gelem_t cto = to;
 	switch (g->gr_type) {
 
+	/* see lg_connect() */
+	case GRAPH_WE:
+		edge_canon(g, &cfrom, &cto);
+		/* FALLTHROUGH */
 	case DIGRAPH_WE:
-		we1 = lg_mk_w_edge();
+		we1 = lg_mk_w_edge(g);
 		swe1.sle_p = we1;
-		we1->wed_from = from;
-		we1->wed_to = to;
+		we1->wed_from = cfrom;
+		we1->wed_to = cto;
 		we1->wed_weight = weight;
-		r = slablist_add(g->gr_edges, swe1, 0);
+		r = edge_add(g, swe1);
 		if (r == SL_EDUP) {
 			lg_rm_w_edge(we1);
 			return (G_ERR_EDGE_EXISTS);
 		}
 		break;
 
-	case GRAPH_WE:
-		we1 = lg_mk_w_edge();
-		we2 = lg_mk_w_edge();
-		swe1.sle_p = we1;
-		swe2.sle_p = we2;
-		we1->wed_from = from;
-		we1->wed_to = to;
-		we1->wed_weight = weight;
-		we2->wed_from = from;
-		we2->wed_to = to;
-		we2->wed_weight = weight;
+	default:
+		break;
+	}
+	if (!g->gr_rollingback) {
+		snap_wconnect(g, from, to, weight);
+	}
+	return (0);
+}
 
-		r = slablist_add(g->gr_edges, swe1, 0);
-		if (r == SL_EDUP) {
-			lg_rm_w_edge(we1);
-			lg_rm_w_edge(we2);
-			return (G_ERR_EDGE_EXISTS);
+void
+wdisconnect_cb(selem_t e)
+{
+	w_edge_t *edge = e.sle_p;
+	lg_rm_w_edge(edge);
+}
+
+/*
+ * Since weighted edges are keyed by their endpoints, the edge from->to is
+ * removed regardless of `weight`. The change that gets logged carries the
+ * weight the edge actually had, so that a rollback restores it faithfully.
+ * Returns G_ERR_NFOUND_DISCONNECT if the graph is unweighted.
+ */
+int
+lg_wdisconnect(lg_graph_t *g, gelem_t from, gelem_t to, gelem_t weight)
+{
+	selem_t swe1;
+	selem_t found;
+	w_edge_t we1;
+	w_edge_t *stored;
+	if (from.ge_u == to.ge_u) {
+		return (G_ERR_SELF_DISCONNECT);
+	}
+	if (g->gr_csr != NULL) {
+		return (G_ERR_FROZEN);
+	}
+	if (g->gr_type != DIGRAPH_WE && g->gr_type != GRAPH_WE) {
+		return (G_ERR_NFOUND_DISCONNECT);
+	}
+	if (g->gr_shards != NULL) {
+		return (shard_disconnect(g, from, to));
+	}
+	int r;
+	swe1.sle_p = &we1;
+	we1.wed_from = from;
+	we1.wed_to = to;
+	we1.wed_weight = weight;
+	edge_canon(g, &we1.wed_from, &we1.wed_to);
+	if (edges_find(g, swe1, &found) == SL_ENFOUND) {
+		return (G_ERR_NFOUND_DISCONNECT);
+	}
+	stored = found.sle_p;
+	weight = stored->wed_weight;
+	r = edge_rem(g, swe1, wdisconnect_cb);
+	if (r == SL_ENFOUND) {
+		return (G_ERR_NFOUND_DISCONNECT);
+	}
+	if (!g->gr_rollingback) {
+		snap_wdisconnect(g, from, to, weight);
+	}
+	return (0);
+}
+
+/*
+ * Changes the weight of the existing edge from->to to `weight`, in place. In
+ * an undirected graph, the edge to->from is the same edge. Returns
+ * G_ERR_NFOUND_UPDATE if there is no such edge. If the edge already has weight
+ * `weight`, nothing is logged.
+ */
+int
+lg_wupdate(lg_graph_t *g, gelem_t from, gelem_t to, gelem_t weight)
+{
+	selem_t key;
+	selem_t found;
+	w_edge_t we;
+	w_edge_t *stored;
+	gelem_t oweight;
+	if (g->gr_csr != NULL) {
+		return (G_ERR_FROZEN);
+	}
+	if (g->gr_type != DIGRAPH_WE && g->gr_type != GRAPH_WE) {
+		return (G_ERR_NFOUND_UPDATE);
+	}
+	if (g->gr_shards != NULL) {
+		return (shard_wupdate(g, from, to, weight));
+	}
+	key.sle_p = &we;
+	we.wed_from = from;
+	we.wed_to = to;
+	edge_canon(g, &we.wed_from, &we.wed_to);
+	if (edges_find(g, key, &found) == SL_ENFOUND) {
+		return (G_ERR_NFOUND_UPDATE);
+	}
+	stored = found.sle_p;
+	oweight = stored->wed_weight;
+	if (oweight.ge_u == weight.ge_u) {
+		return (0);
+	}
+	stored = edge_own(g, found);
+	stored->wed_weight = weight;
+	if (!g->gr_rollingback) {
+		snap_wupdate(g, from, to, oweight, weight);
+	}
+	return (0);
+}
+
+/*
+ * A batch of edges is connected in three steps. First, the edges are put into
+ * canonical order, and sorted by the keys of their endpoints (see node_key),
+ * which is the order of `gr_edges`. Ties are broken by position in the batch,
+ * so that if an edge appears more than once, the first occurrence wins.
+ * Second, duplicates within the batch are dropped. Third, the surviving edges
+ * are merged into `gr_edges`.
+ *
+ * If the batch is at least as large as the graph, the merge is done by
+ * walking the old edge-list and the sorted batch side by side, and adding the
+ * union, in order, to a new edge-list, which replaces the old one. Otherwise,
+ * the edges are added to the old edge-list one by one. Either way, the whole
+ * batch is logged as a single CONNECT_BATCH change.
+ */
+typedef struct batch_ent {
+	uint64_t	be_kf;
+	uint64_t	be_kt;
+	uint64_t	be_idx;
+	gelem_t		be_from;
+	gelem_t		be_to;
+	gelem_t		be_w;
+} batch_ent_t;
+
+static int
+batch_ent_cmp(const void *a, const void *b)
+{
+	const batch_ent_t *b1 = a;
+	const batch_ent_t *b2 = b;
+	if (b1->be_kf != b2->be_kf) {
+		return (b1->be_kf < b2->be_kf ? -1 : 1);
+	}
+	if (b1->be_kt != b2->be_kt) {
+		return (b1->be_kt < b2->be_kt ? -1 : 1);
+	}
+	if (b1->be_idx != b2->be_idx) {
+		return (b1->be_idx < b2->be_idx ? -1 : 1);
+	}
+	return (0);
+}
+
+/*
+ * Sets `kf` and `kt` to the keys of the endpoints of an element of
+ * `gr_edges`.
+ */
+void
+elem_keys(lg_graph_t *g, selem_t e, uint64_t *kf, uint64_t *kt)
+{
+	gelem_t from;
+	gelem_t to;
+	gelem_t w;
+	if (EDGE_PACKED(g)) {
+		*kf = EDGE_PFROM(e.sle_u);
+		*kt = EDGE_PTO(e.sle_u);
+		return;
+	}
+	edge_get(g, e, &from, &to, &w);
+	*kf = from.ge_u;
+	*kt = to.ge_u;
+}
+
+static selem_t
+batch_elem(lg_graph_t *g, batch_ent_t *be)
+{
+	selem_t se;
+	w_edge_t *we;
+	if (g->gr_type == GRAPH_WE || g->gr_type == DIGRAPH_WE) {
+		we = lg_mk_w_edge(g);
+		we->wed_from = be->be_from;
+		we->wed_to = be->be_to;
+		we->wed_weight = be->be_w;
+		se.sle_p = we;
+		return (se);
+	}
+	return (edge_new(g, be->be_from, be->be_to));
+}
+
+static selem_t
+batch_collect_cb(selem_t zero, selem_t *e, uint64_t sz)
+{
+	selem_t *out = zero.sle_p;
+	bcopy(e, out, sz * sizeof (selem_t));
+	zero.sle_p = out + sz;
+	return (zero);
+}
+
+/*
+ * Merges the sorted, duplicate-free batch `b` into a new edge-list, and
+ * compacts `b` down to the edges that weren't already in the graph. Returns
+ * how many are left.
+ */
+static uint64_t
+batch_merge(lg_graph_t *g, batch_ent_t *b, uint64_t nb)
+{
+	uint64_t ne = slablist_get_elems(g->gr_edges);
+	selem_t *old = lg_zalloc((ne + 1) * sizeof (selem_t));
+	selem_t zero;
+	zero.sle_p = old;
+	slablist_foldr(g->gr_edges, batch_collect_cb, zero);
+	slablist_t *nsl = edges_create(g, NULL);
+	uint64_t i = 0;
+	uint64_t j = 0;
+	uint64_t nadd = 0;
+	uint64_t kf;
+	uint64_t kt;
+	while (i < ne || j < nb) {
+		int c = 1;
+		if (i < ne && j < nb) {
+			elem_keys(g, old[i], &kf, &kt);
+			c = (kf != b[j].be_kf) ? (kf < b[j].be_kf ? -1 : 1) :
+			    (kt != b[j].be_kt) ? (kt < b[j].be_kt ? -1 : 1) : 0;
+		} else if (i < ne) {
+			c = -1;
 		}
+		if (c <= 0) {
+			(void) slablist_add(nsl, old[i], 0);
+			i++;
+			if (c == 0) {
+				/* already in the graph */
+				j++;
+			}
+			continue;
+		}
+		(void) slablist_add(nsl, batch_elem(g, &b[j]), 0);
+		b[nadd++] = b[j];
+		j++;
+	}
+	lg_free(old, (ne + 1) * sizeof (selem_t));
+	slablist_destroy(g->gr_edges, NULL);
+	g->gr_edges = nsl;
+	/* both are cheaper to rebuild lazily than to update edge by edge */
+	if (g->gr_in_edges != NULL) {
+		slablist_destroy(g->gr_in_edges, NULL);
+		g->gr_in_edges = NULL;
+	}
+	nodes_destroy(g);
+	return (nadd);
+}
 
-		r = slablist_add(g->gr_edges, swe2, 0);
-		if (r == SL_EDUP) {
-			lg_rm_w_edge(we1);
-			lg_rm_w_edge(we2);
-			return (G_ERR_EDGE_EXISTS);
+static void
+snap_connect_batch(lg_graph_t *g, batch_ent_t *b, uint64_t nb)
+{
+	if (g->gr_snaps == NULL || nb == 0) {
+		return;
+	}
+	uint64_t i = 0;
+	if (g->gr_snapstrat == SNAP_DEDUP) {
+		while (i < nb) {
+			/* see snap_connect() */
+			if (g->gr_snap_cb != NULL) {
+				g->gr_snap_cb(1, EDGE, b[i].be_from,
+				    b[i].be_to, b[i].be_w);
+				g->gr_snap_cb(1, SNAP, b[i].be_from,
+				    b[i].be_to, b[i].be_w);
+			}
+			snap_edge(g, CONNECT, b[i].be_from, b[i].be_to,
+			    b[i].be_w);
+			i++;
+		}
+		return;
+	}
+	change_t *c = lg_mk_change(g);
+	c->ch_snap = g->gr_snap - 1;
+	c->ch_graph = g;
+	c->ch_op = CONNECT_BATCH;
+	c->ch_batch = lg_zalloc(nb * sizeof (w_edge_t));
+	c->ch_nbatch = nb;
+	while (i < nb) {
+		c->ch_batch[i].wed_from = b[i].be_from;
+		c->ch_batch[i].wed_to = b[i].be_to;
+		c->ch_batch[i].wed_weight = b[i].be_w;
+		/* see snap_connect() */
+		if (g->gr_snap_cb != NULL) {
+			g->gr_snap_cb(1, EDGE, b[i].be_from, b[i].be_to,
+			    b[i].be_w);
+			g->gr_snap_cb(1, SNAP, b[i].be_from, b[i].be_to,
+			    b[i].be_w);
+		}
+		i++;
+	}
+	c->ch_from = c->ch_batch[0].wed_from;
+	c->ch_to = c->ch_batch[0].wed_to;
+	c->ch_weight = c->ch_batch[0].wed_weight;
+	GRAPH_CHANGE_ADD(g, c, c->ch_snap, c->ch_op, c->ch_from, c->ch_to,
+	    c->ch_weight);
+	snap_add(g, c);
+}
+
+uint64_t
+connect_batch(lg_graph_t *g, gelem_t *from, gelem_t *to, gelem_t *w,
+    uint64_t n)
+{
+	uint64_t i = 0;
+	uint64_t nb = 0;
+	gelem_t zero;
+	zero.ge_u = 0;
+	if (g->gr_csr != NULL || n == 0) {
+		return (0);
+	}
+	if (g->gr_shards != NULL) {
+		/* the same edges are skipped as in the loop below */
+		while (i < n) {
+			if (from[i].ge_u != to[i].ge_u && (!EDGE_PACKED(g) ||
+			    (node_intern(g, from[i]) == 0 &&
+			    node_intern(g, to[i]) == 0)) &&
+			    shard_connect(g, from[i], to[i],
+			    w != NULL ? w[i] : zero) == 0) {
+				nb++;
+			}
+			i++;
+		}
+		return (nb);
+	}
+	batch_ent_t *b = lg_zalloc(n * sizeof (batch_ent_t));
+	while (i < n) {
+		batch_ent_t *be = &b[nb];
+		if (from[i].ge_u == to[i].ge_u || (EDGE_PACKED(g) &&
+		    (node_intern(g, from[i]) != 0 ||
+		    node_intern(g, to[i]) != 0))) {
+			i++;
+			continue;
+		}
+		be->be_from = from[i];
+		be->be_to = to[i];
+		be->be_w = w != NULL ? w[i] : zero;
+		be->be_idx = i;
+		edge_canon(g, &be->be_from, &be->be_to);
+		(void) node_key(g, be->be_from, &be->be_kf);
+		(void) node_key(g, be->be_to, &be->be_kt);
+		nb++;
+		i++;
+	}
+	qsort(b, nb, sizeof (batch_ent_t), batch_ent_cmp);
+	uint64_t nu = 0;
+	i = 0;
+	while (i < nb) {
+		if (nu == 0 || b[i].be_kf != b[nu - 1].be_kf ||
+		    b[i].be_kt != b[nu - 1].be_kt) {
+			b[nu++] = b[i];
+		}
+		i++;
+	}
+	uint64_t nadd = 0;
+	if (nu > 0) {
+		cow_write(g);
+	}
+	/* shared edges can't be rebuilt, only added to one by one */
+	if (g->gr_cow == NULL && nu >= slablist_get_elems(g->gr_edges)) {
+		nadd = batch_merge(g, b, nu);
+	} else {
+		i = 0;
+		while (i < nu) {
+			selem_t se = batch_elem(g, &b[i]);
+			if (edge_add(g, se) == SL_EDUP) {
+				edge_free(g, se);
+			} else {
+				b[nadd++] = b[i];
+			}
+			i++;
 		}
-		break;
-	default:
-		break;
 	}
 	if (!g->gr_rollingback) {
-		snap_wconnect(g, from, to, weight);
+		snap_connect_batch(g, b, nadd);
 	}
+	lg_free(b, n * sizeof (batch_ent_t));
+	return (nadd);
+}
+
+/*
+ * Connects `from[i]` to `to[i]`, for every `i` less than `n`, and returns the
+ * number of edges that were added. Self-edges, edges that already exist, and
+ * repeated edges are skipped, as are edges between nodes that can't be stored
+ * in this graph (see lg_edgestrat). This is much faster than calling
+ * lg_connect() `n` times, especially on an empty graph, and if snapshots are
+ * on, the whole batch is recorded as a single change.
+ */
+uint64_t
+lg_connect_batch(lg_graph_t *g, gelem_t *from, gelem_t *to, uint64_t n)
+{
+	if (g->gr_type != GRAPH && g->gr_type != DIGRAPH) {
+		return (0);
+	}
+	return (connect_batch(g, from, to, NULL, n));
+}
+
+/*
+ * Like lg_connect_batch(), but for weighted graphs. If an edge is repeated in
+ * the batch, the first weight is used.
+ */
+uint64_t
+lg_wconnect_batch(lg_graph_t *g, gelem_t *from, gelem_t *to, gelem_t *w,
+    uint64_t n)
+{
+	if (g->gr_type != GRAPH_WE && g->gr_type != DIGRAPH_WE) {
+		return (0);
+	}
+	return (connect_batch(g, from, to, w, n));
+}
+
+/*
+ * The edges that lg_remove_node() collects before removing them. `rc_elems`
+ * holds the elements as they are stored in `gr_edges`, and `rc_edges` holds
+ * their decoded endpoints and weights.
+ */
+typedef struct rmnode_coll {
+	lg_graph_t	*rc_g;
+	int		rc_mirror;
+	selem_t		*rc_elems;
+	w_edge_t	*rc_edges;
+	uint64_t	rc_n;
+	uint64_t	rc_max;
+} rmnode_coll_t;
+
+static selem_t
+rmnode_collect_cb(selem_t zero, selem_t *e, uint64_t sz)
+{
+	rmnode_coll_t *rc = zero.sle_p;
+	lg_graph_t *g = rc->rc_g;
+	uint64_t i = 0;
+	if (rc->rc_n + sz > rc->rc_max) {
+		uint64_t nmax = rc->rc_max * 2;
+		if (nmax < rc->rc_n + sz) {
+			nmax = rc->rc_n + sz;
+		}
+		selem_t *ne = lg_zalloc(nmax * sizeof (selem_t));
+		w_edge_t *nw = lg_zalloc(nmax * sizeof (w_edge_t));
+		if (rc->rc_n > 0) {
+			bcopy(rc->rc_elems, ne, rc->rc_n * sizeof (selem_t));
+			bcopy(rc->rc_edges, nw, rc->rc_n * sizeof (w_edge_t));
+		}
+		lg_free(rc->rc_elems, rc->rc_max * sizeof (selem_t));
+		lg_free(rc->rc_edges, rc->rc_max * sizeof (w_edge_t));
+		rc->rc_elems = ne;
+		rc->rc_edges = nw;
+		rc->rc_max = nmax;
+	}
+	while (i < sz) {
+		/* mirror elements convert back with the same swap */
+		selem_t se = rc->rc_mirror ? in_elem(g, e[i]) : e[i];
+		w_edge_t *we = &rc->rc_edges[rc->rc_n];
+		edge_get(g, se, &we->wed_from, &we->wed_to, &we->wed_weight);
+		rc->rc_elems[rc->rc_n] = se;
+		rc->rc_n++;
+		i++;
+	}
+	return (zero);
+}
+
+/*
+ * Logs a REMOVE_NODE or DROP change, which removed the edges in `edges`.
+ */
+static void
+snap_remove_edges(lg_graph_t *g, graph_op_t op, gelem_t n, w_edge_t *edges,
+    uint64_t ne)
+{
+	uint64_t i = 0;
+	if (g->gr_snaps == NULL || ne == 0) {
+		return;
+	}
+	if (g->gr_snapstrat == SNAP_DEDUP) {
+		while (i < ne) {
+			/* see snap_disconnect() */
+			if (g->gr_snap_cb != NULL) {
+				g->gr_snap_cb(1, SNAP, edges[i].wed_from,
+				    edges[i].wed_to, edges[i].wed_weight);
+				g->gr_snap_cb(0, EDGE, edges[i].wed_from,
+				    edges[i].wed_to, edges[i].wed_weight);
+			}
+			snap_edge(g, DISCONNECT, edges[i].wed_from,
+			    edges[i].wed_to, edges[i].wed_weight);
+			i++;
+		}
+		return;
+	}
+	change_t *c = lg_mk_change(g);
+	c->ch_snap = g->gr_snap - 1;
+	c->ch_graph = g;
+	c->ch_op = op;
+	c->ch_from = n;
+	c->ch_batch = lg_zalloc(ne * sizeof (w_edge_t));
+	c->ch_nbatch = ne;
+	bcopy(edges, c->ch_batch, ne * sizeof (w_edge_t));
+	GRAPH_CHANGE_ADD(g, c, c->ch_snap, c->ch_op, c->ch_from, c->ch_to,
+	    c->ch_weight);
+	/* see snap_disconnect() */
+	while (g->gr_snap_cb != NULL && i < ne) {
+		g->gr_snap_cb(1, SNAP, edges[i].wed_from, edges[i].wed_to,
+		    edges[i].wed_weight);
+		g->gr_snap_cb(0, EDGE, edges[i].wed_from, edges[i].wed_to,
+		    edges[i].wed_weight);
+		i++;
+	}
+	snap_add(g, c);
+}
+
+/*
+ * Removes the node `n`, by removing every edge that leaves or enters it.
+ *
+ * The edges that leave `n` (in an undirected graph, the ones stored under `n`)
+ * are contiguous in `gr_edges`, and are removed with a single ranged removal.
+ * The edges that enter `n` (in an undirected graph, the rest of them) are
+ * contiguous in the incoming-edge index (which is built if it wasn't already),
+ * and are removed from it with a single ranged removal. They then have to be
+ * removed from `gr_edges` one by one. While the edges are shared with a clone
+ * (see graph_cow.c), all of them are removed one by one. The whole removal is
+ * logged as a single REMOVE_NODE change, which a rollback undoes by
+ * reconnecting every edge.
+ *
+ * Returns G_ERR_NFOUND_NODE if `n` has no edges, and -1 if the graph is
+ * sharded.
+ */
+int
+lg_remove_node(lg_graph_t *g, gelem_t n)
+{
+	rmnode_coll_t rc;
+	ekey_t kmin;
+	ekey_t kmax;
+	selem_t omin;
+	selem_t omax;
+	selem_t imin;
+	selem_t imax;
+	if (g->gr_csr != NULL) {
+		return (G_ERR_FROZEN);
+	}
+	if (g->gr_shards != NULL) {
+		return (-1);
+	}
+	if (edge_range(g, n, &kmin, &kmax, &omin, &omax) != 0) {
+		return (G_ERR_NFOUND_NODE);
+	}
+	in_index_build(g);
+	bzero(&rc, sizeof (rc));
+	rc.rc_g = g;
+	selem_t zero;
+	zero.sle_p = &rc;
+	edges_foldr_range(g, rmnode_collect_cb, omin, omax, zero);
+	uint64_t nout = rc.rc_n;
+	ekey_t ikmin;
+	ekey_t ikmax;
+	(void) mirror_range(g, n, &ikmin, &ikmax, &imin, &imax);
+	rc.rc_mirror = 1;
+	slablist_foldr_range(g->gr_in_edges, rmnode_collect_cb, imin, imax,
+	    zero);
+	if (rc.rc_n == 0) {
+		return (G_ERR_NFOUND_NODE);
+	}
+	uint64_t i = 0;
+	cow_write(g);
+	if (g->gr_cow != NULL) {
+		/* shared edges can't be removed by range, only one by one */
+		while (i < rc.rc_n) {
+			(void) edge_rem(g, rc.rc_elems[i], NULL);
+			edge_free(g, rc.rc_elems[i]);
+			i++;
+		}
+		goto removed;
+	}
+	while (i < nout) {
+		(void) slablist_rem(g->gr_in_edges, in_elem(g, rc.rc_elems[i]),
+		    0, NULL);
+		i++;
+	}
+	if (nout > 0) {
+		(void) slablist_rem_range(g->gr_edges, omin, omax, NULL);
+	}
+	if (rc.rc_n > nout) {
+		(void) slablist_rem_range(g->gr_in_edges, imin, imax, NULL);
+	}
+	while (i < rc.rc_n) {
+		(void) slablist_rem(g->gr_edges, rc.rc_elems[i], 0, NULL);
+		i++;
+	}
+	i = 0;
+	while (i < rc.rc_n) {
+		if (g->gr_nodes != NULL) {
+			nodes_edge_rem(g, rc.rc_edges[i].wed_from,
+			    rc.rc_edges[i].wed_to);
+		}
+		edge_free(g, rc.rc_elems[i]);
+		i++;
+	}
+removed:
+	if (!g->gr_rollingback) {
+		snap_remove_edges(g, REMOVE_NODE, n, rc.rc_edges, rc.rc_n);
+	}
+	lg_free(rc.rc_elems, rc.rc_max * sizeof (selem_t));
+	lg_free(rc.rc_edges, rc.rc_max * sizeof (w_edge_t));
 	return (0);
 }
 
 void
-wdisconnect_cb(selem_t e)
+vset_init(lg_graph_t *g, vset_t *vs, char *name)
+{
+	vs->vs_sl = NULL;
+	vs->vs_bm = NULL;
+	vs->vs_bits = 0;
+	vs->vs_ctx = NULL;
+	if (g->gr_edgestrat == EDGE_DENSE) {
+		vs->vs_bits = g->gr_dict->di_n;
+		vs->vs_bm = lg_zalloc(((vs->vs_bits + 63) / 64) *
+		    sizeof (uint64_t));
+		return;
+	}
+	vs->vs_sl = slablist_create(name, gelem_cmp, gelem_bnd, SL_SORTED);
+}
+
+/*
+ * Like vset_init(), but the visited-set is the one of the workspace `tc`,
+ * which is reset, and which the traversal can use for its queue, too.
+ */
+void
+vset_init_ctx(lg_graph_t *g, vset_t *vs, lg_trav_ctx_t *tc)
 {
-	w_edge_t *edge = e.sle_p;
-	lg_rm_w_edge(edge);
+	vs->vs_sl = NULL;
+	vs->vs_bm = NULL;
+	vs->vs_bits = 0;
+	vs->vs_ctx = tc;
+	trav_reset(tc, g);
 }
 
-int
-lg_wdisconnect(lg_graph_t *g, gelem_t from, gelem_t to, gelem_t weight)
+void
+vset_destroy(vset_t *vs)
 {
-	selem_t swe1;
-	selem_t swe2;
-	w_edge_t we1;
-	w_edge_t we2;
-	if (from.ge_u == to.ge_u) {
-		return (G_ERR_SELF_DISCONNECT);
-	}
-	int r;
-	switch (g->gr_type) {
-
-	case DIGRAPH_WE:
-		swe1.sle_p = &we1;
-		we1.wed_from = from;
-		we1.wed_to = to;
-		we1.wed_weight = weight;
-		r = slablist_rem(g->gr_edges, swe1, 0, wdisconnect_cb);
-		if (r == SL_ENFOUND) {
-			return (G_ERR_NFOUND_DISCONNECT);
-		}
-		break;
-
-	case GRAPH_WE:
-		swe1.sle_p = &we1;
-		swe2.sle_p = &we2;
-		we1.wed_from = from;
-		we1.wed_to = to;
-		we1.wed_weight = weight;
-		we2.wed_from = from;
-		we2.wed_to = to;
-		we2.wed_weight = weight;
-
-		r = slablist_rem(g->gr_edges, swe1, 0, wdisconnect_cb);
-		if (r == SL_ENFOUND) {
-			return (G_ERR_NFOUND_DISCONNECT);
-		}
-
-		r = slablist_rem(g->gr_edges, swe2, 0, wdisconnect_cb);
-		if (r == SL_ENFOUND) {
-			return (G_ERR_NFOUND_DISCONNECT);
-		}
-		break;
-	default:
-		break;
+	if (vs->vs_ctx != NULL) {
+		return;
 	}
-	if (!g->gr_rollingback) {
-		snap_wdisconnect(g, from, to, weight);
+	if (vs->vs_bm != NULL) {
+		lg_free(vs->vs_bm, ((vs->vs_bits + 63) / 64) *
+		    sizeof (uint64_t));
+		return;
 	}
-	return (0);
+	slablist_destroy(vs->vs_sl, NULL);
 }
 
-typedef struct args {
-	fold_cb_t		*a_cb;
-	adj_cb_t		*a_acb;
-	lg_graph_t		*a_g;
-	gelem_t			a_agg;
-	slablist_t 		*a_q;
-	slablist_t 		*a_v;
-	int			a_stat;
-} args_t;
-
 /*
- * Checks to see if a node, encoded as a slablist_elem was visited.
+ * Checks to see if the node with key `k` was visited. Nodes that were given an
+ * id after the bitmap was sized count as visited, so that a callback that
+ * connects new nodes can't make us run off the end of the bitmap.
  */
 int
-visited(slablist_t *V, selem_t enq)
+vset_test(vset_t *vs, uint64_t k)
 {
 	selem_t fnd;
-	int r = slablist_find(V, enq, &fnd);
+	selem_t sk;
+	if (vs->vs_ctx != NULL) {
+		return (trav_test(vs->vs_ctx, k));
+	}
+	if (vs->vs_bm != NULL) {
+		if (k >= vs->vs_bits) {
+			return (1);
+		}
+		return ((vs->vs_bm[k / 64] >> (k % 64)) & 1);
+	}
+	sk.sle_u = k;
+	int r = slablist_find(vs->vs_sl, sk, &fnd);
 	if (r == SL_ENFOUND) {
 		return (0);
 	}
 	return (1);
 }
 
+void
+vset_add(vset_t *vs, uint64_t k)
+{
+	selem_t sk;
+	if (vs->vs_ctx != NULL) {
+		trav_add(vs->vs_ctx, k);
+		return;
+	}
+	if (vs->vs_bm != NULL) {
+		if (k < vs->vs_bits) {
+			vs->vs_bm[k / 64] |= (1ULL << (k % 64));
+		}
+		return;
+	}
+	sk.sle_u = k;
+	slablist_add(vs->vs_sl, sk, 0);
+}
+
 /*
- * Same as above, but the node is encoded as a gelem.
+ * Same as above, but the node is given as a gelem. A node that has no key
+ * can't be in the graph, so there is nothing to mark.
  */
-int
-gvisited(slablist_t *V, gelem_t node)
+void
+vset_gadd(lg_graph_t *g, vset_t *vs, gelem_t n)
 {
-	selem_t fnd;
-	selem_t snode;
-	snode.sle_u = node.ge_u;
-	int r = slablist_find(V, snode, &fnd);
-	if (r == SL_ENFOUND) {
-		return (0);
+	uint64_t k;
+	if (node_key(g, n, &k) == 0) {
+		vset_add(vs, k);
 	}
-	return (1);
 }
 
+/*
+ * Decodes the element `e` of `gr_edges` (or of the mirror, if `mirror` is
+ * set) as seen from the node whose range it is in: `n` is that node, and
+ * `adj` is the other endpoint, whose key is returned. Packed entries of the
+ * mirror are already stored with their halves swapped (see in_elem), while
+ * pointers are shared with `gr_edges`, and have to be swapped here.
+ */
+uint64_t
+nbr_get(lg_graph_t *g, int mirror, selem_t e, gelem_t *n, gelem_t *adj,
+    gelem_t *w)
+{
+	edge_get(g, e, n, adj, w);
+	if (EDGE_PACKED(g)) {
+		return (EDGE_PTO(e.sle_u));
+	}
+	if (mirror) {
+		gelem_t tmp = *n;
+		*n = *adj;
+		*adj = tmp;
+	}
+	return (adj->ge_u);
+}
+
+typedef struct nbrs_args {
+	lg_graph_t	*na_g;
+	int		na_mirror;
+	nbrs_cb_t	*na_cb;
+	void		*na_arg;
+} nbrs_args_t;
 
-selem_t
-visit_and_q(selem_t z, selem_t *e, uint64_t sz)
+static selem_t
+nbrs_fold_cb(selem_t zero, selem_t *e, uint64_t sz)
 {
-	args_t *args = z.sle_p;
-	gtype_t type = args->a_g->gr_type;
-	slablist_t *Q = args->a_q;
-	slablist_t *V = args->a_v;
+	nbrs_args_t *a = zero.sle_p;
+	gelem_t n;
+	gelem_t adj;
+	gelem_t w;
 	uint64_t i = 0;
 	while (i < sz) {
-		selem_t c = e[i];
-		edge_t *edge = NULL;
-		w_edge_t *w_edge = NULL;
-		selem_t enq;
-		gelem_t from;
-		gelem_t weight;
-		weight.ge_u = 0;
-		if (type == DIGRAPH || type == GRAPH) {
-			edge = c.sle_p;
-			from.ge_u = edge->ed_from.ge_u;
-			enq.sle_u = edge->ed_to.ge_u;
+		uint64_t k = nbr_get(a->na_g, a->na_mirror, e[i], &n, &adj, &w);
+		a->na_cb(n, adj, k, w, a->na_arg);
+		i++;
+	}
+	return (zero);
+}
+
+/*
+ * Calls `cb` on every neighbor of `n`, in the order in which the neighbors are
+ * stored. For directed graphs these are the `to` nodes of the edges that leave
+ * `n`. For undirected graphs, we first walk the mirror, and then `gr_edges`
+ * (see the comment above edge_t in graph_impl.h).
+ */
+void
+graph_nbrs(lg_graph_t *g, gelem_t n, nbrs_cb_t *cb, void *arg)
+{
+	nbrs_args_t args;
+	ekey_t kmin;
+	ekey_t kmax;
+	selem_t min;
+	selem_t max;
+	selem_t zero;
+	args.na_g = g;
+	args.na_cb = cb;
+	args.na_arg = arg;
+	zero.sle_p = &args;
+	if (GRAPH_UNDIRECTED(g)) {
+		in_index_build(g);
+		if (mirror_range(g, n, &kmin, &kmax, &min, &max) != 0) {
+			return;
+		}
+		args.na_mirror = 1;
+		slablist_foldr_range(g->gr_in_edges, nbrs_fold_cb, min, max,
+		    zero);
+	}
+	if (edge_range(g, n, &kmin, &kmax, &min, &max) != 0) {
+		return;
+	}
+	args.na_mirror = 0;
+	if (g->gr_shards != NULL) {
+		shard_t *sh;
+		slablist_t *edges = shard_lock(g, n, &sh);
+		slablist_foldr_range(edges, nbrs_fold_cb, min, max, zero);
+		shard_unlock(sh);
+		return;
+	}
+	edges_foldr_range(g, nbrs_fold_cb, min, max, zero);
+}
+
+typedef struct args {
+	fold_cb_t		*a_cb;
+	adj_cb_t		*a_acb;
+	lg_graph_t		*a_g;
+	gelem_t			a_agg;
+	slablist_t 		*a_q;
+	vset_t	 		*a_v;
+	lg_trav_ctx_t		*a_ctx;	/* if non-NULL, queue in it */
+	int			a_stat;
+} args_t;
+
+void
+visit_and_q(gelem_t from, gelem_t to, uint64_t k, gelem_t weight, void *arg)
+{
+	args_t *args = arg;
+	slablist_t *Q = args->a_q;
+	vset_t *V = args->a_v;
+	selem_t enq;
+	enq.sle_u = to.ge_u;
+	if (!vset_test(V, k)) {
+		if (args->a_acb != NULL) {
+			args->a_acb(to, from, weight, args->a_agg);
+		}
+		GRAPH_BFS_ENQ(to);
+		if (args->a_ctx != NULL) {
+			trav_enq(args->a_ctx, to);
 		} else {
-			w_edge = c.sle_p;
-			from.ge_u = w_edge->wed_from.ge_u;
-			enq.sle_u = w_edge->wed_to.ge_u;
-			weight.ge_u = w_edge->wed_weight.ge_u;
-		}
-		if (!visited(V, enq)) {
-			gelem_t to;
-			to.ge_u = enq.sle_u;
-			if (args->a_acb != NULL) {
-				args->a_acb(to, from, weight, args->a_agg);
-			}
-			GRAPH_BFS_ENQ(to);
 			slablist_add(Q, enq, 0);
-			GRAPH_BFS_VISIT(to);
-			slablist_add(V, enq, 0);
 		}
-		i++;
+		GRAPH_BFS_VISIT(to);
+		vset_add(V, k);
 	}
-	return (z);
 }
 
 /*
  * This is the redundant version of the previous. It doesn't add anything to
  * the visited set, since we assume that such a set is unneeded.
  */
-selem_t
-just_q(selem_t z, selem_t *e, uint64_t sz)
+void
+just_q(gelem_t from, gelem_t to, uint64_t k, gelem_t weight, void *arg)
 {
-	args_t *args = z.sle_p;
-	gtype_t type = args->a_g->gr_type;
+	args_t *args = arg;
 	slablist_t *Q = args->a_q;
-	uint64_t i = 0;
-	while (i < sz) {
-		selem_t c = e[i];
-		edge_t *edge = NULL;
-		w_edge_t *w_edge = NULL;
-		selem_t enq;
-		gelem_t from;
-		gelem_t weight;
-		weight.ge_u = 0;
-		if (type == DIGRAPH || type == GRAPH) {
-			edge = c.sle_p;
-			from.ge_u = edge->ed_from.ge_u;
-			enq.sle_u = edge->ed_to.ge_u;
-		} else {
-			w_edge = c.sle_p;
-			from.ge_u = w_edge->wed_from.ge_u;
-			enq.sle_u = w_edge->wed_to.ge_u;
-			weight.ge_u = w_edge->wed_weight.ge_u;
-		}
-		gelem_t to;
-		to.ge_u = enq.sle_u;
-		if (args->a_acb != NULL) {
-			args->a_acb(to, from, weight, args->a_agg);
-		}
-		GRAPH_BFS_RDNT_ENQ(to);
-		slablist_add(Q, enq, 0);
-		i++;
+	selem_t enq;
+	(void)k;
+	enq.sle_u = to.ge_u;
+	if (args->a_acb != NULL) {
+		args->a_acb(to, from, weight, args->a_agg);
 	}
-	return (z);
+	GRAPH_BFS_RDNT_ENQ(to);
+	slablist_add(Q, enq, 0);
 }
 
 
@@ -720,43 +1967,9 @@ just_q(selem_t z, selem_t *e, uint64_t sz)
  * code, but takes an appropriate callback.
  */
 void
-add_connected(lg_graph_t *g, gelem_t origin, selem_t zero, slablist_fold_t cb)
+add_connected(lg_graph_t *g, gelem_t origin, selem_t zero, nbrs_cb_t *cb)
 {
-	gelem_t min_to;
-	gelem_t max_to;
-	selem_t min_edge;
-	selem_t max_edge;
-
-	min_to.ge_u = 0;
-	max_to.ge_u = UINT64_MAX;
-	edge_t min;
-	edge_t max;
-	w_edge_t w_min;
-	w_edge_t w_max;
-
-	if (g->gr_type == GRAPH || g->gr_type == DIGRAPH) {
-		min.ed_from = origin;
-		min.ed_to = min_to;
-
-		max.ed_from = origin;
-		max.ed_to = max_to;
-
-		min_edge.sle_p = &min;
-		max_edge.sle_p = &max;
-	} else {
-		w_min.wed_from = origin;
-		w_min.wed_to = min_to;
-		w_min.wed_weight.ge_u = 0;
-
-		w_max.wed_from = origin;
-		w_max.wed_to = max_to;
-		w_max.wed_weight.ge_u = UINT64_MAX;
-
-		min_edge.sle_p = &w_min;
-		max_edge.sle_p = &w_max;
-	}
-	slablist_foldr_range(g->gr_edges, cb, min_edge,
-	max_edge, zero);
+	graph_nbrs(g, origin, cb, zero.sle_p);
 }
 
 /*
@@ -783,13 +1996,13 @@ enq_rdnt_connected(lg_graph_t *g, gelem_t origin, selem_t zero)
  * Sometimes we just want a enqueue a single node (usually the start-node).
  */
 void
-enq_origin(slablist_t *Q, slablist_t *V, gelem_t origin)
+enq_origin(lg_graph_t *g, slablist_t *Q, vset_t *V, gelem_t origin)
 {
 	GRAPH_BFS_ENQ(origin);
 	selem_t enq;
 	enq.sle_u = origin.ge_u;
 	slablist_add(Q, enq, 0);
-	slablist_add(V, enq, 0);
+	vset_gadd(g, V, origin);
 }
 
 /*
@@ -818,79 +2031,24 @@ deq(slablist_t *Q)
 }
 
 /*
- * Similar in principle to enq_origin, but we push a stack_elem, which may
- * contain a bookmark, which is pointing to the first 'edge' that connects the
- * origin to another gelem.
+ * The BFS queue is either a slablist, or the ring-buffer of a workspace.
  */
-void
-push(slablist_t *S, stack_elem_t *s)
-{
-	selem_t push;
-	push.sle_p = s;
-	slablist_add(S, push, 0);
-}
-
-/*
- * This gives us the pointer to the last bmark on the stack, but _doesn't_
- * remove it.
- */
-stack_elem_t *
-last_se(slablist_t *S)
+static uint64_t
+bfs_qlen(args_t *args)
 {
-	selem_t slast = slablist_end(S);
-	uint64_t elems = slablist_get_elems(S);
-	if (!elems) {
-		return (NULL);
+	if (args->a_ctx != NULL) {
+		return (args->a_ctx->tc_qn);
 	}
-	stack_elem_t *last;
-	last = slast.sle_p;
-	return (last);
-}
-
-/*
- * Returns the last stack_elem, and pops it.
- */
-static stack_elem_t *
-pop(lg_graph_t *g, slablist_t *S)
-{
-	(void)g;
-	selem_t slast = slablist_end(S);
-	uint64_t elems = slablist_get_elems(S);
-	slablist_rem(S, ignored, (elems - 1), NULL);
-	stack_elem_t *last;
-	last = slast.sle_p;
-	return (last);
+	return (slablist_get_elems(args->a_q));
 }
 
-/*
- * Returns the last stack_elem, pops it from the regular stack, and from the
- * branch-stack if present.
- */
-static stack_elem_t *
-br_pop(lg_graph_t *g, slablist_t *S, slablist_t *B)
+static gelem_t
+bfs_deq(args_t *args)
 {
-	(void)g;
-	selem_t slast = slablist_end(S);
-	uint64_t elems = slablist_get_elems(S);
-	slablist_rem(S, ignored, (elems - 1), NULL);
-
-	stack_elem_t *last;
-	last = slast.sle_p;
-
-	/*
-	 * We can safely assume that if the node on top of stack S is present
-	 * in slack B, it will also be at the end -- if it's not, we've screwed
-	 * up the stack handling code.
-	 */
-	elems = slablist_get_elems(B);
-	if (elems) {
-		selem_t blast = slablist_end(B);
-		if (blast.sle_p == last->se_node.ge_p) {
-			slablist_rem(B, ignored, (elems - 1), NULL);
-		}
+	if (args->a_ctx != NULL) {
+		return (trav_deq(args->a_ctx));
 	}
-
-	return (last);
+	return (deq(args->a_q));
 }
 
 /*
@@ -912,42 +2070,66 @@ br_pop(lg_graph_t *g, slablist_t *S, slablist_t *B)
  *
  * This aggregation can be used to compute arbitrary things like shortest path,
  * centrality values, and so on.
+ *
+ * bfs_fold() implements lg_bfs_fold() and lg_bfs_fold_ctx(). If `tc` is NULL,
+ * the queue and the visited-set are created for this traversal alone.
  */
-gelem_t
-lg_bfs_fold(lg_graph_t *g, gelem_t start, adj_cb_t *acb, fold_cb_t *cb, gelem_t gzero)
+static gelem_t
+bfs_fold(lg_graph_t *g, lg_trav_ctx_t *tc, gelem_t start, adj_cb_t *acb,
+    fold_cb_t *cb, gelem_t gzero)
 {
+	if (g->gr_epoch != NULL) {
+		epoch_slot_t *es;
+		csr_t *cs = epoch_enter(g, &es);
+		gelem_t r = csr_bfs_fold(g, cs, start, acb, cb, gzero);
+		epoch_exit(es);
+		return (r);
+	}
+	if (g->gr_csr != NULL) {
+		return (csr_bfs_fold(g, g->gr_csr, start, acb, cb, gzero));
+	}
 	/*
 	 * First we create an appropriate queue and visited-set.
 	 */
 	GRAPH_BFS_BEGIN(g);
-	uint64_t nedges = slablist_get_elems(g->gr_edges);
-	if (nedges == 0) {
+	if (lg_nedges(g) == 0) {
 		return (gzero);
 	}
 	args_t args;
 	selem_t zero;
 	zero.sle_p = &args;
-	slablist_t *Q;
-	slablist_t *V;
-	Q = slablist_create("graph_bfs_queue", NULL, NULL, SL_ORDERED);
-	V = slablist_create("graph_bfs_vset", gelem_cmp, gelem_bnd,
-	    SL_SORTED);
+	slablist_t *Q = NULL;
+	vset_t vs;
+	vset_t *V = &vs;
+	if (tc != NULL) {
+		vset_init_ctx(g, V, tc);
+	} else {
+		Q = slablist_create("graph_bfs_queue", NULL, NULL, SL_ORDERED);
+		vset_init(g, V, "graph_bfs_vset");
+	}
 
 	args.a_g = g;
 	args.a_cb = cb;
 	args.a_acb = acb;
 	args.a_q = Q;
 	args.a_v = V;
+	args.a_ctx = tc;
 	args.a_agg = gzero;
 	/*
 	 * Here we execute BFS. We enqueue all the nodes connected to start,
 	 * and we loop through BFS, until we reach the terminating condition --
 	 * or visit all of the nodes.
 	 */
-	enq_origin(Q, V, start);
+	if (tc != NULL) {
+		GRAPH_BFS_ENQ(start);
+		trav_enq(tc, start);
+		vset_gadd(g, V, start);
+	} else {
+		enq_origin(g, Q, V, start);
+	}
 	if (cb != NULL) {
-		while (slablist_get_elems(Q) > 0) {
-			gelem_t last = deq(Q);
+		while (bfs_qlen(&args) > 0) {
+			gelem_t last = bfs_deq(&args);
 			GRAPH_BFS_DEQ(last);
 			int stat = cb(args.a_agg, last, &(args.a_agg));
 			if (stat) {
@@ -955,26 +2137,45 @@ lg_bfs_fold(lg_graph_t *g, gelem_t start, adj_cb_t *acb, fold_cb_t *cb, gelem_t
 				 * The user should save what he's looking for
 				 * in a_agg.
 				 */
-				slablist_destroy(Q, NULL);
-				slablist_destroy(V, NULL);
-				GRAPH_BFS_END(g);
-				return (args.a_agg);
+				break;
 			}
 			enq_connected(g, last, zero);
 		}
 	} else {
-		while (slablist_get_elems(Q) > 0) {
-			gelem_t last = deq(Q);
+		while (bfs_qlen(&args) > 0) {
+			gelem_t last = bfs_deq(&args);
 			GRAPH_BFS_DEQ(last);
 			enq_connected(g, last, zero);
 		}
 	}
-	slablist_destroy(Q, NULL);
-	slablist_destroy(V, NULL);
+	if (Q != NULL) {
+		slablist_destroy(Q, NULL);
+	}
+	vset_destroy(V);
 	GRAPH_BFS_END(g);
 	return (args.a_agg);
 }
 
+gelem_t
+lg_bfs_fold(lg_graph_t *g, gelem_t start, adj_cb_t *acb, fold_cb_t *cb, gelem_t gzero)
+{
+	return (bfs_fold(g, NULL, start, acb, cb, gzero));
+}
+
+/*
+ * Like lg_bfs_fold(), but the queue and the visited-set are those of the
+ * workspace `tc` (see graph_trav.c), which can be reused by any number of
+ * traversals, so that a traversal doesn't have to create and destroy them.
+ * Frozen and concurrent graphs are walked as by lg_bfs_fold(), since their
+ * traversals use flat arrays anyway.
+ */
+gelem_t
+lg_bfs_fold_ctx(lg_graph_t *g, lg_trav_ctx_t *tc, gelem_t start,
+    adj_cb_t *acb, fold_cb_t *cb, gelem_t gzero)
+{
+	return (bfs_fold(g, tc, start, acb, cb, gzero));
+}
+
 /*
  * A 'redundant' version of BFS. It walks over nodes in level-order just like
  * normal BFS, however it doesn't skip nodes that it has already visited. This
@@ -986,12 +2187,22 @@ gelem_t
 lg_bfs_rdnt_fold(lg_graph_t *g, gelem_t start, adj_cb_t *acb, fold_cb_t *cb,
     gelem_t gzero)
 {
+	if (g->gr_epoch != NULL) {
+		epoch_slot_t *es;
+		csr_t *cs = epoch_enter(g, &es);
+		gelem_t r = csr_bfs_rdnt_fold(g, cs, start, acb, cb, gzero);
+		epoch_exit(es);
+		return (r);
+	}
+	if (g->gr_csr != NULL) {
+		return (csr_bfs_rdnt_fold(g, g->gr_csr, start, acb, cb,
+		    gzero));
+	}
 	/*
 	 * First we create an appropriate queue.
 	 */
 	GRAPH_BFS_RDNT_BEGIN(g);
-	uint64_t nedges = slablist_get_elems(g->gr_edges);
-	if (nedges == 0) {
+	if (lg_nedges(g) == 0) {
 		return (gzero);
 	}
 
@@ -1042,361 +2253,90 @@ lg_bfs_rdnt_fold(lg_graph_t *g, gelem_t start, adj_cb_t *acb, fold_cb_t *cb,
 
 }
 
-slablist_bm_t *
-edge_bm(lg_graph_t *g, gelem_t start)
-{
-	slablist_bm_t *bm = slablist_bm_create();
-	selem_t slret;
-	edge_t start_e;
-	edge_t end_e;
-	w_edge_t start_we;
-	w_edge_t end_we;
-	selem_t start_edge;
-	selem_t end_edge;
-
-	switch (g->gr_type) {
-
-	case GRAPH:
-	case DIGRAPH:
-		start_e.ed_from = start;
-		start_e.ed_to.ge_u = 0;
-		end_e.ed_from = start;
-		end_e.ed_to.ge_u = UINT64_MAX;
-		start_edge.sle_p = &start_e;
-		end_edge.sle_p = &end_e;
-		break;
-	case GRAPH_WE:
-	case DIGRAPH_WE:
-		start_we.wed_from = start;
-		start_we.wed_to.ge_u = 0;
-		start_we.wed_weight.ge_u = 0;
-		end_we.wed_from = start;
-		end_we.wed_to.ge_u = UINT64_MAX;
-		end_we.wed_weight.ge_u = UINT64_MAX;
-		start_edge.sle_p = &start_we;
-		end_edge.sle_p = &end_we;
-		break;
-	}
-
-	int sr = slablist_range_min(g->gr_edges, bm, start_edge, end_edge,
-	    &slret);
-	if (sr != 0) {
-		slablist_bm_destroy(bm);
-		return (NULL);
-	}
-	return (bm);
-}
-
-/*
- * This function returns a bookmark to an edge A->B, if A is pushable. A is
- * pushable if it hasn't been visited before, and if it is reachable from the
- * edge pointed to by `last`. If this function doesn't find any unvisited nodes
- * from the edges emanating from the node in `last`, it returns NULL.
- *
- * We should also go over some constraints on what the value of the bookmark
- * `last` can be. `last` begins life, point to an edge A->B. It is incremented
- * to point to other edges contain A in the `from` member -- A->X, A->Y, A->Z,
- * and so forth. It can _never_ point to any edge that doesn't contain A in the
- * `from` member.
- */
-stack_elem_t *
-get_pushable(lg_graph_t *g, slablist_t *V, stack_elem_t *last_se)
-{
-	slablist_bm_t *last = last_se->se_bm;
-	/*
-	 * We're trying to find an unvisited neighbor of a node that has no
-	 * outgoing neighbors.
-	 */
-	if (last == NULL) {
-		return (NULL);
-	}
-	slablist_t *edges = g->gr_edges;
-	selem_t curelem;
-	slablist_cur(edges, last, &curelem);
-	edge_t *e;
-	w_edge_t *we;
-	gelem_t adj;
-	gelem_t parent;
-	/*
-	 * We try to find a child that wasn't visited.
-	 */
-	if (g->gr_type == GRAPH || g->gr_type == DIGRAPH) {
-		e = curelem.sle_p;
-		GRAPH_DFS_BM(g, last, e->ed_from, e->ed_to);
-		parent.ge_u = e->ed_from.ge_u;
-		adj.ge_u = e->ed_to.ge_u;
-		while (1) {
-			/*
-			 * If we've never visited `adj`, we break out
-			 * of this loop and return a bookmark to it.
-			 */
-			if (!gvisited(V, adj)) {
-				break;
-			}
-			/* We check out the next edge, if we have one */
-			int end = slablist_next(edges, last, &curelem);
-			if (end) {
-				slablist_prev(edges, last, &curelem);
-				e = curelem.sle_p;
-				GRAPH_DFS_BM(g, last, e->ed_from, e->ed_to);
-				return (NULL);
-			}
-			e = curelem.sle_p;
-			GRAPH_DFS_BM(g, last, e->ed_from, e->ed_to);
-			/*
-			 * If this new edge doesn't contain a `from` node that
-			 * is identical to `parent`, we rewind the bookmark so
-			 * that it points the last node that contained
-			 * `parent`, and we return NULL, indicating that there
-			 * are no adjacent nodes that we can visit.
-			 */
-			if (parent.ge_u != e->ed_from.ge_u) {
-				slablist_prev(edges, last, &curelem);
-				e = curelem.sle_p;
-				GRAPH_DFS_BM(g, last, e->ed_from, e->ed_to);
-				return (NULL);
-			}
-			/* otherwise, we update `parent`, and `adj`. */
-			parent.ge_u = e->ed_from.ge_u;
-			adj.ge_u = e->ed_to.ge_u;
-			e = curelem.sle_p;
-			GRAPH_DFS_BM(g, last, e->ed_from, e->ed_to);
-		}
-	} else {
-		we = curelem.sle_p;
-		GRAPH_DFS_BM(g, last, we->wed_from, we->wed_to);
-		parent.ge_u = we->wed_from.ge_u;
-		adj.ge_u = we->wed_to.ge_u;
-		while (1) {
-			/*
-			 * If we've never visited `adj`, we break out
-			 * of this loop and return a bookmark to it.
-			 */
-			if (!gvisited(V, adj)) {
-				break;
-			}
-			/* We check out the next edge, if we have one */
-			int end = slablist_next(edges, last, &curelem);
-			if (end) {
-				slablist_prev(edges, last, &curelem);
-				e = curelem.sle_p;
-				GRAPH_DFS_BM(g, last, we->wed_from, we->wed_to);
-				return (NULL);
-			}
-			we = curelem.sle_p;
-			GRAPH_DFS_BM(g, last, we->wed_from, we->wed_to);
-			/*
-			 * If this new edge doesn't contain a `from` node that
-			 * is identical to `parent`, we rewind the bookmark so
-			 * that it points the last node that contained
-			 * `parent`, and we return NULL, indicating that there
-			 * are no adjacent nodes that we can visit.
-			 */
-			if (parent.ge_u != we->wed_from.ge_u) {
-				slablist_prev(edges, last, &curelem);
-				we = curelem.sle_p;
-				GRAPH_DFS_BM(g, last, we->wed_from, we->wed_to);
-				return (NULL);
-			}
-			/* otherwise, we update `parent`, and `adj`. */
-			parent.ge_u = we->wed_from.ge_u;
-			adj.ge_u = we->wed_to.ge_u;
-			we = curelem.sle_p;
-			GRAPH_DFS_BM(g, last, we->wed_from, we->wed_to);
-		}
-	}
-	slablist_bm_t *bm = edge_bm(g, adj);
-	stack_elem_t *pushable = lg_mk_stack_elem();
-	pushable->se_node = adj;
-	pushable->se_bm = bm;
-	return (pushable);
-}
-
-/*
- * This is the redundant variant of the previous function. It doesn't have to
- * search for an unvisited child-node -- it merely returns the next child-node,
- * until there are no more child-nodes to return. Therefor, there is no need
- * for loops and such.
- */
-stack_elem_t *
-get_pushable_rdnt(lg_graph_t *g, stack_elem_t *last_se)
-{
-	if (last_se == NULL) {
-		return (NULL);
-	}
-	slablist_bm_t *last = last_se->se_bm;
-	/*
-	 * We're trying to find an unvisited neighbor of a node that has no
-	 * outgoing neighbors.
-	 */
-	if (last == NULL || last_se->se_end) {
-		return (NULL);
-	}
-	slablist_t *edges = g->gr_edges;
-	selem_t curelem;
-	slablist_cur(edges, last, &curelem);
-	edge_t *e;
-	w_edge_t *we;
-	gelem_t adj;
-	if (g->gr_type == GRAPH || g->gr_type == DIGRAPH) {
-		e = curelem.sle_p;
-		GRAPH_DFS_RDNT_BM(g, last, e->ed_from, e->ed_to);
-		adj.ge_u = e->ed_to.ge_u;
-		/*
-		 * If `adj` isn't a child of `se_node`, we rewind and return
-		 * NULL.
-		 */
-		if (last_se->se_node.ge_u != e->ed_from.ge_u) {
-			slablist_prev(edges, last, &curelem);
-			e = curelem.sle_p;
-			GRAPH_DFS_RDNT_BM(g, last, e->ed_from, e->ed_to);
-			return (NULL);
-		}
-		/* We advance the bookmark for the next call */
-		int end = slablist_next(edges, last, &curelem);
-		if (end) {
-			slablist_prev(edges, last, &curelem);
-			e = curelem.sle_p;
-			GRAPH_DFS_RDNT_BM(g, last, e->ed_from, e->ed_to);
-			last_se->se_end = end;
-		}
-		e = curelem.sle_p;
-		GRAPH_DFS_RDNT_BM(g, last, e->ed_from, e->ed_to);
-	} else {
-		we = curelem.sle_p;
-		GRAPH_DFS_RDNT_BM(g, last, we->wed_from, we->wed_to);
-		adj.ge_u = we->wed_to.ge_u;
-		if (last_se->se_node.ge_u != we->wed_from.ge_u) {
-			slablist_prev(edges, last, &curelem);
-			we = curelem.sle_p;
-			GRAPH_DFS_RDNT_BM(g, last, we->wed_from, we->wed_to);
-			return (NULL);
-		}
-		/* We check out the next edge, if we have one */
-		int end = slablist_next(edges, last, &curelem);
-		if (end) {
-			slablist_prev(edges, last, &curelem);
-			e = curelem.sle_p;
-			GRAPH_DFS_RDNT_BM(g, last, we->wed_from, we->wed_to);
-			last_se->se_end = end;
-		}
-		we = curelem.sle_p;
-		GRAPH_DFS_RDNT_BM(g, last, we->wed_from, we->wed_to);
-	}
-	slablist_bm_t *bm = edge_bm(g, adj);
-	stack_elem_t *pushable = lg_mk_stack_elem();
-	pushable->se_node = adj;
-	pushable->se_bm = bm;
-	return (pushable);
-}
-
 /*
- * Used by slablist_map to free stack_elem_t's and destroy their bookmarks.
+ * Pops the top of `S`, and pops it off of the branch-stack `B` as well, if it
+ * is on top of it.
  */
-void
-free_stack_elem(selem_t *e, uint64_t sz)
+static gelem_t
+dfs_br_pop(dfs_stack_t *S, dfs_stack_t *B)
 {
-	uint64_t i = 0;
-	while (i < sz) {
-		stack_elem_t *se = e[i].sle_p;
-		slablist_bm_destroy(se->se_bm);
-		lg_rm_stack_elem(se);
-		i++;
+	gelem_t n = dfs_pop(S);
+	dfs_frame_t *b = dfs_top(B);
+	if (b != NULL && b->df_node.ge_u == n.ge_u) {
+		(void) dfs_pop(B);
 	}
+	return (n);
 }
 
 /*
  * For a DFS, we begin at node `start`. We add `start` to a stack, visit its
  * first child and add it to the stack. Visit child's first child and so on.
  * When we hit bottom, or an already visited node, we go back up the stack go
- * the next child (which is supported the slablist's 'bookmark' feature --- we
- * have bookmarks on the edge-list, 1 bookmark for each gelem on the stack).
- * The book marks are stored in a slablist the 'mirror' the stack (which is
- * also a slablist).
+ * the next child. Each frame of the stack has a cursor into the neighbors of
+ * its node, which are copied onto the stack when the node is pushed (see
+ * dfs_stack_t).
+ *
+ * dfs_fold() implements lg_dfs_fold() and lg_dfs_fold_ctx(). If `tc` is NULL,
+ * the stack and the visited-set are created for this traversal alone.
  */
-gelem_t
-lg_dfs_fold(lg_graph_t *g, gelem_t start, pop_cb_t *pcb, fold_cb_t *cb,
-    gelem_t gzero)
+static gelem_t
+dfs_fold(lg_graph_t *g, lg_trav_ctx_t *tc, gelem_t start, pop_cb_t *pcb,
+    fold_cb_t *cb, gelem_t gzero)
 {
+	if (g->gr_epoch != NULL) {
+		epoch_slot_t *es;
+		csr_t *cs = epoch_enter(g, &es);
+		gelem_t r = csr_dfs_fold(g, cs, start, pcb, cb, gzero);
+		epoch_exit(es);
+		return (r);
+	}
+	if (g->gr_csr != NULL) {
+		return (csr_dfs_fold(g, g->gr_csr, start, pcb, cb, gzero));
+	}
 	GRAPH_DFS_BEGIN(g);
-	uint64_t nedges = slablist_get_elems(g->gr_edges);
-	if (nedges == 0) {
+	if (lg_nedges(g) == 0) {
 		return (gzero);
 	}
 
-	args_t args;
-
-	slablist_t *S;
-	slablist_t *V;
-
-	S = slablist_create("graph_dfs_stack", NULL, NULL, SL_ORDERED);
-	V = slablist_create("graph_dfs_vset", gelem_cmp, gelem_bnd, SL_SORTED);
-
-	args.a_g = g;
-	args.a_cb = cb;
-	args.a_q = S;
-	args.a_v = V;
-	args.a_agg = gzero;
+	gelem_t agg = gzero;
+	dfs_stack_t stack;
+	dfs_stack_t *S = &stack;
+	vset_t vs;
+	vset_t *V = &vs;
+	if (tc != NULL) {
+		vset_init_ctx(g, V, tc);
+		S = &tc->tc_stack;
+	} else {
+		bzero(S, sizeof (dfs_stack_t));
+		vset_init(g, V, "graph_dfs_vset");
+	}
 
-	slablist_bm_t *bm = edge_bm(g, start);
-	stack_elem_t *last_pushed = lg_mk_stack_elem();
-	last_pushed->se_node = start;
-	last_pushed->se_bm = bm;
+	dfs_push(g, S, start);
 	/*
 	 * `start` has no outgoing edges, so we just call `cb` on `start`, and
 	 * return.
 	 */
-	int stat = 0;
-	if (bm == NULL) {
-		stat = cb(args.a_agg, start, &(args.a_agg));
-		return (args.a_agg);
+	if (S->ds_nn == 0) {
+		(void)cb(agg, start, &agg);
+		goto done;
 	}
-
-	selem_t sedge;
-	edge_t *e;
-	w_edge_t *we;
 	GRAPH_DFS_PUSH(g, start);
-	push(S, last_pushed);
-	gelem_t par_pushed;
-	slablist_cur(g->gr_edges, bm, &sedge);
-	if (g->gr_type == GRAPH || g->gr_type == DIGRAPH) {
-		e = sedge.sle_p;
-		par_pushed.ge_u = e->ed_from.ge_u;
-	} else {
-		we = sedge.sle_p;
-		par_pushed.ge_u = we->wed_from.ge_u;
-	}
-	stat = cb(args.a_agg, par_pushed, &(args.a_agg));
-	if (stat) {
-		slablist_map(S, free_stack_elem);
-		slablist_destroy(S, NULL);
-		slablist_destroy(V, NULL);
-		GRAPH_DFS_END(g);
-		return (args.a_agg);
-	}
-	selem_t visited;
-	visited.sle_u = par_pushed.ge_u;
-	slablist_add(V, visited, 0);
-	stack_elem_t *pushable;
+	if (cb(agg, start, &agg)) {
+		goto done;
+	}
+	vset_gadd(g, V, start);
+	gelem_t adj;
 
 try_continue:;
-	while ((pushable =
-	    get_pushable(g, V, last_pushed)) != NULL) {
-		GRAPH_DFS_PUSH(g, pushable->se_node);
-		push(S, pushable);
-		last_pushed = last_se(S);
-		stat = cb(args.a_agg, pushable->se_node,
-		    &(args.a_agg));
+	while (dfs_pushable(S, V, &adj)) {
+		GRAPH_DFS_BM(g, dfs_top(S), dfs_top(S)->df_node, adj);
+		GRAPH_DFS_PUSH(g, adj);
+		dfs_push(g, S, adj);
 		/* we've met our terminating condition */
-		if (stat) {
-			slablist_map(S, free_stack_elem);
-			slablist_destroy(S, NULL);
-			slablist_destroy(V, NULL);
-			GRAPH_DFS_END(g);
-			return (args.a_agg);
+		if (cb(agg, adj, &agg)) {
+			goto done;
 		}
-		visited.sle_u = pushable->se_node.ge_u;
-		slablist_add(V, visited, 0);
+		vset_gadd(g, V, adj);
 	}
 
 	/*
@@ -1405,118 +2345,108 @@ try_continue:;
 	 * doing this until the stack is empty.
 	 */
 pop_again:;
-	int popstat = 0;
-	stack_elem_t *popped = NULL;
-	uint64_t depth = slablist_get_elems(S);
-	if (depth > 1) {
-		popped = pop(g, S);
-		GRAPH_DFS_POP(g, popped->se_node);
-		if (pcb != NULL) {
-			popstat = pcb(popped->se_node, args.a_agg);
-		}
-		if (popped->se_bm != NULL) {
-			slablist_bm_destroy(popped->se_bm);
-		}
-		lg_rm_stack_elem(popped);
-		last_pushed = last_se(S);
-		if (popstat == 1) {
-			goto pop_again;
-		}
-		goto try_continue;
-	} else if (depth == 1) {
-		popped = pop(g, S);
-		GRAPH_DFS_POP(g, popped->se_node);
+	if (S->ds_depth > 0) {
+		gelem_t popped = dfs_pop(S);
+		GRAPH_DFS_POP(g, popped);
+		int popstat = 0;
 		if (pcb != NULL) {
-			(void)pcb(popped->se_node, args.a_agg);
+			popstat = pcb(popped, agg);
 		}
-		if (popped->se_bm != NULL) {
-			slablist_bm_destroy(popped->se_bm);
+		if (S->ds_depth > 0) {
+			if (popstat == 1) {
+				goto pop_again;
+			}
+			goto try_continue;
 		}
-		lg_rm_stack_elem(popped);
 	}
-	slablist_destroy(S, NULL);
-	slablist_destroy(V, NULL);
+done:
+	if (tc == NULL) {
+		dfs_stack_destroy(S);
+	}
+	vset_destroy(V);
 	GRAPH_DFS_END(g);
-	return (args.a_agg);
+	return (agg);
+}
+
+gelem_t
+lg_dfs_fold(lg_graph_t *g, gelem_t start, pop_cb_t *pcb, fold_cb_t *cb,
+    gelem_t gzero)
+{
+	return (dfs_fold(g, NULL, start, pcb, cb, gzero));
 }
 
 /*
- * This is a 'redundant' version of DFS. It visits nodes more than once. Will
- * loop infinitely on graphs with cycles, so be careful.
+ * Like lg_dfs_fold(), but the stack and the visited-set are those of the
+ * workspace `tc` (see graph_trav.c), which can be reused by any number of
+ * traversals. Frozen and concurrent graphs are walked as by lg_dfs_fold().
  */
 gelem_t
-lg_dfs_rdnt_fold(lg_graph_t *g, gelem_t start, pop_cb_t *pcb, fold_cb_t *cb,
-    gelem_t gzero)
+lg_dfs_fold_ctx(lg_graph_t *g, lg_trav_ctx_t *tc, gelem_t start,
+    pop_cb_t *pcb, fold_cb_t *cb, gelem_t gzero)
+{
+	return (dfs_fold(g, tc, start, pcb, cb, gzero));
+}
+
+/*
+ * Implements lg_dfs_rdnt_fold() and lg_dfs_br_rdnt_fold(). If `brcb` is NULL,
+ * we behave like the former, otherwise like the latter.
+ */
+static gelem_t
+dfs_rdnt_fold(lg_graph_t *g, gelem_t start, br_cb_t *brcb, pop_cb_t *pcb,
+    fold_cb_t *cb, gelem_t gzero)
 {
+	if (g->gr_epoch != NULL) {
+		epoch_slot_t *es;
+		csr_t *cs = epoch_enter(g, &es);
+		gelem_t r = csr_dfs_rdnt_fold(g, cs, start, brcb, pcb, cb,
+		    gzero);
+		epoch_exit(es);
+		return (r);
+	}
+	if (g->gr_csr != NULL) {
+		return (csr_dfs_rdnt_fold(g, g->gr_csr, start, brcb, pcb, cb,
+		    gzero));
+	}
 	GRAPH_DFS_RDNT_BEGIN(g);
-	uint64_t nedges = slablist_get_elems(g->gr_edges);
-	if (nedges == 0) {
+	if (lg_nedges(g) == 0) {
 		return (gzero);
 	}
 
-	args_t args;
-
-	slablist_t *S;
+	gelem_t agg = gzero;
+	dfs_stack_t S;
+	dfs_stack_t B;
+	bzero(&S, sizeof (dfs_stack_t));
+	bzero(&B, sizeof (dfs_stack_t));
 
-	S = slablist_create("graph_dfs_stack", NULL, NULL, SL_ORDERED);
-
-	args.a_g = g;
-	args.a_cb = cb;
-	args.a_q = S;
-	args.a_v = NULL;
-	args.a_agg = gzero;
-
-	slablist_bm_t *bm = edge_bm(g, start);
-	stack_elem_t *last_pushed = lg_mk_stack_elem();
-	last_pushed->se_node = start;
-	last_pushed->se_bm = bm;
+	dfs_push(g, &S, start);
 	/*
 	 * `start` has no outgoing edges, so we just call `cb` on `start`, and
 	 * return.
 	 */
-	int stat = 0;
-	if (bm == NULL) {
-		stat = cb(args.a_agg, start, &(args.a_agg));
-		return (args.a_agg);
+	if (S.ds_nn == 0) {
+		(void)cb(agg, start, &agg);
+		goto done;
 	}
-
-	selem_t sedge;
-	edge_t *e;
-	w_edge_t *we;
 	GRAPH_DFS_RDNT_PUSH(g, start);
-	push(S, last_pushed);
-	gelem_t par_pushed;
-	slablist_cur(g->gr_edges, bm, &sedge);
-	if (g->gr_type == GRAPH || g->gr_type == DIGRAPH) {
-		e = sedge.sle_p;
-		par_pushed.ge_u = e->ed_from.ge_u;
-	} else {
-		we = sedge.sle_p;
-		par_pushed.ge_u = we->wed_from.ge_u;
+	if (cb(agg, start, &agg)) {
+		goto done;
 	}
-	stat = cb(args.a_agg, par_pushed, &(args.a_agg));
-	if (stat) {
-		slablist_map(S, free_stack_elem);
-		slablist_destroy(S, NULL);
-		GRAPH_DFS_RDNT_END(g);
-		return (args.a_agg);
+	if (brcb != NULL && brcb(start)) {
+		dfs_push(NULL, &B, start);
 	}
-	stack_elem_t *pushable;
+	gelem_t adj;
 
 try_continue:;
-	while ((pushable =
-	    get_pushable_rdnt(g, last_pushed)) != NULL) {
-		GRAPH_DFS_RDNT_PUSH(g, pushable->se_node);
-		push(S, pushable);
-		last_pushed = last_se(S);
-		stat = cb(args.a_agg, pushable->se_node,
-		    &(args.a_agg));
+	while (dfs_pushable(&S, NULL, &adj)) {
+		GRAPH_DFS_RDNT_BM(g, dfs_top(&S), dfs_top(&S)->df_node, adj);
+		GRAPH_DFS_RDNT_PUSH(g, adj);
+		dfs_push(g, &S, adj);
 		/* we've met our terminating condition */
-		if (stat) {
-			slablist_map(S, free_stack_elem);
-			slablist_destroy(S, NULL);
-			GRAPH_DFS_RDNT_END(g);
-			return (args.a_agg);
+		if (cb(agg, adj, &agg)) {
+			goto done;
+		}
+		if (brcb != NULL && brcb(adj)) {
+			dfs_push(NULL, &B, adj);
 		}
 	}
 
@@ -1526,77 +2456,46 @@ try_continue:;
 	 * doing this until the stack is empty.
 	 */
 pop_again:;
-	int popstat = 0;
-	stack_elem_t *popped = NULL;
-	uint64_t depth = slablist_get_elems(S);
-	if (depth > 1) {
-		popped = pop(g, S);
-		GRAPH_DFS_RDNT_POP(g, popped->se_node);
+	if (S.ds_depth > 0) {
+		gelem_t popped = dfs_br_pop(&S, &B);
+		GRAPH_DFS_RDNT_POP(g, popped);
+		int popstat = 0;
 		if (pcb != NULL) {
-			popstat = pcb(popped->se_node, args.a_agg);
+			popstat = pcb(popped, agg);
 		}
-		if (popped->se_bm != NULL) {
-			slablist_bm_destroy(popped->se_bm);
+		if (S.ds_depth == 0) {
+			goto done;
 		}
-		lg_rm_stack_elem(popped);
-		last_pushed = last_se(S);
-		if (popstat) {
+		if (popstat == 1 || (brcb == NULL && popstat)) {
 			goto pop_again;
 		}
-		goto try_continue;
-	} else if (depth == 1) {
-		popped = pop(g, S);
-		GRAPH_DFS_RDNT_POP(g, popped->se_node);
-		if (pcb != NULL) {
-			(void)pcb(popped->se_node, args.a_agg);
-		}
-		if (popped->se_bm != NULL) {
-			slablist_bm_destroy(popped->se_bm);
+		if (popstat == 2) {
+			/* pop to branch */
+			while (S.ds_depth > 0 && (B.ds_depth == 0 ||
+			    dfs_top(&S)->df_node.ge_u !=
+			    dfs_top(&B)->df_node.ge_u)) {
+				popped = dfs_br_pop(&S, &B);
+				GRAPH_DFS_RDNT_POP(g, popped);
+			}
 		}
-		lg_rm_stack_elem(popped);
+		goto try_continue;
 	}
-	slablist_destroy(S, NULL);
+done:
+	dfs_stack_destroy(&S);
+	dfs_stack_destroy(&B);
 	GRAPH_DFS_RDNT_END(g);
-	return (args.a_agg);
-}
-
-/*
- * We just add to the brancher stack, but want to hide the boilerplate.
- */
-void
-add_as_branch(lg_graph_t *g, slablist_t *branchers, gelem_t n)
-{
-	/*
-	 * We don't need a bookmark, because the regular stack would have the
-	 * same exact bookmark. But we leave the commented code here just in
-	 * case minds change.
-	 */
-	//slablist_bm_t *bm = edge_bm(g, n);
-	//stack_elem_t *stack_elem = lg_mk_stack_elem();
-	//last_pushed->se_node = n;
-	//last_pushed->se_bm = bm;
-	(void)g;
-	selem_t s;
-	s.sle_p = n.ge_p;
-	(void)slablist_add(branchers, s, 0);
+	return (agg);
 }
 
 /*
- * This gives us the pointer to the last gelem_t on the branching stack stack,
- * but _doesn't_ remove it.
+ * This is a 'redundant' version of DFS. It visits nodes more than once. Will
+ * loop infinitely on graphs with cycles, so be careful.
  */
 gelem_t
-last_be(slablist_t *B)
+lg_dfs_rdnt_fold(lg_graph_t *g, gelem_t start, pop_cb_t *pcb, fold_cb_t *cb,
+    gelem_t gzero)
 {
-	selem_t slast = slablist_end(B);
-	uint64_t elems = slablist_get_elems(B);
-	gelem_t last;
-	if (!elems) {
-		last.ge_p = NULL;
-		return (last);
-	}
-	last.ge_p = slast.sle_p;
-	return (last);
+	return (dfs_rdnt_fold(g, start, NULL, pcb, cb, gzero));
 }
 
 /*
@@ -1606,212 +2505,23 @@ last_be(slablist_t *B)
  * 'branching' node. Branching nodes are placed in a parallel stack. The idea
  * is that a callback can indicate if a branch has 'failed' and instead of
  * popping to the parent, we pop to the ancestor that's a branching node. We
- * then continue DFSing down the next child (which we get to by incrementing
- * that sl_bmark).
+ * then continue DFSing down the next child (which we get to by advancing the
+ * cursor of that node's frame).
  */
 gelem_t
 lg_dfs_br_rdnt_fold(lg_graph_t *g, gelem_t start, br_cb_t *brcb, pop_cb_t *pcb,
     fold_cb_t *cb, gelem_t gzero)
 {
-	GRAPH_DFS_RDNT_BEGIN(g);
-	uint64_t nedges = slablist_get_elems(g->gr_edges);
-	if (nedges == 0) {
-		return (gzero);
-	}
-
-	args_t args;
-
-	slablist_t *S;
-	slablist_t *B;
-
-	S = slablist_create("graph_dfs_stack", NULL, NULL, SL_ORDERED);
-	B = slablist_create("graph_br_stack", NULL, NULL, SL_ORDERED);
-
-	args.a_g = g;
-	args.a_cb = cb;
-	args.a_q = S;
-	args.a_v = NULL;
-	args.a_agg = gzero;
-
-	slablist_bm_t *bm = edge_bm(g, start);
-	stack_elem_t *last_pushed = lg_mk_stack_elem();
-	last_pushed->se_node = start;
-	last_pushed->se_bm = bm;
-	/*
-	 * `start` has no outgoing edges, so we just call `cb` on `start`, and
-	 * return.
-	 */
-	int stat = 0;
-	if (bm == NULL) {
-		stat = cb(args.a_agg, start, &(args.a_agg));
-		return (args.a_agg);
-	}
-
-	selem_t sedge;
-	edge_t *e;
-	w_edge_t *we;
-	GRAPH_DFS_RDNT_PUSH(g, start);
-	push(S, last_pushed);
-	gelem_t par_pushed;
-	slablist_cur(g->gr_edges, bm, &sedge);
-	if (g->gr_type == GRAPH || g->gr_type == DIGRAPH) {
-		e = sedge.sle_p;
-		par_pushed.ge_u = e->ed_from.ge_u;
-	} else {
-		we = sedge.sle_p;
-		par_pushed.ge_u = we->wed_from.ge_u;
-	}
-	stat = cb(args.a_agg, par_pushed, &(args.a_agg));
-	if (stat) {
-		slablist_map(S, free_stack_elem);
-		slablist_destroy(S, NULL);
-		GRAPH_DFS_RDNT_END(g);
-		return (args.a_agg);
-	}
-	int is_br = brcb(par_pushed);
-	if (is_br) {
-		add_as_branch(g, B, par_pushed);
-	}
-
-	stack_elem_t *pushable;
-
-try_continue:;
-	while ((pushable =
-	    get_pushable_rdnt(g, last_pushed)) != NULL) {
-		GRAPH_DFS_RDNT_PUSH(g, pushable->se_node);
-		push(S, pushable);
-		last_pushed = last_se(S);
-		stat = cb(args.a_agg, pushable->se_node,
-		    &(args.a_agg));
-		/* we've met our terminating condition */
-		if (stat) {
-			slablist_map(S, free_stack_elem);
-			slablist_destroy(S, NULL);
-			GRAPH_DFS_RDNT_END(g);
-			return (args.a_agg);
-		}
-		is_br = brcb(pushable->se_node);
-		if (is_br) {
-			add_as_branch(g, B, pushable->se_node);
-		}
-	}
-
-	/*
-	 * We've reached the bottom. We want to pop one element off of the
-	 * stack, and then we want to try to continue to DFS search. We keep
-	 * doing this until the stack is empty.
-	 */
-pop_again:;
-	int popstat = 0;
-	stack_elem_t *popped = NULL;
-	uint64_t depth = slablist_get_elems(S);
-	GRAPH_GOT_HERE(depth);
-	if (depth > 1) {
-		popped = br_pop(g, S, B);
-		GRAPH_DFS_RDNT_POP(g, popped->se_node);
-		if (pcb != NULL) {
-			popstat = pcb(popped->se_node, args.a_agg);
-		}
-		if (popped->se_bm != NULL) {
-			slablist_bm_destroy(popped->se_bm);
-		}
-		lg_rm_stack_elem(popped);
-		last_pushed = last_se(S);
-		if (popstat == 1) {
-			goto pop_again;
-		} else if (popstat == 2) {
-			/* pop to branch */
-			/* TODO make this a separate function */
-			stack_elem_t *tmp_se = last_se(S);
-			gelem_t tmp_be = last_be(B);
-			while (tmp_se != NULL &&
-			    tmp_se->se_node.ge_p != tmp_be.ge_p) {
-				popped = br_pop(g, S, B);
-				GRAPH_DFS_RDNT_POP(g, popped->se_node);
-				if (popped->se_bm != NULL) {
-					slablist_bm_destroy(popped->se_bm);
-				}
-				lg_rm_stack_elem(popped);
-				tmp_se = last_se(S);
-			}
-			last_pushed = tmp_se;
-		}
-		goto try_continue;
-	} else if (depth == 1) {
-		popped = br_pop(g, S, B);
-		GRAPH_DFS_RDNT_POP(g, popped->se_node);
-		if (pcb != NULL) {
-			(void)pcb(popped->se_node, args.a_agg);
-		}
-		if (popped->se_bm != NULL) {
-			slablist_bm_destroy(popped->se_bm);
-		}
-		lg_rm_stack_elem(popped);
-	}
-	slablist_destroy(S, NULL);
-	GRAPH_DFS_RDNT_END(g);
-	return (args.a_agg);
+	return (dfs_rdnt_fold(g, start, brcb, pcb, cb, gzero));
 }
 
 typedef struct edges_args {
+	lg_graph_t	*ea_g;
 	edges_cb_t	*ea_cb;
 	edges_arg_cb_t	*ea_acb;
 	gelem_t		ea_arg;
-	slablist_t	*ea_dict;
 } edges_args_t;
 
-selem_t
-graph_foldr_w_edges_cb(selem_t zero, selem_t *e, uint64_t sz)
-{
-	edges_args_t *a = zero.sle_p;
-	gelem_t arg = a->ea_arg;
-	edges_arg_cb_t *acb = a->ea_acb;
-	edges_cb_t *cb = a->ea_cb;
-	slablist_t *sl = a->ea_dict;
-	uint64_t i = 0;
-	while (i < sz) {
-		int touched = slablist_add(sl, e[i], 0);
-		if (!touched) {
-			w_edge_t *edge = e[i].sle_p;
-			gelem_t weight;
-			weight = edge->wed_weight;
-			if (acb != NULL) {
-				acb(edge->wed_from, edge->wed_to, weight, arg);
-			} else {
-				cb(edge->wed_from, edge->wed_to, weight);
-			}
-		}
-		i++;
-	}
-	return (zero);
-}
-
-selem_t
-graph_foldr_edges_cb(selem_t zero, selem_t *e, uint64_t sz)
-{
-	edges_args_t *a = zero.sle_p;
-	gelem_t arg = a->ea_arg;
-	edges_cb_t *cb = a->ea_cb;
-	edges_arg_cb_t *acb = a->ea_acb;
-	slablist_t *sl = a->ea_dict;
-	uint64_t i = 0;
-	gelem_t weight;
-	weight.ge_d = 0;
-	while (i < sz) {
-		int touched = slablist_add(sl, e[i], 0);
-		if (!touched) {
-			edge_t *edge = e[i].sle_p;
-			if (acb != NULL) {
-				acb(edge->ed_from, edge->ed_to, weight, arg);
-			} else {
-				cb(edge->ed_from, edge->ed_to, weight);
-			}
-		}
-		i++;
-	}
-	return (zero);
-}
-
 selem_t
 digraph_foldr_w_edges_cb(selem_t zero, selem_t *e, uint64_t sz)
 {
@@ -1842,169 +2552,57 @@ digraph_foldr_edges_cb(selem_t zero, selem_t *e, uint64_t sz)
 	edges_arg_cb_t *acb = a->ea_acb;
 	gelem_t arg = a->ea_arg;
 	uint64_t i = 0;
+	gelem_t from;
+	gelem_t to;
 	gelem_t weight;
-	weight.ge_d = 0;
 	while (i < sz) {
-		edge_t *edge = e[i].sle_p;
+		edge_get(a->ea_g, e[i], &from, &to, &weight);
 		if (acb != NULL) {
-			acb(edge->ed_from, edge->ed_to, weight, arg);
+			acb(from, to, weight, arg);
 		} else {
-			cb(edge->ed_from, edge->ed_to, weight);
+			cb(from, to, weight);
 		}
 		i++;
 	}
 	return (zero);
 }
 
-int
-uniq_edge_cmp(selem_t e1, selem_t e2)
-{
-	edge_t *edge1 = e1.sle_p;
-	edge_t *edge2 = e2.sle_p;
-	edge_t tmp1;
-	edge_t tmp2;
-	/*
-	 * By convention, we place the numerically smaller pointer/integer in
-	 * the `ed_to` field while the larger one is in the `ed_from` field.
-	 * This way, we effectively "deduplicate" the edges. Deduplicating the
-	 * edges, causes us to walk over the same edge only once. This is the
-	 * illusion we want to preserve -- that we are dealing with an
-	 * undirected graph.
-	 */
-	if (edge1->ed_from.ge_u < edge1->ed_to.ge_u) {
-		tmp1.ed_from.ge_u = edge1->ed_to.ge_u;
-		tmp1.ed_to.ge_u = edge1->ed_from.ge_u;
-	} else {
-		tmp1.ed_from.ge_u = edge1->ed_from.ge_u;
-		tmp1.ed_to.ge_u = edge1->ed_to.ge_u;
-	}
-	if (edge2->ed_from.ge_u < edge2->ed_to.ge_u) {
-		tmp2.ed_from.ge_u = edge2->ed_to.ge_u;
-		tmp2.ed_to.ge_u = edge2->ed_from.ge_u;
-	} else {
-		tmp2.ed_from.ge_u = edge2->ed_from.ge_u;
-		tmp2.ed_to.ge_u = edge2->ed_to.ge_u;
-	}
-	if (tmp1.ed_from.ge_u < tmp2.ed_from.ge_u) {
-		return (-1);
-	}
-	if (tmp1.ed_from.ge_u > tmp2.ed_from.ge_u) {
-		return (1);
-	}
-	if (tmp1.ed_to.ge_u < tmp2.ed_to.ge_u) {
-		return (-1);
-	}
-	if (tmp1.ed_to.ge_u > tmp2.ed_to.ge_u) {
-		return (1);
-	}
-	return (0);
-}
-
-int
-uniq_w_edge_cmp(selem_t e1, selem_t e2)
-{
-	w_edge_t *edge1 = e1.sle_p;
-	w_edge_t *edge2 = e2.sle_p;
-	w_edge_t tmp1;
-	w_edge_t tmp2;
-	if (edge1->wed_from.ge_u > edge1->wed_from.ge_u) {
-		tmp1.wed_from.ge_u = edge1->wed_to.ge_u;
-		tmp1.wed_to.ge_u = edge1->wed_from.ge_u;
-	} else {
-		tmp1.wed_from.ge_u = edge1->wed_from.ge_u;
-		tmp1.wed_to.ge_u = edge1->wed_to.ge_u;
-	}
-	if (edge2->wed_from.ge_u > edge2->wed_from.ge_u) {
-		tmp2.wed_from.ge_u = edge2->wed_to.ge_u;
-		tmp2.wed_to.ge_u = edge2->wed_from.ge_u;
-	} else {
-		tmp2.wed_from.ge_u = edge2->wed_from.ge_u;
-		tmp2.wed_to.ge_u = edge2->wed_to.ge_u;
-	}
-	if (tmp1.wed_from.ge_u < tmp2.wed_from.ge_u) {
-		return (-1);
-	}
-	if (tmp1.wed_from.ge_u > tmp2.wed_from.ge_u) {
-		return (1);
-	}
-	if (tmp1.wed_to.ge_u < tmp2.wed_to.ge_u) {
-		return (-1);
-	}
-	if (tmp1.wed_to.ge_u > tmp2.wed_to.ge_u) {
-		return (1);
-	}
-	if (edge1->wed_weight.ge_u < edge2->wed_weight.ge_u) {
-		return (-1);
-	}
-	if (edge1->wed_weight.ge_u > edge2->wed_weight.ge_u) {
-		return (1);
-	}
-	return (0);
-}
-
-int
-uniq_edge_bnd(selem_t e, selem_t min, selem_t max)
-{
-	if (uniq_edge_cmp(e, min) < 0) {
-		return (-1);
-	}
-	if (uniq_edge_cmp(e, max) > 0) {
-		return (1);
-	}
-	return (0);
-}
-
-int
-uniq_w_edge_bnd(selem_t e, selem_t min, selem_t max)
-{
-	if (uniq_w_edge_cmp(e, min) < 0) {
-		return (-1);
-	}
-	if (uniq_w_edge_cmp(e, max) > 0) {
-		return (1);
-	}
-	return (0);
-}
-
 void
 lg_edges(lg_graph_t *g, edges_cb_t *cb)
 {
+	edges_args_t args;
+	gelem_t ignored;
+	ignored.ge_u = 0;
+	if (g->gr_epoch != NULL) {
+		epoch_slot_t *es;
+		csr_t *cs = epoch_enter(g, &es);
+		csr_edges(g, cs, cb, NULL, ignored);
+		epoch_exit(es);
+		return;
+	}
+	if (g->gr_csr != NULL) {
+		csr_edges(g, g->gr_csr, cb, NULL, ignored);
+		return;
+	}
 	/*
-	 * If this is just a directed graph, then it's a matter of a simple
-	 * foldr.
+	 * Undirected graphs store every edge once, so for any kind of graph
+	 * this is a matter of a simple foldr.
 	 */
-	edges_args_t args;
+	args.ea_g = g;
 	args.ea_acb = NULL;
 	args.ea_cb = cb;
-	args.ea_dict = NULL;
 	selem_t zero;
 	zero.sle_p = &args;
 	switch (g->gr_type) {
 
 	case DIGRAPH:
-		slablist_foldr(g->gr_edges, digraph_foldr_edges_cb, zero);
-		break;
-
 	case GRAPH:
-		/*
-		 * This slab-list uses a special comparison function to single
-		 * out unique edges in an undirected graph.
-		 */
-		args.ea_dict = slablist_create("ea_dict", uniq_edge_cmp,
-		    uniq_edge_bnd, SL_SORTED);
-		slablist_foldr(g->gr_edges, graph_foldr_edges_cb, zero);
-		slablist_destroy(args.ea_dict, NULL);
+		edges_foldr(g, digraph_foldr_edges_cb, zero);
 		break;
 
 	case DIGRAPH_WE:
-		slablist_foldr(g->gr_edges, digraph_foldr_w_edges_cb, zero);
-		break;
-
 	case GRAPH_WE:
-		args.ea_dict = slablist_create("ea_dict", uniq_w_edge_cmp,
-		    uniq_w_edge_bnd, SL_SORTED);
-		slablist_foldr(g->gr_edges, graph_foldr_w_edges_cb, zero);
-		slablist_destroy(args.ea_dict, NULL);
+		edges_foldr(g, digraph_foldr_w_edges_cb, zero);
 		break;
 	}
 }
@@ -2012,54 +2610,58 @@ lg_edges(lg_graph_t *g, edges_cb_t *cb)
 void
 lg_edges_arg(lg_graph_t *g, edges_arg_cb_t *acb, gelem_t arg)
 {
+	edges_args_t args;
+	if (g->gr_epoch != NULL) {
+		epoch_slot_t *es;
+		csr_t *cs = epoch_enter(g, &es);
+		csr_edges(g, cs, NULL, acb, arg);
+		epoch_exit(es);
+		return;
+	}
+	if (g->gr_csr != NULL) {
+		csr_edges(g, g->gr_csr, NULL, acb, arg);
+		return;
+	}
 	/*
-	 * If this is just a directed graph, then it's a matter of a simple
-	 * foldr.
+	 * Undirected graphs store every edge once, so for any kind of graph
+	 * this is a matter of a simple foldr.
 	 */
-	edges_args_t args;
+	args.ea_g = g;
 	args.ea_cb = NULL;
 	args.ea_acb = acb;
 	args.ea_arg = arg;
-	args.ea_dict = NULL;
 	selem_t zero;
 	zero.sle_p = &args;
 	switch (g->gr_type) {
 
 	case DIGRAPH:
-		slablist_foldr(g->gr_edges, digraph_foldr_edges_cb, zero);
-		break;
-
 	case GRAPH:
-		/*
-		 * This slab-list uses a special comparison function to single
-		 * out unique edges in an undirected graph.
-		 */
-		args.ea_dict = slablist_create("ea_dict", uniq_edge_cmp,
-		    uniq_edge_bnd, SL_SORTED);
-		slablist_foldr(g->gr_edges, graph_foldr_edges_cb, zero);
-		slablist_destroy(args.ea_dict, NULL);
+		edges_foldr(g, digraph_foldr_edges_cb, zero);
 		break;
 
 	case DIGRAPH_WE:
-		slablist_foldr(g->gr_edges, digraph_foldr_w_edges_cb, zero);
-		break;
-
 	case GRAPH_WE:
-		args.ea_dict = slablist_create("ea_dict", uniq_w_edge_cmp,
-		    uniq_w_edge_bnd, SL_SORTED);
-		slablist_foldr(g->gr_edges, graph_foldr_w_edges_cb, zero);
-		slablist_destroy(args.ea_dict, NULL);
+		edges_foldr(g, digraph_foldr_w_edges_cb, zero);
 		break;
 	}
 }
 
+typedef struct flip_args {
+	lg_graph_t	*fa_src;
+	lg_graph_t	*fa_dst;
+} flip_args_t;
+
 selem_t
 digraph_foldr_flip_cb(selem_t zero, selem_t *e, uint64_t sz)
 {
+	flip_args_t *fa = zero.sle_p;
+	gelem_t from;
+	gelem_t to;
+	gelem_t w;
 	uint64_t i = 0;
 	while (i < sz) {
-		edge_t *edge = e[i].sle_p;
-		lg_connect(zero.sle_p, edge->ed_to, edge->ed_from);
+		edge_get(fa->fa_src, e[i], &from, &to, &w);
+		lg_connect(fa->fa_dst, to, from);
 		i++;
 	}
 	return (zero);
@@ -2093,6 +2695,7 @@ lg_graph_t *
 lg_flip_edges(lg_graph_t *g)
 {
 	selem_t zero;
+	flip_args_t fa;
 	lg_graph_t *g2 = NULL;
 	switch (g->gr_type) {
 
@@ -2103,78 +2706,62 @@ lg_flip_edges(lg_graph_t *g)
 
 	case DIGRAPH:
 		g2 = lg_create_digraph();
-		zero.sle_p = g2;
-		slablist_foldr(g->gr_edges, digraph_foldr_flip_cb, zero);
+		(void) lg_edgestrat(g2, g->gr_edgestrat);
+		fa.fa_src = g;
+		fa.fa_dst = g2;
+		zero.sle_p = &fa;
+		edges_foldr(g, digraph_foldr_flip_cb, zero);
 		break;
 
 	case DIGRAPH_WE:
 		g2 = lg_create_wdigraph();
 		zero.sle_p = g2;
-		slablist_foldr(g->gr_edges, digraph_foldr_w_flip_cb, zero);
+		edges_foldr(g, digraph_foldr_w_flip_cb, zero);
 		break;
 
 	}
 	return (g2);
 }
 
+static void
+neighbors_nbr_cb(gelem_t n, gelem_t adj, uint64_t k, gelem_t w, void *arg)
+{
+	edges_args_t *a = arg;
+	(void)k;
+	if (a->ea_acb != NULL) {
+		a->ea_acb(n, adj, w, a->ea_arg);
+	} else {
+		a->ea_cb(n, adj, w);
+	}
+}
+
 /*
  * This function walks over the edges that are outgoing from the node `n`. It's
  * kind of like the first iteration of BFS, except it's faster, and doesn't
- * require queues or visited-sets.
- *
- * You'll notice that the implementation is similar to the lg_edges function,
- * except that it uses a ranged fold instead of a regular fold, and doesn't
- * need a special slablist undirected graphs.
+ * require queues or visited-sets. In an undirected graph, every edge of `n`
+ * is passed to `cb` as (n, neighbor, weight), whichever way it is stored.
  */
 void
 lg_neighbors(lg_graph_t *g, gelem_t n, edges_cb_t *cb)
 {
 	edges_args_t args;
+	gelem_t ignored;
+	ignored.ge_u = 0;
+	if (g->gr_epoch != NULL) {
+		epoch_slot_t *es;
+		csr_t *cs = epoch_enter(g, &es);
+		csr_neighbors(cs, n, cb, NULL, ignored);
+		epoch_exit(es);
+		return;
+	}
+	if (g->gr_csr != NULL) {
+		csr_neighbors(g->gr_csr, n, cb, NULL, ignored);
+		return;
+	}
+	args.ea_g = g;
 	args.ea_acb = NULL;
 	args.ea_cb = cb;
-	args.ea_dict = NULL;
-	selem_t zero;
-	zero.sle_p = &args;
-
-	edge_t emin;
-	edge_t emax;
-	selem_t s_emin;
-	selem_t s_emax;
-	s_emin.sle_p = &emin;
-	s_emax.sle_p = &emax;
-
-	w_edge_t wemin;
-	w_edge_t wemax;
-	selem_t s_wemin;
-	selem_t s_wemax;
-	s_wemin.sle_p = &wemin;
-	s_wemax.sle_p = &wemax;
-
-	switch (g->gr_type) {
-
-	case DIGRAPH:
-	case GRAPH:
-		emin.ed_from.ge_u = n.ge_u;
-		emin.ed_to.ge_u = 0;
-		emax.ed_from.ge_u = n.ge_u;
-		emax.ed_to.ge_u = UINT64_MAX;
-		slablist_foldr_range(g->gr_edges, digraph_foldr_edges_cb,
-		    s_emin, s_emax, zero);
-		break;
-
-
-	case DIGRAPH_WE:
-	case GRAPH_WE:
-		wemin.wed_from.ge_u = n.ge_u;
-		wemin.wed_to.ge_u = 0;
-		wemin.wed_weight.ge_u = 0;
-		wemax.wed_from.ge_u = n.ge_u;
-		wemax.wed_to.ge_u = UINT64_MAX;
-		wemax.wed_weight.ge_u = UINT64_MAX;
-		slablist_foldr_range(g->gr_edges, digraph_foldr_w_edges_cb,
-		    s_wemin, s_wemax, zero);
-		break;
-	}
+	graph_nbrs(g, n, neighbors_nbr_cb, &args);
 }
 
 /*
@@ -2185,55 +2772,154 @@ void
 lg_neighbors_arg(lg_graph_t *g, gelem_t n, edges_arg_cb_t *cb, gelem_t arg)
 {
 	edges_args_t args;
+	if (g->gr_epoch != NULL) {
+		epoch_slot_t *es;
+		csr_t *cs = epoch_enter(g, &es);
+		csr_neighbors(cs, n, NULL, cb, arg);
+		epoch_exit(es);
+		return;
+	}
+	if (g->gr_csr != NULL) {
+		csr_neighbors(g->gr_csr, n, NULL, cb, arg);
+		return;
+	}
+	args.ea_g = g;
 	args.ea_acb = cb;
 	args.ea_cb = NULL;
-	args.ea_dict = NULL;
 	args.ea_arg = arg;
-	selem_t zero;
-	zero.sle_p = &args;
-
-	edge_t emin;
-	edge_t emax;
-	selem_t s_emin;
-	selem_t s_emax;
-	s_emin.sle_p = &emin;
-	s_emax.sle_p = &emax;
+	graph_nbrs(g, n, neighbors_nbr_cb, &args);
+}
 
-	w_edge_t wemin;
-	w_edge_t wemax;
-	selem_t s_wemin;
-	selem_t s_wemax;
-	s_wemin.sle_p = &wemin;
-	s_wemax.sle_p = &wemax;
+selem_t
+in_index_fold_cb(selem_t zero, selem_t *e, uint64_t sz)
+{
+	lg_graph_t *g = zero.sle_p;
+	uint64_t i = 0;
+	while (i < sz) {
+		(void) slablist_add(g->gr_in_edges, in_elem(g, e[i]), 0);
+		i++;
+	}
+	return (zero);
+}
 
-	switch (g->gr_type) {
+/*
+ * Builds the incoming-edge index of a directed graph, or the mirror of an
+ * undirected one. This is done the first time somebody asks for the
+ * in-neighbors (or, if undirected, the neighbors) of a node. From then on, the
+ * index is maintained by edge_add() and edge_rem(), and all of the functions
+ * that change edges (including rollback) keep it up to date.
+ */
+void
+in_index_build(lg_graph_t *g)
+{
+	if (g->gr_in_edges != NULL) {
+		return;
+	}
+	if (EDGE_PACKED(g)) {
+		g->gr_in_edges = slablist_create("in_edges", gelem_cmp,
+		    gelem_bnd, SL_SORTED);
+	} else if (g->gr_type == DIGRAPH || g->gr_type == GRAPH) {
+		g->gr_in_edges = slablist_create("in_edges", in_edge_cmp,
+		    in_edge_bnd, SL_SORTED);
+	} else {
+		g->gr_in_edges = slablist_create("in_edges", in_w_edge_cmp,
+		    in_w_edge_bnd, SL_SORTED);
+	}
+	selem_t zero;
+	zero.sle_p = g;
+	edges_foldr(g, in_index_fold_cb, zero);
+}
 
-	case DIGRAPH:
-	case GRAPH:
-		emin.ed_from.ge_u = n.ge_u;
-		emin.ed_to.ge_u = 0;
-		emax.ed_from.ge_u = n.ge_u;
-		emax.ed_to.ge_u = UINT64_MAX;
-		slablist_foldr_range(g->gr_edges, digraph_foldr_edges_cb,
-		    s_emin, s_emax, zero);
-		break;
+selem_t
+in_neighbors_fold_cb(selem_t zero, selem_t *e, uint64_t sz)
+{
+	edges_args_t *a = zero.sle_p;
+	lg_graph_t *g = a->ea_g;
+	gelem_t from;
+	gelem_t to;
+	gelem_t w;
+	uint64_t i = 0;
+	while (i < sz) {
+		edge_get(g, e[i], &from, &to, &w);
+		if (EDGE_PACKED(g)) {
+			/* packed entries of the index are stored reversed */
+			gelem_t tmp = from;
+			from = to;
+			to = tmp;
+		}
+		if (a->ea_acb != NULL) {
+			a->ea_acb(from, to, w, a->ea_arg);
+		} else {
+			a->ea_cb(from, to, w);
+		}
+		i++;
+	}
+	return (zero);
+}
 
+static void
+in_neighbors_common(lg_graph_t *g, gelem_t n, edges_args_t *args)
+{
+	ekey_t kmin;
+	ekey_t kmax;
+	selem_t min;
+	selem_t max;
+	if (mirror_range(g, n, &kmin, &kmax, &min, &max) != 0) {
+		return;
+	}
+	in_index_build(g);
+	selem_t zero;
+	zero.sle_p = args;
+	slablist_foldr_range(g->gr_in_edges, in_neighbors_fold_cb, min, max,
+	    zero);
+}
 
-	case DIGRAPH_WE:
-	case GRAPH_WE:
-		wemin.wed_from.ge_u = n.ge_u;
-		wemin.wed_to.ge_u = 0;
-		wemin.wed_weight.ge_u = 0;
-		wemax.wed_from.ge_u = n.ge_u;
-		wemax.wed_to.ge_u = UINT64_MAX;
-		wemax.wed_weight.ge_u = UINT64_MAX;
-		slablist_foldr_range(g->gr_edges, digraph_foldr_w_edges_cb,
-		    s_wemin, s_wemax, zero);
-		break;
+/*
+ * Calls `cb` on every edge that points _to_ `n`, in order of the source node.
+ * The callback receives the edge as it is stored: (from, n, weight). For
+ * undirected graphs, this is the same as lg_neighbors(). Sharded graphs have
+ * no incoming-edge index, so `cb` is never called on them.
+ */
+void
+lg_in_neighbors(lg_graph_t *g, gelem_t n, edges_cb_t *cb)
+{
+	edges_args_t args;
+	if (g->gr_type == GRAPH || g->gr_type == GRAPH_WE) {
+		lg_neighbors(g, n, cb);
+		return;
+	}
+	if (g->gr_shards != NULL) {
+		return;
 	}
+	args.ea_g = g;
+	args.ea_acb = NULL;
+	args.ea_cb = cb;
+	in_neighbors_common(g, n, &args);
+}
 
+void
+lg_in_neighbors_arg(lg_graph_t *g, gelem_t n, edges_arg_cb_t *cb,
+    gelem_t arg)
+{
+	edges_args_t args;
+	if (g->gr_type == GRAPH || g->gr_type == GRAPH_WE) {
+		lg_neighbors_arg(g, n, cb, arg);
+		return;
+	}
+	if (g->gr_shards != NULL) {
+		return;
+	}
+	args.ea_g = g;
+	args.ea_acb = cb;
+	args.ea_cb = NULL;
+	args.ea_arg = arg;
+	in_neighbors_common(g, n, &args);
 }
 
+/*
+ * The DEDUP strategy sorts changes by snapshot, and then by edge, so that the
+ * change of an edge in a snapshot can be looked up (see snap_add()).
+ */
 int
 snap_cmp(selem_t e1, selem_t e2)
 {
@@ -2246,12 +2932,6 @@ snap_cmp(selem_t e1, selem_t e2)
 	if (c1->ch_snap < c2->ch_snap) {
 		return (-1);
 	}
-	if (c1->ch_op > c2->ch_op) {
-		return (1);
-	}
-	if (c1->ch_op < c2->ch_op) {
-		return (-1);
-	}
 	if (c1->ch_from.ge_u > c2->ch_from.ge_u) {
 		return (1);
 	}
@@ -2264,12 +2944,24 @@ snap_cmp(selem_t e1, selem_t e2)
 	if (c1->ch_to.ge_u < c2->ch_to.ge_u) {
 		return (-1);
 	}
+	if (c1->ch_op > c2->ch_op) {
+		return (1);
+	}
+	if (c1->ch_op < c2->ch_op) {
+		return (-1);
+	}
 	if (c1->ch_weight.ge_u > c2->ch_weight.ge_u) {
 		return (1);
 	}
 	if (c1->ch_weight.ge_u < c2->ch_weight.ge_u) {
 		return (-1);
 	}
+	if ((uintptr_t)c1->ch_batch > (uintptr_t)c2->ch_batch) {
+		return (1);
+	}
+	if ((uintptr_t)c1->ch_batch < (uintptr_t)c2->ch_batch) {
+		return (-1);
+	}
 	return (0);
 }
 
@@ -2287,6 +2979,45 @@ snap_bnd(selem_t e, selem_t min, selem_t max)
 	return (0);
 }
 
+/*
+ * The FAST strategy sorts changes by snapshot, and then in the order in which
+ * they were made, so that the changes made since a snapshot form a range.
+ */
+int
+seq_cmp(selem_t e1, selem_t e2)
+{
+	change_t *c1 = e1.sle_p;
+	change_t *c2 = e2.sle_p;
+
+	if (c1->ch_snap > c2->ch_snap) {
+		return (1);
+	}
+	if (c1->ch_snap < c2->ch_snap) {
+		return (-1);
+	}
+	if (c1->ch_seq > c2->ch_seq) {
+		return (1);
+	}
+	if (c1->ch_seq < c2->ch_seq) {
+		return (-1);
+	}
+	return (0);
+}
+
+int
+seq_bnd(selem_t e, selem_t min, selem_t max)
+{
+	int c = seq_cmp(e, min);
+	if (c < 0) {
+		return (-1);
+	}
+	c = seq_cmp(e, max);
+	if (c > 0) {
+		return (1);
+	}
+	return (0);
+}
+
 /*
  * The snap_cb is called on every edge that is affected by a change.
  * This is typically used to increase or decrease a reference count in structs
@@ -2316,8 +3047,8 @@ lg_snapshot(lg_graph_t *g)
 		switch (g->gr_snapstrat) {
 
 		case SNAP_FAST:
-			g->gr_snaps = slablist_create("snapshots", NULL, NULL,
-					SL_ORDERED);
+			g->gr_snaps = slablist_create("snapshots", seq_cmp,
+					seq_bnd, SL_SORTED);
 			break;
 		case SNAP_DEDUP:
 			g->gr_snaps = slablist_create("snapshots", snap_cmp,
@@ -2327,6 +3058,7 @@ lg_snapshot(lg_graph_t *g)
 	}
 	uint64_t r = g->gr_snap;
 	g->gr_snap++;
+	ckpt_snapshot(g, r);
 	return (r);
 }
 
@@ -2337,223 +3069,570 @@ lg_snapstrat(lg_graph_t *g, snap_strat_t s)
 }
 
 /*
- * Creates a clone of graph `g` at snapshot `snap`. To create a clone, we
- * create an identical copy of `g`. On this copy, we carry out a rollback
- * (using the snapshot data stored in `g`, so that we save space). Unlike
- * clones in other systems like ZFS, cloned graphs do _not_ occupy any less
- * space than identical but uncloned graphs.
+ * Selects how the edges of `g` are stored (see the comment above edge_t in
+ * graph_impl.h). The strategy can only be changed while the graph has no
+ * edges and isn't sharded, and the packed strategies are only available for
+ * unweighted graphs.
+ * Returns 0 on success, and -1 otherwise.
  */
-lg_graph_t *
-lg_clone(lg_graph_t *g, uint64_t snap)
+int
+lg_edgestrat(lg_graph_t *g, edge_strat_t s)
 {
-	if (snap >= g->gr_snap || g->gr_snaps == NULL) {
-		return (NULL);
+	if (s == g->gr_edgestrat) {
+		return (0);
 	}
-	/* XXX temporary to stop compiler warnings */
-	lg_graph_t *c = g;
-	return (c);
+	if (edges_nelems(g) > 0 || g->gr_csr != NULL ||
+	    g->gr_shards != NULL) {
+		return (-1);
+	}
+	if (g->gr_type == GRAPH_WE || g->gr_type == DIGRAPH_WE) {
+		return (-1);
+	}
+	lg_compact(g);
+	char *name = "digraph_edges";
+	if (g->gr_type == GRAPH) {
+		name = "graph_edges";
+	}
+	slablist_destroy(g->gr_edges, NULL);
+	/* the in-edge index is sorted according to the old strategy */
+	if (g->gr_in_edges != NULL) {
+		slablist_destroy(g->gr_in_edges, NULL);
+		g->gr_in_edges = NULL;
+	}
+	nodes_destroy(g);
+	dict_destroy(g->gr_dict);
+	g->gr_dict = NULL;
+	switch (s) {
+
+	case EDGE_PTR:
+		g->gr_edges = slablist_create(name, graph_edge_cmp,
+		    graph_edge_bnd, SL_SORTED);
+		break;
+	case EDGE_DENSE:
+		g->gr_dict = dict_create();
+		/* FALLTHROUGH */
+	case EDGE_INLINE:
+		g->gr_edges = slablist_create(name, gelem_cmp, gelem_bnd,
+		    SL_SORTED);
+		break;
+	}
+	g->gr_edgestrat = s;
+	return (0);
 }
 
-selem_t
-rollback_fold_fast(selem_t z, selem_t *e, uint64_t sz)
+/*
+ * A rollback doesn't replay the change-log backwards. Instead, it takes the
+ * state of every edge that changed since the snapshot, as a view of the graph
+ * at that snapshot records it (see graph_view.c), and makes each such edge
+ * what it was: `re_present` says whether the edge existed at the snapshot,
+ * and `re_w` is its weight back then. Every edge is thus touched once, no
+ * matter how many times it changed, and an edge that was connected and then
+ * disconnected again isn't touched at all.
+ *
+ * If the edges to restore are numerous, compared to the graph, they are
+ * merged with the old edge-list into a new one, in a single pass, like a
+ * large batch is (see batch_merge()). Otherwise they are looked up one by
+ * one.
+ */
+typedef struct rb_ent {
+	uint64_t	re_kf;
+	uint64_t	re_kt;
+	gelem_t		re_from;
+	gelem_t		re_to;
+	gelem_t		re_w;
+	int		re_present;
+} rb_ent_t;
+
+static int
+rb_ent_cmp(const void *a, const void *b)
 {
-	lg_graph_t *g = z.sle_p;
-	gelem_t ignored;
-	uint64_t i = sz - 1;
-	uint64_t j = 0;
-	while (j < sz) {
-		change_t *c = e[i].sle_p;
-		GRAPH_ROLLBACK_CHANGE(g, c);
-		if (c->ch_snap >= g->gr_rollback_to) {
-			switch (c->ch_op) {
+	const rb_ent_t *r1 = a;
+	const rb_ent_t *r2 = b;
+	if (r1->re_kf != r2->re_kf) {
+		return (r1->re_kf < r2->re_kf ? -1 : 1);
+	}
+	if (r1->re_kt != r2->re_kt) {
+		return (r1->re_kt < r2->re_kt ? -1 : 1);
+	}
+	return (0);
+}
 
-			case CONNECT:
-				switch (g->gr_type) {
-
-				case DIGRAPH:
-				case GRAPH:
-					lg_disconnect(g, c->ch_from, c->ch_to);
-					g->gr_snap_cb(0, EDGE, c->ch_from, c->ch_to,
-					    ignored);
-					break;
-
-				case DIGRAPH_WE:
-				case GRAPH_WE:
-					lg_wdisconnect(g, c->ch_from,
-					    c->ch_to, c->ch_weight);
-					g->gr_snap_cb(0, EDGE, c->ch_from, c->ch_to,
-					    c->ch_weight);
-					break;
-				}
-				break;
+typedef struct rb_collect {
+	lg_graph_t	*rbc_g;
+	rb_ent_t	*rbc_ents;
+	uint64_t	rbc_n;
+} rb_collect_t;
 
-			case DISCONNECT:
-				switch (g->gr_type) {
-
-				case DIGRAPH:
-				case GRAPH:
-					lg_connect(g, c->ch_from, c->ch_to);
-					g->gr_snap_cb(1, EDGE, c->ch_from, c->ch_to,
-					    ignored);
-					break;
-
-				case DIGRAPH_WE:
-				case GRAPH_WE:
-					lg_wconnect(g, c->ch_from,
-					    c->ch_to, c->ch_weight);
-					g->gr_snap_cb(1, EDGE, c->ch_from, c->ch_to,
-					    c->ch_weight);
-					break;
+static selem_t
+rb_collect_cb(selem_t zero, selem_t *e, uint64_t sz)
+{
+	rb_collect_t *rbc = zero.sle_p;
+	lg_graph_t *g = rbc->rbc_g;
+	uint64_t i = 0;
+	while (i < sz) {
+		view_ent_t *ve = e[i].sle_p;
+		rb_ent_t *r = &rbc->rbc_ents[rbc->rbc_n];
+		i++;
+		if (ve->ve_mirror) {
+			continue;
+		}
+		r->re_from = ve->ve_edge.wed_from;
+		r->re_to = ve->ve_edge.wed_to;
+		r->re_w = ve->ve_edge.wed_weight;
+		r->re_present = ve->ve_present;
+		edge_canon(g, &r->re_from, &r->re_to);
+		if (node_key(g, r->re_from, &r->re_kf) != 0 ||
+		    node_key(g, r->re_to, &r->re_kt) != 0) {
+			/* never connected, so it can't be in the graph */
+			continue;
+		}
+		rbc->rbc_n++;
+	}
+	return (zero);
+}
+
+static selem_t
+rb_elem(lg_graph_t *g, rb_ent_t *r)
+{
+	selem_t se;
+	w_edge_t *we;
+	if (g->gr_type == GRAPH_WE || g->gr_type == DIGRAPH_WE) {
+		we = lg_mk_w_edge(g);
+		we->wed_from = r->re_from;
+		we->wed_to = r->re_to;
+		we->wed_weight = r->re_w;
+		se.sle_p = we;
+		return (se);
+	}
+	return (edge_new(g, r->re_from, r->re_to));
+}
+
+/*
+ * Gives the existing edge `se` its state at the snapshot. Returns non-zero if
+ * the edge has to go.
+ */
+static int
+rb_existing(lg_graph_t *g, selem_t se, rb_ent_t *r)
+{
+	gelem_t from;
+	gelem_t to;
+	gelem_t w;
+	if (r->re_present) {
+		if ((g->gr_type == GRAPH_WE || g->gr_type == DIGRAPH_WE) &&
+		    ((w_edge_t *)se.sle_p)->wed_weight.ge_u != r->re_w.ge_u) {
+			edge_own(g, se)->wed_weight = r->re_w;
+		}
+		return (0);
+	}
+	if (g->gr_snap_cb != NULL) {
+		edge_get(g, se, &from, &to, &w);
+		g->gr_snap_cb(0, EDGE, from, to, w);
+	}
+	return (1);
+}
+
+static void
+rb_missing(lg_graph_t *g, slablist_t *edges, rb_ent_t *r)
+{
+	if (!r->re_present) {
+		return;
+	}
+	(void) slablist_add(edges, rb_elem(g, r), 0);
+	if (g->gr_snap_cb != NULL) {
+		g->gr_snap_cb(1, EDGE, r->re_from, r->re_to, r->re_w);
+	}
+}
+
+static void
+rb_merge(lg_graph_t *g, rb_ent_t *r, uint64_t nr)
+{
+	uint64_t ne = slablist_get_elems(g->gr_edges);
+	selem_t *old = lg_zalloc((ne + 1) * sizeof (selem_t));
+	selem_t zero;
+	zero.sle_p = old;
+	slablist_foldr(g->gr_edges, batch_collect_cb, zero);
+	slablist_t *nsl = edges_create(g, NULL);
+	uint64_t i = 0;
+	uint64_t j = 0;
+	uint64_t kf;
+	uint64_t kt;
+	while (i < ne || j < nr) {
+		int c = 1;
+		if (i < ne && j < nr) {
+			elem_keys(g, old[i], &kf, &kt);
+			c = (kf != r[j].re_kf) ? (kf < r[j].re_kf ? -1 : 1) :
+			    (kt != r[j].re_kt) ? (kt < r[j].re_kt ? -1 : 1) : 0;
+		} else if (i < ne) {
+			c = -1;
+		}
+		if (c < 0) {
+			(void) slablist_add(nsl, old[i], 0);
+			i++;
+		} else if (c == 0) {
+			if (rb_existing(g, old[i], &r[j])) {
+				edge_free(g, old[i]);
+			} else {
+				(void) slablist_add(nsl, old[i], 0);
+			}
+			i++;
+			j++;
+		} else {
+			rb_missing(g, nsl, &r[j]);
+			j++;
+		}
+	}
+	lg_free(old, (ne + 1) * sizeof (selem_t));
+	slablist_destroy(g->gr_edges, NULL);
+	g->gr_edges = nsl;
+	if (g->gr_in_edges != NULL) {
+		slablist_destroy(g->gr_in_edges, NULL);
+		g->gr_in_edges = NULL;
+	}
+	nodes_destroy(g);
+}
+
+static void
+rb_each(lg_graph_t *g, rb_ent_t *r, uint64_t nr)
+{
+	ekey_t k;
+	selem_t key;
+	selem_t found;
+	uint64_t i = 0;
+	while (i < nr) {
+		key = edge_key(g, &k, r[i].re_from, r[i].re_to, r[i].re_w);
+		if (edges_find(g, key, &found) == SL_ENFOUND) {
+			if (r[i].re_present) {
+				(void) edge_add(g, rb_elem(g, &r[i]));
+				if (g->gr_snap_cb != NULL) {
+					g->gr_snap_cb(1, EDGE, r[i].re_from,
+					    r[i].re_to, r[i].re_w);
 				}
-				break;
 			}
-			g->gr_chs_rolled++;
+		} else if (rb_existing(g, found, &r[i])) {
+			(void) edge_rem(g, key, NULL);
+			edge_free(g, found);
 		}
-		i--;
-		j++;
+		i++;
 	}
-	return (z);
 }
 
-selem_t
-rollback_fold_dedup(selem_t z, selem_t *e, uint64_t sz)
+/*
+ * Gives `g` the edges that `src` had at snapshot `snap`, where `g` is either
+ * `src` itself, or a clone that still shares the edges of `src`.
+ */
+static void
+rollback_edges(lg_graph_t *g, lg_graph_t *src, uint64_t snap)
 {
-	(void)z; (void)e; (void)sz;
-	return (z);
+	lg_view_t *v = lg_view_at(src, snap);
+	if (v == NULL) {
+		return;
+	}
+	uint64_t nmax = slablist_get_elems(v->vw_ents);
+	if (nmax == 0) {
+		lg_view_destroy(v);
+		return;
+	}
+	rb_collect_t rbc;
+	rbc.rbc_g = g;
+	rbc.rbc_ents = lg_zalloc(nmax * sizeof (rb_ent_t));
+	rbc.rbc_n = 0;
+	selem_t zero;
+	zero.sle_p = &rbc;
+	slablist_foldr(v->vw_ents, rb_collect_cb, zero);
+	lg_view_destroy(v);
+	cow_write(g);
+	qsort(rbc.rbc_ents, rbc.rbc_n, sizeof (rb_ent_t), rb_ent_cmp);
+	/* shared edges can't be rebuilt, only changed one by one */
+	if (g->gr_cow == NULL &&
+	    rbc.rbc_n * 2 >= slablist_get_elems(g->gr_edges)) {
+		rb_merge(g, rbc.rbc_ents, rbc.rbc_n);
+	} else {
+		rb_each(g, rbc.rbc_ents, rbc.rbc_n);
+	}
+	lg_free(rbc.rbc_ents, nmax * sizeof (rb_ent_t));
 }
 
+/*
+ * Used to truncate the change-log after a rollback.
+ */
 static void
-clean_change(selem_t e)
+rollback_clean_change(selem_t e)
 {
 	change_t *c = e.sle_p;
-	lg_graph_t *g = c->ch_graph;
-	gelem_t ignored;
-	if (g->gr_snap_cb) {
-		g->gr_snap_cb(0, SNAP, c->ch_from, c->ch_to, ignored);
-	}
-	lg_rm_change(c);
+	(void)c;
+	GRAPH_ROLLBACK_CHANGE(c->ch_graph, c);
+	clean_change(e);
 }
 
 /*
- * Rolls the graph back to snapshot `snap`. Given an ordered slablist of
- * changes, we do a foldl, and while the `ch_snap` value is >= `snap` we undo
- * whatever operation is described by the change.
+ * Sets `ch_min` and `ch_max` up as the bounds of the changes that the
+ * change-log holds for snapshots `snap` and later, for either strategy.
  */
-int
-lg_rollback_fast(lg_graph_t *g, uint64_t snap)
+void
+snaps_range(lg_graph_t *g, uint64_t snap, change_t *ch_min, change_t *ch_max)
 {
-
-	g->gr_chs_rolled = 0;
-
-	g->gr_rollback_to = snap;
-
-	selem_t zero;
-	zero.sle_p = g;
-	slablist_foldl(g->gr_snaps, rollback_fold_fast, zero);
-	uint64_t nch = slablist_get_elems(g->gr_snaps);
-	uint64_t nch_left = nch - g->gr_chs_rolled;
-	uint64_t rems = g->gr_chs_rolled;
-	selem_t null;
-	null.sle_p = NULL;
-	while (rems > 0) {
-		slablist_rem(g->gr_snaps, null, nch_left, clean_change);
-		rems--;
-	}
-	return (0);
+	ch_min->ch_snap = snap;
+	ch_max->ch_snap = g->gr_snap - 1;
+	ch_min->ch_seq = 0;
+	ch_max->ch_seq = UINT64_MAX;
+	ch_min->ch_op = CONNECT;
+	ch_max->ch_op = DROP;
+	ch_min->ch_from.ge_u = 0;
+	ch_max->ch_from.ge_u = UINT64_MAX;
+	ch_min->ch_to.ge_u = 0;
+	ch_max->ch_to.ge_u = UINT64_MAX;
+	ch_min->ch_weight.ge_u = 0;
+	ch_max->ch_weight.ge_u = UINT64_MAX;
+	ch_min->ch_batch = NULL;
+	ch_max->ch_batch = (w_edge_t *)UINTPTR_MAX;
 }
 
+/*
+ * Rolls the graph back to snapshot `snap`: the edges are restored (see
+ * rollback_edges()), and then the changes made since `snap`, which sit at the
+ * end of the change-log under either strategy, are removed in one go. Returns
+ * -1 if there is no snapshot `snap`, or if the graph is frozen or sharded.
+ */
 int
-lg_rollback_dedup(lg_graph_t *g, uint64_t snap)
+lg_rollback(lg_graph_t *g, uint64_t snap)
 {
-	g->gr_rollback_to = snap;
+	if (snap >= g->gr_snap || g->gr_snaps == NULL || g->gr_csr != NULL ||
+	    g->gr_shards != NULL) {
+		return (-1);
+	}
+	g->gr_rollingback = 1;
+	rollback_edges(g, g, snap);
 	change_t ch_min;
 	change_t ch_max;
-	ch_min.ch_snap = snap;
-	ch_max.ch_snap = g->gr_snap - 1;
-	ch_min.ch_op = CONNECT;
-	ch_max.ch_op = DISCONNECT;
-	ch_min.ch_from.ge_u = 0;
-	ch_max.ch_from.ge_u = UINT64_MAX;
-	ch_min.ch_to.ge_u = 0;
-	ch_max.ch_to.ge_u = UINT64_MAX;
-	ch_min.ch_weight.ge_u = 0;
-	ch_max.ch_weight.ge_u = UINT64_MAX;
-
+	snaps_range(g, snap, &ch_min, &ch_max);
 	selem_t s_min;
 	selem_t s_max;
 	s_min.sle_p = &ch_min;
 	s_max.sle_p = &ch_max;
-
-	selem_t zero;
-	zero.sle_p = g;
-	slablist_foldl_range(g->gr_snaps, rollback_fold_dedup, s_min, s_max,
-	    zero);
-	slablist_rem_range(g->gr_snaps, s_min, s_max, clean_change);
+	(void) slablist_rem_range(g->gr_snaps, s_min, s_max,
+	    rollback_clean_change);
+	ckpt_rollback(g, snap);
+	g->gr_gen++;
+	g->gr_rollingback = 0;
 	return (0);
 }
 
-int
-lg_rollback(lg_graph_t *g, uint64_t snap)
+/*
+ * Creates a clone of graph `g` at snapshot `snap`. The clone shares the edges
+ * of `g` (see graph_cow.c), and has the net difference between `g` and `snap`
+ * applied to its overlay, like lg_rollback() does. Creating a clone thus costs
+ * a walk of the changes made since `snap`, and never copies the edges of `g`.
+ * Later changes to either graph also go to that graph's overlay, so a clone
+ * only ever occupies space for the edges in which it differs from `g`, and
+ * reading it costs a merge with its overlay. lg_compact() gives either graph
+ * edges of its own, if that is no longer wanted.
+ *
+ * If `g` takes checkpoints (see lg_checkpoint_every), and `snap` is so old
+ * that building it from the checkpoint before it is cheaper than undoing the
+ * changes made since, the clone is built from that checkpoint instead, and
+ * gets edges of its own right away.
+ *
+ * The clone has the same type and strategies as `g`, and no snapshots of its
+ * own. It doesn't inherit the snap_cb of `g`, so the nodes that it refers to
+ * have to be kept alive for as long as it exists. Returns NULL if `g` has no
+ * snapshot `snap`, or is sharded.
+ */
+lg_graph_t *
+lg_clone(lg_graph_t *g, uint64_t snap)
 {
-	if (snap >= g->gr_snap || g->gr_snaps == NULL) {
-		return (-1);
+	lg_graph_t *c = NULL;
+	if (snap >= g->gr_snap || g->gr_snaps == NULL ||
+	    g->gr_shards != NULL) {
+		return (NULL);
 	}
-	int r = 0;
-	g->gr_rollingback = 1;
-
-	switch (g->gr_snapstrat) {
+	switch (g->gr_type) {
 
-	case SNAP_FAST:
-		r = lg_rollback_fast(g, snap);
+	case GRAPH:
+		c = lg_create_graph();
+		break;
+	case GRAPH_WE:
+		c = lg_create_wgraph();
 		break;
-	case SNAP_DEDUP:
-		/* TODO implement a DEDUP strategy */
-		r = lg_rollback_dedup(g, snap);
+	case DIGRAPH:
+		c = lg_create_digraph();
+		break;
+	case DIGRAPH_WE:
+		c = lg_create_wdigraph();
 		break;
 	}
-	g->gr_rollingback = 0;
-	return (r);
+	c->gr_snapstrat = g->gr_snapstrat;
+	c->gr_rollingback = 1;
+	if (ckpt_clone(g, c, snap) != 0) {
+		cow_share(g, c);
+		rollback_edges(c, g, snap);
+	}
+	c->gr_rollingback = 0;
+	return (c);
+}
+
+/*
+ * The state of lg_destroy_snapshot(). `sc_net` collects the net changes of the
+ * destroyed snapshot and the one before it, sorted like a DEDUP change-log.
+ */
+typedef struct snap_compact {
+	lg_graph_t	*sc_g;
+	uint64_t	sc_snap;
+	slablist_t	*sc_net;
+} snap_compact_t;
+
+/*
+ * Puts the net changes back into the change-log. Under the FAST strategy, they
+ * get new sequence numbers, which puts them after any other changes of their
+ * snapshot. Since they are net changes, their order doesn't matter.
+ */
+static selem_t
+compact_flush_cb(selem_t zero, selem_t *e, uint64_t sz)
+{
+	lg_graph_t *g = zero.sle_p;
+	uint64_t i = 0;
+	while (i < sz) {
+		change_t *c = e[i].sle_p;
+		c->ch_seq = ++g->gr_gen;
+		(void) slablist_add(g->gr_snaps, e[i], 0);
+		i++;
+	}
+	return (zero);
+}
+
+/*
+ * Merges the change `c`, of the destroyed snapshot or the one before it, into
+ * the net changes. Batch changes are split up into changes of single edges,
+ * which take over the references that the batch held.
+ */
+static void
+compact_merge(snap_compact_t *sc, change_t *c)
+{
+	lg_graph_t *g = sc->sc_g;
+	selem_t e;
+	e.sle_p = c;
+	if (sc->sc_snap == 0) {
+		/* there is no snapshot to merge into */
+		clean_change(e);
+		return;
+	}
+	if (c->ch_batch == NULL) {
+		c->ch_snap = sc->sc_snap - 1;
+		snap_merge(g, sc->sc_net, c);
+		return;
+	}
+	graph_op_t op = (c->ch_op == CONNECT_BATCH) ? CONNECT : DISCONNECT;
+	uint64_t i = 0;
+	while (i < c->ch_nbatch) {
+		change_t *ec = lg_mk_change(g);
+		ec->ch_snap = sc->sc_snap - 1;
+		ec->ch_graph = g;
+		ec->ch_op = op;
+		ec->ch_from = c->ch_batch[i].wed_from;
+		ec->ch_to = c->ch_batch[i].wed_to;
+		ec->ch_weight = c->ch_batch[i].wed_weight;
+		snap_merge(g, sc->sc_net, ec);
+		i++;
+	}
+	free_batch_cb(e);
+	lg_rm_change(c);
 }
 
 /*
- * To destroy a snapshot, we move all changes into the previous snapshot. For
- * the fast snap-strat all this means is that you'll be unable to rollback or
- * clone the snapshot you destroyed, but the changes are all still there. For
- * the dedup-strat, you may get some memory savings if there are changes common
- * to both snapshots.
+ * To destroy a snapshot, we move all changes into the previous snapshot, and
+ * replace the changes that the two snapshots have made to each edge with
+ * their net change, like the DEDUP strategy does (see snap_merge()). Changes
+ * that undo each other thus disappear from the change-log. The changes made
+ * after snapshot 0 have no previous snapshot to go to, so destroying snapshot
+ * 0 discards them. Afterwards, rolling back to, or cloning, the destroyed
+ * snapshot yields the snapshot after it.
+ *
+ * Under either strategy, the changes of the two snapshots form a range of the
+ * change-log, which is taken out, and replaced with the net changes.
+ *
+ * Returns -1 if there is no snapshot `snap`.
  */
 int
 lg_destroy_snapshot(lg_graph_t *g, uint64_t snap)
 {
-	(void)g;
-	(void)snap;
+	snap_compact_t sc;
+	change_t ch_min;
+	change_t ch_max;
+	selem_t s_min;
+	selem_t s_max;
+	selem_t zero;
+	if (snap >= g->gr_snap || g->gr_snaps == NULL) {
+		return (-1);
+	}
+	g->gr_gen++;
+	sc.sc_g = g;
+	sc.sc_snap = snap;
+	sc.sc_net = slablist_create("snapshot_compaction", snap_cmp, snap_bnd,
+	    SL_SORTED);
+	snaps_range(g, snap == 0 ? 0 : snap - 1, &ch_min, &ch_max);
+	ch_max.ch_snap = snap;
+	s_min.sle_p = &ch_min;
+	s_max.sle_p = &ch_max;
+	/* the changes can't be in the log while they are merged */
+	uint64_t nmax = slablist_get_elems(g->gr_snaps);
+	selem_t *chs = lg_zalloc((nmax + 1) * sizeof (selem_t));
+	zero.sle_p = chs;
+	zero = slablist_foldr_range(g->gr_snaps, batch_collect_cb, s_min, s_max,
+	    zero);
+	uint64_t nch = (selem_t *)zero.sle_p - chs;
+	if (nch > 0) {
+		(void) slablist_rem_range(g->gr_snaps, s_min, s_max, NULL);
+	}
+	uint64_t i = 0;
+	while (i < nch) {
+		compact_merge(&sc, chs[i].sle_p);
+		i++;
+	}
+	zero.sle_p = g;
+	slablist_foldr(sc.sc_net, compact_flush_cb, zero);
+	lg_free(chs, (nmax + 1) * sizeof (selem_t));
+	slablist_destroy(sc.sc_net, NULL);
+	ckpt_destroy_snapshot(g, snap);
 	return (0);
 }
 
 /*
  * We destroy all changes associated with snapshots, reset the snapshot counter
- * to zero.
+ * to zero. The snap_cb is told about every change, but the changes themselves
+ * are released along with the arena they live in, instead of one by one.
  */
 int
 lg_destroy_all_snapshots(lg_graph_t *g)
 {
-	(void)g;
+	if (g->gr_snaps == NULL) {
+		return (0);
+	}
+	slablist_destroy(g->gr_snaps, release_change);
+	g->gr_snaps = NULL;
+	g->gr_snap = 0;
+	ckpt_destroy(g);
+	g->gr_gen++;
+	arena_destroy(&g->gr_ar_changes);
 	return (0);
 }
 
 /*
- * Count the number of edges in the graph.
+ * Count the number of edges in the graph. An edge of an undirected graph is
+ * counted once.
  */
 uint64_t
 lg_nedges(lg_graph_t *g)
 {
+	if (g->gr_shards != NULL) {
+		return (shard_nedges(g));
+	}
 	if (g->gr_edges) {
-		return (slablist_get_elems(g->gr_edges));
+		return (edges_nelems(g));
 	}
 	return (0);
 }
 
 typedef struct flatten_cookie {
+	lg_graph_t	*fck_graph;
 	slablist_t	*fck_chs;
 	flatten_cb_t	*fck_cb;
 	gelem_t		fck_node;
@@ -2593,7 +3672,7 @@ flatten_adj(gelem_t to, gelem_t from, gelem_t weight, gelem_t agg)
 	switch (pdk) {
 
 	case FLATTEN_PROMOTE:
-		c = lg_mk_change();
+		c = lg_mk_change(ck->fck_graph);
 		/*
 		 * If not already connected to parent, queue for connection.
 		 */
@@ -2605,7 +3684,7 @@ flatten_adj(gelem_t to, gelem_t from, gelem_t weight, gelem_t agg)
 			c->ch_weight.ge_u = ck->fck_connects;
 			sc.sle_p = c;
 			slablist_add(ck->fck_chs, sc, 0);
-			c = lg_mk_change();
+			c = lg_mk_change(ck->fck_graph);
 			c->ch_op = DISCONNECT;
 			c->ch_from = from;
 			c->ch_to = to;
@@ -2616,7 +3695,7 @@ flatten_adj(gelem_t to, gelem_t from, gelem_t weight, gelem_t agg)
 		break;
 
 	case FLATTEN_DROP:
-		c = lg_mk_change();
+		c = lg_mk_change(ck->fck_graph);
 		c->ch_op = DISCONNECT;
 		c->ch_from = from;
 		c->ch_to = to;
@@ -2652,6 +3731,16 @@ flatten_apply_changes(selem_t agg, selem_t *e, uint64_t sz)
 			case DISCONNECT:
 				lg_disconnect(g, c->ch_from, c->ch_to);
 				break;
+
+			case UPDATE:
+				/* unweighted edges have nothing to update */
+				break;
+
+			case CONNECT_BATCH:
+			case REMOVE_NODE:
+			case DROP:
+				/* lg_flatten() never makes these */
+				break;
 			}
 			i++;
 		}
@@ -2669,6 +3758,16 @@ flatten_apply_changes(selem_t agg, selem_t *e, uint64_t sz)
 				lg_wdisconnect(g, c->ch_from, c->ch_to,
 				    c->ch_weight);
 				break;
+
+			case UPDATE:
+				lg_wupdate(g, c->ch_from, c->ch_to,
+				    c->ch_weight);
+				break;
+
+			case CONNECT_BATCH:
+			case REMOVE_NODE:
+			case DROP:
+				break;
 			}
 			i++;
 		}
@@ -2697,10 +3796,14 @@ void
 lg_flatten(lg_graph_t *g, gelem_t node, flatten_cb_t *cb, gelem_t arg)
 {
 	flatten_cookie_t cookie;
+	if (g->gr_csr != NULL) {
+		return;
+	}
 
 	slablist_t *chs = slablist_create("flatten_changes", NULL, NULL,
 	    SL_ORDERED);
 
+	cookie.fck_graph = g;
 	cookie.fck_chs = chs;
 	cookie.fck_cb = cb;
 	cookie.fck_node.ge_u = node.ge_u;
@@ -2717,25 +3820,392 @@ lg_flatten(lg_graph_t *g, gelem_t node, flatten_cb_t *cb, gelem_t arg)
 	slablist_destroy(chs, rm_change_cb);
 }
 
+typedef struct drop_roots {
+	drop_cb_t	*dr_cb;
+	gelem_t		*dr_nodes;
+	uint64_t	dr_n;
+} drop_roots_t;
+
+static selem_t
+drop_ask_cb(selem_t zero, selem_t *e, uint64_t sz)
+{
+	drop_roots_t *dr = zero.sle_p;
+	uint64_t i = 0;
+	while (i < sz) {
+		node_t *nd = e[i].sle_p;
+		if (dr->dr_cb(nd->nd_node)) {
+			dr->dr_nodes[dr->dr_n++] = nd->nd_node;
+		}
+		i++;
+	}
+	return (zero);
+}
+
+/*
+ * Adds all of the edges that leave or enter `n` to `rc`. Edges between two
+ * dropped nodes get added twice.
+ */
+static void
+drop_collect(lg_graph_t *g, gelem_t n, rmnode_coll_t *rc)
+{
+	ekey_t kmin;
+	ekey_t kmax;
+	selem_t min;
+	selem_t max;
+	selem_t zero;
+	zero.sle_p = rc;
+	if (edge_range(g, n, &kmin, &kmax, &min, &max) == 0) {
+		rc->rc_mirror = 0;
+		edges_foldr_range(g, rmnode_collect_cb, min, max, zero);
+	}
+	if (mirror_range(g, n, &kmin, &kmax, &min, &max) == 0) {
+		rc->rc_mirror = 1;
+		slablist_foldr_range(g->gr_in_edges, rmnode_collect_cb, min,
+		    max, zero);
+	}
+}
+
+/*
+ * Removes the sorted, duplicate-free batch `b` of edges from `gr_edges`, by
+ * copying all of the other edges into a new edge-list.
+ */
+static void
+drop_filter(lg_graph_t *g, batch_ent_t *b, uint64_t nb)
+{
+	uint64_t ne = slablist_get_elems(g->gr_edges);
+	selem_t *old = lg_zalloc((ne + 1) * sizeof (selem_t));
+	selem_t zero;
+	zero.sle_p = old;
+	slablist_foldr(g->gr_edges, batch_collect_cb, zero);
+	slablist_t *nsl = edges_create(g, NULL);
+	uint64_t i = 0;
+	uint64_t j = 0;
+	uint64_t kf;
+	uint64_t kt;
+	while (i < ne) {
+		elem_keys(g, old[i], &kf, &kt);
+		if (j < nb && kf == b[j].be_kf && kt == b[j].be_kt) {
+			j++;
+		} else {
+			(void) slablist_add(nsl, old[i], 0);
+		}
+		i++;
+	}
+	lg_free(old, (ne + 1) * sizeof (selem_t));
+	slablist_destroy(g->gr_edges, NULL);
+	g->gr_edges = nsl;
+	/* see batch_merge() */
+	if (g->gr_in_edges != NULL) {
+		slablist_destroy(g->gr_in_edges, NULL);
+		g->gr_in_edges = NULL;
+	}
+	nodes_destroy(g);
+}
+
 /*
  * We touch all of the nodes in a graph, and ask `cb` if it should be dropped
  * (along with all of its descendants). If so, we queue the node up. We then do
  * a BFS starting from all of the queued nodes, and accumulate a list of
- * change_t's. We then apply all of the change_t's to the graph.
+ * edges that leave or enter the dropped nodes. We then sort that list, and
+ * remove all of its edges from the graph at once.
+ *
+ * With DROP_PARENT, the nodes that `cb` picked are dropped along with their
+ * descendants. With DROP_KIDS, only their descendants are dropped, which
+ * includes any picked node that is a descendant of another. The descendants of
+ * a node in an undirected graph are all of the nodes that it is connected to.
+ * A dropped node loses all of its edges, and so vanishes from the graph.
+ *
+ * If many edges are dropped, the remaining ones are copied into a new
+ * edge-list, instead of removing the dropped ones one by one, unless the edges
+ * are shared with a clone (see graph_cow.c). The whole drop is logged as a
+ * single DROP change, which a rollback undoes by reconnecting every edge.
+ * Nothing is dropped if the graph is frozen or sharded, and `cb` must not
+ * change the graph.
  */
 void
 lg_drop(lg_graph_t *g, drop_cb_t *cb, drop_strat_t s)
 {
+	drop_roots_t dr;
+	rmnode_coll_t rc;
+	if (g->gr_csr != NULL || g->gr_shards != NULL) {
+		return;
+	}
+	nodes_build(g);
+	uint64_t nn = slablist_get_elems(g->gr_nodes);
+	if (nn == 0) {
+		return;
+	}
+	dr.dr_cb = cb;
+	dr.dr_nodes = lg_zalloc(nn * sizeof (gelem_t));
+	dr.dr_n = 0;
+	selem_t zero;
+	zero.sle_p = &dr;
+	slablist_foldr(g->gr_nodes, drop_ask_cb, zero);
+
+	/*
+	 * The BFS starts from all of the picked nodes at once, so that every
+	 * descendant is visited once, no matter how many of them reach it.
+	 */
+	args_t args;
+	vset_t vs;
+	slablist_t *Q = slablist_create("graph_drop_queue", NULL, NULL,
+	    SL_ORDERED);
+	vset_init(g, &vs, "graph_drop_vset");
+	bzero(&args, sizeof (args));
+	args.a_g = g;
+	args.a_q = Q;
+	args.a_v = &vs;
+	zero.sle_p = &args;
+	uint64_t i = 0;
+	while (i < dr.dr_n) {
+		uint64_t k;
+		if (s == DROP_KIDS) {
+			enq_connected(g, dr.dr_nodes[i], zero);
+		} else if (node_key(g, dr.dr_nodes[i], &k) == 0 &&
+		    !vset_test(&vs, k)) {
+			enq_origin(g, Q, &vs, dr.dr_nodes[i]);
+		}
+		i++;
+	}
+	in_index_build(g);
+	bzero(&rc, sizeof (rc));
+	rc.rc_g = g;
+	while (slablist_get_elems(Q) > 0) {
+		gelem_t n = deq(Q);
+		drop_collect(g, n, &rc);
+		enq_connected(g, n, zero);
+	}
+	slablist_destroy(Q, NULL);
+	vset_destroy(&vs);
+	lg_free(dr.dr_nodes, nn * sizeof (gelem_t));
+
+	batch_ent_t *b = lg_zalloc((rc.rc_n + 1) * sizeof (batch_ent_t));
+	i = 0;
+	while (i < rc.rc_n) {
+		b[i].be_from = rc.rc_edges[i].wed_from;
+		b[i].be_to = rc.rc_edges[i].wed_to;
+		b[i].be_w = rc.rc_edges[i].wed_weight;
+		b[i].be_idx = i;
+		elem_keys(g, rc.rc_elems[i], &b[i].be_kf, &b[i].be_kt);
+		i++;
+	}
+	qsort(b, rc.rc_n, sizeof (batch_ent_t), batch_ent_cmp);
+	uint64_t nu = 0;
+	i = 0;
+	while (i < rc.rc_n) {
+		if (nu == 0 || b[i].be_kf != b[nu - 1].be_kf ||
+		    b[i].be_kt != b[nu - 1].be_kt) {
+			b[nu++] = b[i];
+		}
+		i++;
+	}
+	if (nu > 0) {
+		cow_write(g);
+	}
+	/* shared edges can't be rebuilt, only removed one by one */
+	if (g->gr_cow == NULL && nu * 2 >= slablist_get_elems(g->gr_edges)) {
+		drop_filter(g, b, nu);
+	} else {
+		i = 0;
+		while (i < nu) {
+			(void) edge_rem(g, rc.rc_elems[b[i].be_idx], NULL);
+			i++;
+		}
+	}
+	w_edge_t *dropped = lg_zalloc((nu + 1) * sizeof (w_edge_t));
+	i = 0;
+	while (i < nu) {
+		dropped[i] = rc.rc_edges[b[i].be_idx];
+		edge_free(g, rc.rc_elems[b[i].be_idx]);
+		i++;
+	}
+	if (!g->gr_rollingback && nu > 0) {
+		snap_remove_edges(g, DROP, dropped[0].wed_from, dropped, nu);
+	}
+	lg_free(dropped, (nu + 1) * sizeof (w_edge_t));
+	lg_free(b, (rc.rc_n + 1) * sizeof (batch_ent_t));
+	lg_free(rc.rc_elems, rc.rc_max * sizeof (selem_t));
+	lg_free(rc.rc_edges, rc.rc_max * sizeof (w_edge_t));
+}
+
+static selem_t
+copy_edges_cb(selem_t zero, selem_t *e, uint64_t sz)
+{
+	lg_graph_t *c = zero.sle_p;
+	gelem_t from;
+	gelem_t to;
+	gelem_t w;
+	selem_t se;
+	uint64_t i = 0;
+	while (i < sz) {
+		/* packed edges are copied by value */
+		se = e[i];
+		if (EDGE_PACKED(c)) {
+			(void) slablist_add(c->gr_edges, se, 0);
+		} else if (c->gr_type == GRAPH_WE || c->gr_type == DIGRAPH_WE) {
+			w_edge_t *we = lg_mk_w_edge(c);
+			*we = *(w_edge_t *)e[i].sle_p;
+			se.sle_p = we;
+			(void) slablist_add(c->gr_edges, se, 0);
+		} else {
+			edge_t *ed = lg_mk_edge(c);
+			*ed = *(edge_t *)e[i].sle_p;
+			se.sle_p = ed;
+			(void) slablist_add(c->gr_edges, se, 0);
+		}
+		if (c->gr_snap_cb != NULL) {
+			edge_get(c, se, &from, &to, &w);
+			c->gr_snap_cb(1, EDGE, from, to, w);
+		}
+		i++;
+	}
+	return (zero);
+}
 
+static selem_t
+copy_changes_cb(selem_t zero, selem_t *e, uint64_t sz)
+{
+	lg_graph_t *c = zero.sle_p;
+	selem_t sc;
+	uint64_t i = 0;
+	while (i < sz) {
+		change_t *oc = e[i].sle_p;
+		change_t *nc = lg_mk_change(c);
+		*nc = *oc;
+		nc->ch_graph = c;
+		if (oc->ch_batch != NULL) {
+			nc->ch_batch = lg_zalloc(oc->ch_nbatch *
+			    sizeof (w_edge_t));
+			bcopy(oc->ch_batch, nc->ch_batch,
+			    oc->ch_nbatch * sizeof (w_edge_t));
+		}
+		uint64_t j = 0;
+		while (c->gr_snap_cb != NULL && j < nc->ch_nbatch) {
+			c->gr_snap_cb(1, SNAP, nc->ch_batch[j].wed_from,
+			    nc->ch_batch[j].wed_to, nc->ch_batch[j].wed_weight);
+			j++;
+		}
+		if (c->gr_snap_cb != NULL && nc->ch_batch == NULL) {
+			c->gr_snap_cb(1, SNAP, nc->ch_from, nc->ch_to,
+			    nc->ch_weight);
+		}
+		sc.sle_p = nc;
+		(void) slablist_add(c->gr_snaps, sc, 0);
+		i++;
+	}
+	return (zero);
 }
 
 /*
  * Create an identical copy of the graph `g`, and return it. Note that we only
  * copy edges, and the user is responsible for handling how structs pointed to
- * from those edges are copied.
+ * from those edges are copied. If the graph has a snap_cb, the copy inherits
+ * it, and calls it on every edge (and change) that it copies, since the copy
+ * holds references of its own.
+ *
+ * The copy has the same type, edge strategy, and snapshot strategy as `g`. If
+ * `snaps` is non-zero, the snapshots of `g`, the changes made since them, and
+ * its checkpoints, are copied as well, so that the copy can be rolled back
+ * just like `g`. Otherwise the copy starts out without snapshots.
+ *
+ * The edges are walked in order, and added to the copy's edge-list in that
+ * same order, and their memory is carved out of the copy's arena in sequence.
+ * Since libslablist can't clone its slabs, each edge is still added with a
+ * sorted search, which also checks it for duplicates, so copying E edges
+ * costs O(E log E). The node table and the incoming-edge index are not copied,
+ * and will be built when first needed. A frozen graph yields a thawed copy.
+ * Returns NULL if `g` is sharded.
  */
 lg_graph_t *
-lg_copy(lg_graph_t *g)
+lg_copy(lg_graph_t *g, int snaps)
+{
+	lg_graph_t *c = NULL;
+	if (g->gr_shards != NULL) {
+		return (NULL);
+	}
+	switch (g->gr_type) {
+
+	case GRAPH:
+		c = lg_create_graph();
+		break;
+	case GRAPH_WE:
+		c = lg_create_wgraph();
+		break;
+	case DIGRAPH:
+		c = lg_create_digraph();
+		break;
+	case DIGRAPH_WE:
+		c = lg_create_wdigraph();
+		break;
+	}
+	(void) lg_edgestrat(c, g->gr_edgestrat);
+	c->gr_snapstrat = g->gr_snapstrat;
+	c->gr_snap_cb = g->gr_snap_cb;
+	c->gr_ckpt_snaps = g->gr_ckpt_snaps;
+	c->gr_ckpt_changes = g->gr_ckpt_changes;
+	if (g->gr_dict != NULL) {
+		dict_destroy(c->gr_dict);
+		c->gr_dict = dict_copy(g->gr_dict);
+	}
+	selem_t zero;
+	zero.sle_p = c;
+	edges_foldr(g, copy_edges_cb, zero);
+	if (snaps && g->gr_snaps != NULL) {
+		c->gr_snap = g->gr_snap;
+		if (g->gr_snapstrat == SNAP_DEDUP) {
+			c->gr_snaps = slablist_create("snapshots", snap_cmp,
+			    snap_bnd, SL_SORTED);
+		} else {
+			c->gr_snaps = slablist_create("snapshots", seq_cmp,
+			    seq_bnd, SL_SORTED);
+		}
+		c->gr_gen = g->gr_gen;
+		slablist_foldr(g->gr_snaps, copy_changes_cb, zero);
+		ckpt_copy(g, c);
+	}
+	return (c);
+}
+
+/*
+ * Freezing a graph builds a compressed-sparse-row image of its edges (see the
+ * comment above csr_t in graph_impl.h). From then on, lg_bfs_fold(),
+ * lg_dfs_fold() and friends, as well as lg_neighbors() and lg_edges(), walk
+ * over the image instead of the edge-list. This avoids all of the pointer
+ * chasing that the edge-list requires, and is much faster for read-mostly
+ * workloads.
+ *
+ * The image is immutable, so while the graph is frozen, any operation that
+ * would change the edges fails with G_ERR_FROZEN. The graph has to be thawed
+ * with lg_thaw() before it can be changed, and frozen again afterwards.
+ * Freezing an already frozen graph does nothing. Returns -1 if the graph is
+ * sharded.
+ */
+int
+lg_freeze(lg_graph_t *g)
+{
+	if (g->gr_shards != NULL) {
+		return (-1);
+	}
+	if (g->gr_csr == NULL) {
+		g->gr_csr = csr_build(g);
+	}
+	return (0);
+}
+
+/*
+ * Discards the CSR image of a frozen graph, making it mutable again.
+ */
+void
+lg_thaw(lg_graph_t *g)
 {
+	if (g->gr_csr != NULL) {
+		csr_destroy(g->gr_csr);
+		g->gr_csr = NULL;
+	}
+}
 
+int
+lg_is_frozen(lg_graph_t *g)
+{
+	return (g->gr_csr != NULL);
 }
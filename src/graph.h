@@ -15,6 +15,10 @@
 #define G_ERR_SELF_CONNECT -2
 #define G_ERR_SELF_DISCONNECT -3
 #define G_ERR_NFOUND_DISCONNECT -4
+#define G_ERR_FROZEN -5
+#define G_ERR_NODE_RANGE -6
+#define G_ERR_NFOUND_UPDATE -7
+#define G_ERR_NFOUND_NODE -8
 
 #include <unistd.h>
 #include <stdint.h>
@@ -24,6 +28,17 @@ typedef enum snap_strat {
 	SNAP_DEDUP
 } snap_strat_t;
 
+/*
+ * How a graph stores its edges. EDGE_INLINE is only available for unweighted
+ * graphs whose nodes fit in 32 bits. EDGE_DENSE is only available for
+ * unweighted graphs with fewer than 2^32 distinct nodes.
+ */
+typedef enum edge_strat {
+	EDGE_PTR,
+	EDGE_INLINE,
+	EDGE_DENSE
+} edge_strat_t;
+
 /*
  * If lg_drop gets told to drop a node `n`, these flags will tell it if it
  * should drop the parent in addition to the kids.
@@ -42,6 +57,8 @@ typedef union gelem {
 } gelem_t;
 
 typedef struct lg_graph lg_graph_t;
+typedef struct lg_view lg_view_t;
+typedef struct lg_trav_ctx lg_trav_ctx_t;
 
 /* node */
 typedef int br_cb_t(gelem_t);
@@ -55,12 +72,18 @@ typedef void adj_cb_t(gelem_t, gelem_t, gelem_t, gelem_t);
 typedef int pop_cb_t(gelem_t, gelem_t);
 typedef void edges_cb_t(gelem_t, gelem_t, gelem_t);
 typedef void edges_arg_cb_t(gelem_t, gelem_t, gelem_t, gelem_t);
+/* node, out-degree, in-degree */
+typedef void nodes_cb_t(gelem_t, uint64_t, uint64_t);
+typedef void nodes_arg_cb_t(gelem_t, uint64_t, uint64_t, gelem_t);
 /* source node, destination node, weight */
 typedef enum snap_cb_ctx {
 	EDGE,
 	SNAP
 } snap_cb_ctx_t;
 typedef void snap_cb_t(uint8_t, snap_cb_ctx_t, gelem_t, gelem_t, gelem_t);
+/* added (1) or removed (0), source node, destination node, weight */
+typedef void diff_cb_t(uint8_t, gelem_t, gelem_t, gelem_t);
+typedef void diff_arg_cb_t(uint8_t, gelem_t, gelem_t, gelem_t, gelem_t);
 
 extern int lg_is_graph(lg_graph_t *);
 extern int lg_is_digraph(lg_graph_t *);
@@ -75,9 +98,25 @@ extern int lg_connect(lg_graph_t *g, gelem_t e1, gelem_t e2);
 extern int lg_disconnect(lg_graph_t *g, gelem_t e1, gelem_t e2);
 extern int lg_wconnect(lg_graph_t *g, gelem_t e1, gelem_t e2, gelem_t w);
 extern int lg_wdisconnect(lg_graph_t *g, gelem_t e1, gelem_t e2, gelem_t w);
+extern int lg_wupdate(lg_graph_t *g, gelem_t e1, gelem_t e2, gelem_t w);
+extern int lg_remove_node(lg_graph_t *g, gelem_t n);
+extern uint64_t lg_connect_batch(lg_graph_t *g, gelem_t *from, gelem_t *to,
+    uint64_t n);
+extern uint64_t lg_wconnect_batch(lg_graph_t *g, gelem_t *from, gelem_t *to,
+    gelem_t *w, uint64_t n);
 extern gelem_t lg_bfs_fold(lg_graph_t *g, gelem_t start, adj_cb_t, fold_cb_t, gelem_t z);
+extern gelem_t lg_bfs_diropt_fold(lg_graph_t *g, gelem_t start, adj_cb_t,
+    fold_cb_t, gelem_t z);
+extern gelem_t lg_par_bfs(lg_graph_t *g, uint64_t nthreads, gelem_t start,
+    adj_cb_t, fold_cb_t, gelem_t z);
 extern gelem_t lg_bfs_rdnt_fold(lg_graph_t *g, gelem_t start, adj_cb_t, fold_cb_t, gelem_t z);
 extern gelem_t lg_dfs_fold(lg_graph_t *g, gelem_t start, pop_cb_t, fold_cb_t, gelem_t z);
+extern lg_trav_ctx_t *lg_trav_ctx_create(void);
+extern void lg_trav_ctx_destroy(lg_trav_ctx_t *tc);
+extern gelem_t lg_bfs_fold_ctx(lg_graph_t *g, lg_trav_ctx_t *tc, gelem_t start,
+    adj_cb_t, fold_cb_t, gelem_t z);
+extern gelem_t lg_dfs_fold_ctx(lg_graph_t *g, lg_trav_ctx_t *tc, gelem_t start,
+    pop_cb_t, fold_cb_t, gelem_t z);
 extern gelem_t lg_dfs_rdnt_fold(lg_graph_t *g, gelem_t start, pop_cb_t, fold_cb_t, gelem_t z);
 extern gelem_t lg_dfs_br_rdnt_fold(lg_graph_t *g, gelem_t start, br_cb_t, pop_cb_t,
 		fold_cb_t, gelem_t z);
@@ -87,12 +126,50 @@ extern uint64_t lg_nedges(lg_graph_t *g);
 extern lg_graph_t *lg_flip_edges(lg_graph_t *g);
 extern void lg_neighbors(lg_graph_t *g, gelem_t n, edges_cb_t);
 extern void lg_neighbors_arg(lg_graph_t *g, gelem_t n, edges_arg_cb_t, gelem_t);
+extern void lg_in_neighbors(lg_graph_t *g, gelem_t n, edges_cb_t);
+extern void lg_in_neighbors_arg(lg_graph_t *g, gelem_t n, edges_arg_cb_t,
+    gelem_t);
+extern uint64_t lg_nnodes(lg_graph_t *g);
+extern uint64_t lg_degree(lg_graph_t *g, gelem_t n);
+extern uint64_t lg_in_degree(lg_graph_t *g, gelem_t n);
+extern void lg_nodes(lg_graph_t *g, nodes_cb_t);
+extern void lg_nodes_arg(lg_graph_t *g, nodes_arg_cb_t, gelem_t);
+extern uint64_t lg_top_degree(lg_graph_t *g, uint64_t k, gelem_t *out);
 extern void lg_snapshot_cb(lg_graph_t *g, snap_cb_t cb);
 extern uint64_t lg_snapshot(lg_graph_t *g);
 extern lg_graph_t *lg_clone(lg_graph_t *g, uint64_t snap);
+extern lg_graph_t *lg_copy(lg_graph_t *g, int snaps);
+extern void lg_compact(lg_graph_t *g);
 extern int lg_rollback(lg_graph_t *g, uint64_t snap);
 extern int lg_destroy_snapshot(lg_graph_t *g, uint64_t snap);
+extern int lg_snap_diff(lg_graph_t *g, uint64_t s1, uint64_t s2, diff_cb_t);
+extern int lg_snap_diff_arg(lg_graph_t *g, uint64_t s1, uint64_t s2,
+    diff_arg_cb_t, gelem_t);
 extern int lg_destroy_all_snapshots(lg_graph_t *g);
+extern void lg_checkpoint_every(lg_graph_t *g, uint64_t nsnaps,
+    uint64_t nchanges);
 extern void lg_snapstrat(lg_graph_t *g, snap_strat_t s);
+extern int lg_edgestrat(lg_graph_t *g, edge_strat_t s);
 extern void lg_flatten(lg_graph_t *g, gelem_t node, flatten_cb_t *cb, gelem_t arg);
 extern void lg_drop(lg_graph_t *g, drop_cb_t *cb, drop_strat_t s);
+extern int lg_freeze(lg_graph_t *g);
+extern void lg_thaw(lg_graph_t *g);
+extern int lg_is_frozen(lg_graph_t *g);
+extern int lg_concurrent(lg_graph_t *g);
+extern void lg_publish(lg_graph_t *g);
+extern void lg_sequential(lg_graph_t *g);
+extern int lg_is_concurrent(lg_graph_t *g);
+extern int lg_shard(lg_graph_t *g, uint64_t nshards);
+extern void lg_unshard(lg_graph_t *g);
+extern int lg_is_sharded(lg_graph_t *g);
+extern lg_view_t *lg_view_at(lg_graph_t *g, uint64_t snap);
+extern void lg_view_destroy(lg_view_t *v);
+extern gelem_t lg_view_bfs_fold(lg_view_t *v, gelem_t start, adj_cb_t,
+    fold_cb_t, gelem_t z);
+extern gelem_t lg_view_dfs_fold(lg_view_t *v, gelem_t start, pop_cb_t,
+    fold_cb_t, gelem_t z);
+extern void lg_view_neighbors(lg_view_t *v, gelem_t n, edges_cb_t);
+extern void lg_view_neighbors_arg(lg_view_t *v, gelem_t n, edges_arg_cb_t,
+    gelem_t);
+extern void lg_view_edges(lg_view_t *v, edges_cb_t);
+extern void lg_view_edges_arg(lg_view_t *v, edges_arg_cb_t, gelem_t);
@@ -0,0 +1,157 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2015, Nick Zivkovic
+ */
+
+/*
+ * This file implements the per-graph arenas (see arena_t in graph_impl.h),
+ * from which a graph allocates its edges, changes, and node table entries.
+ *
+ * An arena hands out fixed-size objects from slabs of ARENA_SLAB bytes. Fresh
+ * objects are carved out of the newest slab by bumping a pointer, and freed
+ * objects are kept on a free list, from which they are reused first. Every
+ * slab is aligned to its own size, and begins with a header that points back
+ * at the arena, so that an object can be freed without knowing which graph
+ * (or which arena) it came from. This lets slablist's removal callbacks, which
+ * only get the element, free edges and changes.
+ *
+ * When the graph is destroyed, the slabs are released wholesale, without
+ * freeing the objects in them one by one.
+ */
+
+#include <stdlib.h>
+#include <strings.h>
+#include "graph_impl.h"
+
+#define	ARENA_SLAB	(16 * 1024)
+
+typedef struct arena_slab {
+	arena_t			*as_arena;
+	struct arena_slab	*as_next;
+} arena_slab_t;
+
+/* objects begin at the first 16-byte boundary past the header */
+#define	ARENA_HDR	((sizeof (arena_slab_t) + 15) & ~((size_t)15))
+
+void
+arena_init(arena_t *a, size_t size)
+{
+	bzero(a, sizeof (arena_t));
+	a->ar_size = (size + 7) & ~((size_t)7);
+}
+
+void *
+arena_alloc(arena_t *a)
+{
+	void *p;
+	if (a->ar_free != NULL) {
+		p = a->ar_free;
+		a->ar_free = *(void **)p;
+		bzero(p, a->ar_size);
+		return (p);
+	}
+	if (a->ar_bump == NULL || a->ar_bump + a->ar_size > a->ar_end) {
+		arena_slab_t *s = NULL;
+		if (posix_memalign((void **)&s, ARENA_SLAB, ARENA_SLAB) != 0) {
+			abort();
+		}
+		bzero(s, ARENA_SLAB);
+		s->as_arena = a;
+		s->as_next = a->ar_slabs;
+		a->ar_slabs = s;
+		a->ar_nslabs++;
+		a->ar_bump = (char *)s + ARENA_HDR;
+		a->ar_end = (char *)s + ARENA_SLAB;
+	}
+	p = a->ar_bump;
+	a->ar_bump += a->ar_size;
+	return (p);
+}
+
+void
+arena_free(void *p)
+{
+	if (p == NULL) {
+		return;
+	}
+	arena_slab_t *s = (arena_slab_t *)((uintptr_t)p &
+	    ~((uintptr_t)ARENA_SLAB - 1));
+	arena_give(s->as_arena, p);
+}
+
+/*
+ * Returns non-zero if `p` was allocated from one of the slabs of `a`.
+ */
+int
+arena_owns(arena_t *a, void *p)
+{
+	arena_slab_t *s = (arena_slab_t *)((uintptr_t)p &
+	    ~((uintptr_t)ARENA_SLAB - 1));
+	return (s->as_arena == a);
+}
+
+/*
+ * Puts `p` on the free list of `a`, even if it was allocated from another
+ * arena of the same object size. This lets a thread that owns `a` free objects
+ * without touching the arena that they came from, which some other thread may
+ * be using.
+ */
+void
+arena_give(arena_t *a, void *p)
+{
+	*(void **)p = a->ar_free;
+	a->ar_free = p;
+}
+
+/*
+ * Moves all of the slabs and free objects of `src` into `dst`, which must have
+ * the same object size, and leaves `src` empty. Objects allocated from `src`
+ * stay valid, and from then on are freed into `dst`.
+ */
+void
+arena_merge(arena_t *dst, arena_t *src)
+{
+	while (src->ar_bump != NULL &&
+	    src->ar_bump + src->ar_size <= src->ar_end) {
+		arena_give(dst, src->ar_bump);
+		src->ar_bump += src->ar_size;
+	}
+	while (src->ar_free != NULL) {
+		void *p = src->ar_free;
+		src->ar_free = *(void **)p;
+		arena_give(dst, p);
+	}
+	arena_slab_t *s = src->ar_slabs;
+	while (s != NULL) {
+		arena_slab_t *next = s->as_next;
+		s->as_arena = dst;
+		s->as_next = dst->ar_slabs;
+		dst->ar_slabs = s;
+		dst->ar_nslabs++;
+		s = next;
+	}
+	size_t size = src->ar_size;
+	arena_init(src, size);
+}
+
+/*
+ * Releases all of the slabs of `a` at once. Any objects that were still
+ * allocated from `a` become invalid.
+ */
+void
+arena_destroy(arena_t *a)
+{
+	arena_slab_t *s = a->ar_slabs;
+	while (s != NULL) {
+		arena_slab_t *next = s->as_next;
+		free(s);
+		s = next;
+	}
+	size_t size = a->ar_size;
+	arena_init(a, size);
+}
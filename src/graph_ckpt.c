@@ -0,0 +1,443 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2015, Nick Zivkovic
+ */
+
+/*
+ * This file implements checkpoints: images of the edges of a graph, taken
+ * when a snapshot is, every so many snapshots or changes (see
+ * lg_checkpoint_every).
+ *
+ * Cloning snapshot S normally undoes the changes made since S (see
+ * lg_clone), so the older S is, the more it costs. If there is a checkpoint C
+ * at or before S, the clone can instead be built going forward: it gets the
+ * edges of the image of C, with the net changes made between C and S (see
+ * lg_snap_diff) applied to them, which costs the size of the image, plus the
+ * changes made between C and S, no matter how old S is. The `gr_gen` of the
+ * graph counts its changes, so the `ck_gen` of every checkpoint tells us
+ * roughly how many changes each way would have to look at, and lg_clone()
+ * goes the cheaper way.
+ *
+ * An image is an array of w_edge_t's, one per edge, with the smaller node
+ * first if the graph is undirected, and sorted by w_edge_cmp(). That's the
+ * order in which lg_snap_diff() reports edges, so the image and the net
+ * changes are merged in one pass, into a batch that is connected to the clone
+ * in one go (see connect_batch).
+ *
+ * Checkpoints follow the change-log: rolling back to S discards the
+ * checkpoints taken after S, destroying snapshot S discards the checkpoint of
+ * S (if any), and destroying all snapshots discards all checkpoints.
+ */
+
+#include <stdlib.h>
+#include <strings.h>
+#include "graph_impl.h"
+
+static int
+ckpt_cmp(selem_t e1, selem_t e2)
+{
+	ckpt_t *ck1 = e1.sle_p;
+	ckpt_t *ck2 = e2.sle_p;
+	if (ck1->ck_snap < ck2->ck_snap) {
+		return (-1);
+	}
+	if (ck1->ck_snap > ck2->ck_snap) {
+		return (1);
+	}
+	return (0);
+}
+
+static int
+ckpt_bnd(selem_t e, selem_t min, selem_t max)
+{
+	if (ckpt_cmp(e, min) < 0) {
+		return (-1);
+	}
+	if (ckpt_cmp(e, max) > 0) {
+		return (1);
+	}
+	return (0);
+}
+
+static void
+ckpt_free(selem_t e)
+{
+	ckpt_t *ck = e.sle_p;
+	if (ck->ck_nedges > 0) {
+		lg_free(ck->ck_edges, ck->ck_nedges * sizeof (w_edge_t));
+	}
+	lg_free(ck, sizeof (ckpt_t));
+}
+
+static int
+ckpt_edge_cmp(const void *a, const void *b)
+{
+	selem_t e1;
+	selem_t e2;
+	e1.sle_p = (void *)a;
+	e2.sle_p = (void *)b;
+	return (w_edge_cmp(e1, e2));
+}
+
+typedef struct ckpt_image {
+	lg_graph_t	*ci_g;
+	w_edge_t	*ci_edges;
+	uint64_t	ci_n;
+} ckpt_image_t;
+
+static selem_t
+ckpt_image_cb(selem_t zero, selem_t *e, uint64_t sz)
+{
+	ckpt_image_t *ci = zero.sle_p;
+	uint64_t i = 0;
+	while (i < sz) {
+		w_edge_t *we = &ci->ci_edges[ci->ci_n];
+		edge_get(ci->ci_g, e[i], &we->wed_from, &we->wed_to,
+		    &we->wed_weight);
+		if (GRAPH_UNDIRECTED(ci->ci_g) &&
+		    we->wed_from.ge_u > we->wed_to.ge_u) {
+			gelem_t tmp = we->wed_from;
+			we->wed_from = we->wed_to;
+			we->wed_to = tmp;
+		}
+		ci->ci_n++;
+		i++;
+	}
+	return (zero);
+}
+
+/*
+ * Takes a checkpoint of `g` at snapshot `snap`, which has to be the snapshot
+ * that was just taken.
+ */
+static void
+ckpt_take(lg_graph_t *g, uint64_t snap)
+{
+	ckpt_image_t ci;
+	selem_t zero;
+	selem_t se;
+	ckpt_t *ck = lg_zalloc(sizeof (ckpt_t));
+	ck->ck_snap = snap;
+	ck->ck_gen = g->gr_gen;
+	ck->ck_nedges = edges_nelems(g);
+	if (ck->ck_nedges > 0) {
+		ci.ci_g = g;
+		ci.ci_edges = lg_zalloc(ck->ck_nedges * sizeof (w_edge_t));
+		ci.ci_n = 0;
+		zero.sle_p = &ci;
+		edges_foldr(g, ckpt_image_cb, zero);
+		qsort(ci.ci_edges, ci.ci_n, sizeof (w_edge_t), ckpt_edge_cmp);
+		ck->ck_edges = ci.ci_edges;
+	}
+	if (g->gr_ckpts == NULL) {
+		g->gr_ckpts = slablist_create("checkpoints", ckpt_cmp, ckpt_bnd,
+		    SL_SORTED);
+	}
+	se.sle_p = ck;
+	(void) slablist_add(g->gr_ckpts, se, 0);
+}
+
+/*
+ * Called by lg_snapshot() with the snapshot it just took. Takes a checkpoint,
+ * if enough snapshots have been taken, or enough changes made, since the last
+ * one.
+ */
+void
+ckpt_snapshot(lg_graph_t *g, uint64_t snap)
+{
+	uint64_t nsnaps = snap + 1;
+	uint64_t nchanges = g->gr_gen;
+	if ((g->gr_ckpt_snaps == 0 && g->gr_ckpt_changes == 0) ||
+	    g->gr_shards != NULL) {
+		return;
+	}
+	if (g->gr_ckpts != NULL && slablist_get_elems(g->gr_ckpts) > 0) {
+		ckpt_t *last = slablist_end(g->gr_ckpts).sle_p;
+		nsnaps = snap - last->ck_snap;
+		nchanges = g->gr_gen - last->ck_gen;
+	}
+	if ((g->gr_ckpt_snaps != 0 && nsnaps >= g->gr_ckpt_snaps) ||
+	    (g->gr_ckpt_changes != 0 && nchanges >= g->gr_ckpt_changes)) {
+		ckpt_take(g, snap);
+	}
+}
+
+/*
+ * Sets `min` and `max` up as the bounds of the checkpoints of snapshots `s1`
+ * through `s2`.
+ */
+static void
+ckpt_range(ckpt_t *ck_min, ckpt_t *ck_max, uint64_t s1, uint64_t s2,
+    selem_t *min, selem_t *max)
+{
+	ck_min->ck_snap = s1;
+	ck_max->ck_snap = s2;
+	min->sle_p = ck_min;
+	max->sle_p = ck_max;
+}
+
+/*
+ * Finds the latest checkpoint at or before `snap` (`*before`), and the
+ * earliest one after it (`*after`). Either may be NULL.
+ */
+static void
+ckpt_near(lg_graph_t *g, uint64_t snap, ckpt_t **before, ckpt_t **after)
+{
+	ckpt_t ck_min;
+	ckpt_t ck_max;
+	selem_t min;
+	selem_t max;
+	selem_t found;
+	*before = NULL;
+	*after = NULL;
+	if (g->gr_ckpts == NULL || slablist_get_elems(g->gr_ckpts) == 0) {
+		return;
+	}
+	slablist_bm_t *bm = slablist_bm_create();
+	ckpt_range(&ck_min, &ck_max, snap + 1, UINT64_MAX, &min, &max);
+	if (slablist_range_min(g->gr_ckpts, bm, min, max, &found) == 0) {
+		*after = found.sle_p;
+		if (slablist_prev(g->gr_ckpts, bm, &found) == 0) {
+			*before = found.sle_p;
+		}
+	} else {
+		/* every checkpoint is at or before `snap` */
+		*before = slablist_end(g->gr_ckpts).sle_p;
+	}
+	slablist_bm_destroy(bm);
+}
+
+/*
+ * The state of the merge of an image with the net changes made since.
+ * `cm_next` is the next edge of the image to go into the batch.
+ */
+typedef struct ckpt_merge {
+	ckpt_t		*cm_ck;
+	uint64_t	cm_next;
+	gelem_t		*cm_from;
+	gelem_t		*cm_to;
+	gelem_t		*cm_w;
+	uint64_t	cm_n;
+	uint64_t	cm_max;
+} ckpt_merge_t;
+
+static void
+ckpt_put(ckpt_merge_t *cm, gelem_t from, gelem_t to, gelem_t w)
+{
+	if (cm->cm_n == cm->cm_max) {
+		uint64_t nmax = cm->cm_max == 0 ? 64 : cm->cm_max * 2;
+		gelem_t *nfrom = lg_zalloc(nmax * sizeof (gelem_t));
+		gelem_t *nto = lg_zalloc(nmax * sizeof (gelem_t));
+		gelem_t *nw = lg_zalloc(nmax * sizeof (gelem_t));
+		if (cm->cm_max > 0) {
+			bcopy(cm->cm_from, nfrom, cm->cm_n * sizeof (gelem_t));
+			bcopy(cm->cm_to, nto, cm->cm_n * sizeof (gelem_t));
+			bcopy(cm->cm_w, nw, cm->cm_n * sizeof (gelem_t));
+			lg_free(cm->cm_from, cm->cm_max * sizeof (gelem_t));
+			lg_free(cm->cm_to, cm->cm_max * sizeof (gelem_t));
+			lg_free(cm->cm_w, cm->cm_max * sizeof (gelem_t));
+		}
+		cm->cm_from = nfrom;
+		cm->cm_to = nto;
+		cm->cm_w = nw;
+		cm->cm_max = nmax;
+	}
+	cm->cm_from[cm->cm_n] = from;
+	cm->cm_to[cm->cm_n] = to;
+	cm->cm_w[cm->cm_n] = w;
+	cm->cm_n++;
+}
+
+/*
+ * Puts the edges of the image that come before from->to into the batch.
+ * Returns non-zero if the next edge of the image is from->to itself.
+ */
+static int
+ckpt_upto(ckpt_merge_t *cm, gelem_t from, gelem_t to)
+{
+	ckpt_t *ck = cm->cm_ck;
+	w_edge_t k;
+	selem_t e1;
+	selem_t e2;
+	int c = 1;
+	k.wed_from = from;
+	k.wed_to = to;
+	e2.sle_p = &k;
+	while (cm->cm_next < ck->ck_nedges) {
+		w_edge_t *we = &ck->ck_edges[cm->cm_next];
+		e1.sle_p = we;
+		c = w_edge_cmp(e1, e2);
+		if (c >= 0) {
+			break;
+		}
+		ckpt_put(cm, we->wed_from, we->wed_to, we->wed_weight);
+		cm->cm_next++;
+	}
+	return (cm->cm_next < ck->ck_nedges && c == 0);
+}
+
+static void
+ckpt_diff_cb(uint8_t added, gelem_t from, gelem_t to, gelem_t w, gelem_t arg)
+{
+	ckpt_merge_t *cm = arg.ge_p;
+	if (ckpt_upto(cm, from, to) && !added) {
+		cm->cm_next++;
+	}
+	if (added) {
+		ckpt_put(cm, from, to, w);
+	}
+}
+
+/*
+ * Gives the empty graph `c` the edges that `g` had at snapshot `snap`, built
+ * from a checkpoint, if that's estimated to be cheaper than undoing the
+ * changes made since `snap`. Returns 0 if it did, and -1 if `c` should be
+ * built the usual way.
+ */
+int
+ckpt_clone(lg_graph_t *g, lg_graph_t *c, uint64_t snap)
+{
+	ckpt_t *before;
+	ckpt_t *after;
+	ckpt_merge_t cm;
+	gelem_t arg;
+	ckpt_near(g, snap, &before, &after);
+	if (before == NULL || after == NULL) {
+		/* the changes since `snap` are fewer than a checkpoint's */
+		return (-1);
+	}
+	uint64_t undo = g->gr_gen - after->ck_gen;
+	uint64_t redo = before->ck_nedges;
+	if (before->ck_snap != snap) {
+		redo += after->ck_gen - before->ck_gen;
+	}
+	if (undo <= redo) {
+		return (-1);
+	}
+	bzero(&cm, sizeof (cm));
+	cm.cm_ck = before;
+	arg.ge_p = &cm;
+	(void) lg_snap_diff_arg(g, before->ck_snap, snap, ckpt_diff_cb, arg);
+	while (cm.cm_next < before->ck_nedges) {
+		w_edge_t *we = &before->ck_edges[cm.cm_next];
+		ckpt_put(&cm, we->wed_from, we->wed_to, we->wed_weight);
+		cm.cm_next++;
+	}
+	(void) lg_edgestrat(c, g->gr_edgestrat);
+	(void) connect_batch(c, cm.cm_from, cm.cm_to,
+	    (c->gr_type == GRAPH_WE || c->gr_type == DIGRAPH_WE) ? cm.cm_w :
+	    NULL, cm.cm_n);
+	if (cm.cm_max > 0) {
+		lg_free(cm.cm_from, cm.cm_max * sizeof (gelem_t));
+		lg_free(cm.cm_to, cm.cm_max * sizeof (gelem_t));
+		lg_free(cm.cm_w, cm.cm_max * sizeof (gelem_t));
+	}
+	return (0);
+}
+
+/*
+ * Discards the checkpoints taken after snapshot `snap`, which `g` was just
+ * rolled back to.
+ */
+void
+ckpt_rollback(lg_graph_t *g, uint64_t snap)
+{
+	ckpt_t ck_min;
+	ckpt_t ck_max;
+	selem_t min;
+	selem_t max;
+	if (g->gr_ckpts == NULL || snap == UINT64_MAX) {
+		return;
+	}
+	ckpt_range(&ck_min, &ck_max, snap + 1, UINT64_MAX, &min, &max);
+	(void) slablist_rem_range(g->gr_ckpts, min, max, ckpt_free);
+}
+
+/*
+ * Discards the checkpoint of snapshot `snap`, which was just destroyed.
+ */
+void
+ckpt_destroy_snapshot(lg_graph_t *g, uint64_t snap)
+{
+	ckpt_t ck_min;
+	ckpt_t ck_max;
+	selem_t min;
+	selem_t max;
+	if (g->gr_ckpts == NULL) {
+		return;
+	}
+	ckpt_range(&ck_min, &ck_max, snap, snap, &min, &max);
+	(void) slablist_rem_range(g->gr_ckpts, min, max, ckpt_free);
+}
+
+static selem_t
+ckpt_copy_cb(selem_t zero, selem_t *e, uint64_t sz)
+{
+	lg_graph_t *c = zero.sle_p;
+	selem_t se;
+	uint64_t i = 0;
+	while (i < sz) {
+		ckpt_t *ck = e[i].sle_p;
+		ckpt_t *cc = lg_zalloc(sizeof (ckpt_t));
+		*cc = *ck;
+		if (ck->ck_nedges > 0) {
+			cc->ck_edges = lg_zalloc(ck->ck_nedges *
+			    sizeof (w_edge_t));
+			bcopy(ck->ck_edges, cc->ck_edges,
+			    ck->ck_nedges * sizeof (w_edge_t));
+		}
+		se.sle_p = cc;
+		(void) slablist_add(c->gr_ckpts, se, 0);
+		i++;
+	}
+	return (zero);
+}
+
+/*
+ * Gives `c`, which has just been given copies of the snapshots of `g` (see
+ * lg_copy), copies of the checkpoints of `g`.
+ */
+void
+ckpt_copy(lg_graph_t *g, lg_graph_t *c)
+{
+	selem_t zero;
+	if (g->gr_ckpts == NULL) {
+		return;
+	}
+	c->gr_ckpts = slablist_create("checkpoints", ckpt_cmp, ckpt_bnd,
+	    SL_SORTED);
+	zero.sle_p = c;
+	slablist_foldr(g->gr_ckpts, ckpt_copy_cb, zero);
+}
+
+void
+ckpt_destroy(lg_graph_t *g)
+{
+	if (g->gr_ckpts == NULL) {
+		return;
+	}
+	slablist_destroy(g->gr_ckpts, ckpt_free);
+	g->gr_ckpts = NULL;
+}
+
+/*
+ * Makes lg_snapshot() take a checkpoint (see the top of this file) whenever
+ * `nsnaps` snapshots have been taken, or `nchanges` changes have been made,
+ * since the last one. Either can be 0, to ignore it, and if both are, no more
+ * checkpoints are taken, and the ones that were are discarded. A checkpoint
+ * costs space proportional to the edges that the graph has when it is taken.
+ */
+void
+lg_checkpoint_every(lg_graph_t *g, uint64_t nsnaps, uint64_t nchanges)
+{
+	g->gr_ckpt_snaps = nsnaps;
+	g->gr_ckpt_changes = nchanges;
+	if (nsnaps == 0 && nchanges == 0) {
+		ckpt_destroy(g);
+	}
+}
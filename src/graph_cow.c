@@ -0,0 +1,572 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2015, Nick Zivkovic
+ */
+
+/*
+ * This file implements the copy-on-write sharing of edges between a graph and
+ * its clones (see lg_clone).
+ *
+ * A clone doesn't copy the edges of its parent. Instead, the edge-list (and
+ * the node dictionary, if the graph is dense) is handed over to a cow_t, which
+ * both graphs point to, and which counts the graphs that share it. The shared
+ * edges are allocated from the cow_t's own arena, so that they outlive
+ * whichever graph is destroyed first. The dictionary is only ever appended to,
+ * so every graph that shares it can intern new nodes into it.
+ *
+ * The shared edge-list is never changed while more than one graph points to
+ * it. Instead, every graph keeps its own changes in an overlay of two sorted
+ * lists, much like the records of a view (see graph_view.c): `gr_ov_add`
+ * holds the edges that the graph has and the shared list doesn't, which are
+ * allocated from the graph's own arena, and `gr_ov_rem` holds the shared edges
+ * that the graph doesn't have. The edges of the graph are thus the shared
+ * ones, minus those in `gr_ov_rem`, plus those in `gr_ov_add`. Changing the
+ * weight of a shared edge puts the edge into `gr_ov_rem`, and a copy of it,
+ * with the new weight, into `gr_ov_add`. The overlay is created by the first
+ * change that actually happens, so a graph that is only read has none.
+ *
+ * Code that reads the edges goes through edges_foldr(), edges_find() and
+ * friends, which merge the overlay in. A graph without an overlay is read
+ * straight from `gr_edges`, at no extra cost. Every change goes through
+ * edges_add() and edges_rem(), by way of edge_add() and edge_rem() in
+ * graph.c, and the code in graph.c that would rebuild the whole edge-list
+ * changes the edges one by one instead, while they are shared.
+ *
+ * The last graph to share the edges takes them back by applying its overlay to
+ * them, which costs time proportional to the size of the overlay. The edges
+ * are only ever copied by lg_compact().
+ *
+ * The incoming-edge index and the node table of every graph are its own.
+ * Since the index of a graph that uses EDGE_PTR points to the shared edges, it
+ * is dropped when the graph copies them, and rebuilt when it is next needed.
+ */
+
+#include <stdlib.h>
+#include <strings.h>
+#include "graph_impl.h"
+
+/* the most merged edges that are handed to a fold callback at once */
+#define	COW_BATCH	64
+
+/*
+ * A growable array of edges, which holds the part of an overlay that a merged
+ * fold walks.
+ */
+typedef struct cow_vec {
+	selem_t		*cv_e;
+	uint64_t	cv_n;
+	uint64_t	cv_max;
+} cow_vec_t;
+
+/*
+ * The state of a merged fold (see cow_fold()).
+ */
+typedef struct cow_fold {
+	lg_graph_t	*cf_g;
+	slablist_fold_t	*cf_cb;
+	selem_t		cf_zero;
+	cow_vec_t	cf_add;
+	cow_vec_t	cf_rem;
+	uint64_t	cf_ai;		/* next edge of `cf_add` */
+	uint64_t	cf_ri;		/* next edge of `cf_rem` */
+	uint64_t	cf_nbuf;
+	selem_t		cf_buf[COW_BATCH];
+} cow_fold_t;
+
+/*
+ * The state of cow_copy_cb().
+ */
+typedef struct cow_copy {
+	lg_graph_t	*cc_g;
+	slablist_t	*cc_sl;
+	int		cc_own;		/* copy the edges that aren't ours */
+} cow_copy_t;
+
+static void
+ov_create(lg_graph_t *g)
+{
+	g->gr_ov_add = edges_create(g, "cow_add");
+	g->gr_ov_rem = edges_create(g, "cow_rem");
+}
+
+/*
+ * Drops the overlay of `g`. Its edges aren't freed, since they either belong
+ * to the shared edges, or have been handed over to some other list.
+ */
+static void
+ov_destroy(lg_graph_t *g)
+{
+	if (g->gr_ov_add == NULL) {
+		return;
+	}
+	slablist_destroy(g->gr_ov_add, NULL);
+	slablist_destroy(g->gr_ov_rem, NULL);
+	g->gr_ov_add = NULL;
+	g->gr_ov_rem = NULL;
+}
+
+/*
+ * Returns non-zero if `e` is one of the shared edges of `g`, which `g` must
+ * neither free nor change.
+ */
+int
+edge_shared(lg_graph_t *g, selem_t e)
+{
+	return (g->gr_cow != NULL && !EDGE_PACKED(g) &&
+	    !arena_owns(&g->gr_ar_edges, e.sle_p));
+}
+
+/*
+ * Adds the edges in `e` to `cc_sl`. If `cc_own` is set, the edges that `cc_g`
+ * doesn't own are copied into its arena first.
+ */
+static selem_t
+cow_copy_cb(selem_t zero, selem_t *e, uint64_t sz)
+{
+	cow_copy_t *cc = zero.sle_p;
+	lg_graph_t *g = cc->cc_g;
+	selem_t se;
+	uint64_t i = 0;
+	while (i < sz) {
+		se = e[i];
+		if (!cc->cc_own || EDGE_PACKED(g) ||
+		    arena_owns(&g->gr_ar_edges, se.sle_p)) {
+			(void) slablist_add(cc->cc_sl, se, 0);
+			i++;
+			continue;
+		}
+		if (g->gr_type == GRAPH_WE || g->gr_type == DIGRAPH_WE) {
+			w_edge_t *we = lg_mk_w_edge(g);
+			*we = *(w_edge_t *)e[i].sle_p;
+			se.sle_p = we;
+		} else {
+			edge_t *ed = lg_mk_edge(g);
+			*ed = *(edge_t *)e[i].sle_p;
+			se.sle_p = ed;
+		}
+		(void) slablist_add(cc->cc_sl, se, 0);
+		i++;
+	}
+	return (zero);
+}
+
+/*
+ * Makes the empty graph `c` share the edges of `g`. If `g` has an overlay, `c`
+ * gets a copy of it.
+ */
+void
+cow_share(lg_graph_t *g, lg_graph_t *c)
+{
+	cow_t *cw = g->gr_cow;
+	if (cw == NULL) {
+		cw = lg_zalloc(sizeof (cow_t));
+		cw->cw_refs = 1;
+		cw->cw_edges = g->gr_edges;
+		cw->cw_dict = g->gr_dict;
+		arena_init(&cw->cw_ar, g->gr_ar_edges.ar_size);
+		arena_merge(&cw->cw_ar, &g->gr_ar_edges);
+		g->gr_cow = cw;
+	}
+	slablist_destroy(c->gr_edges, NULL);
+	c->gr_edges = cw->cw_edges;
+	c->gr_dict = cw->cw_dict;
+	c->gr_edgestrat = g->gr_edgestrat;
+	c->gr_cow = cw;
+	cw->cw_refs++;
+	if (g->gr_ov_add == NULL) {
+		return;
+	}
+	ov_create(c);
+	cow_copy_t cc;
+	cc.cc_g = c;
+	selem_t zero;
+	zero.sle_p = &cc;
+	cc.cc_sl = c->gr_ov_add;
+	cc.cc_own = 1;
+	slablist_foldr(g->gr_ov_add, cow_copy_cb, zero);
+	cc.cc_sl = c->gr_ov_rem;
+	cc.cc_own = 0;
+	slablist_foldr(g->gr_ov_rem, cow_copy_cb, zero);
+}
+
+static selem_t
+adopt_rem_cb(selem_t zero, selem_t *e, uint64_t sz)
+{
+	lg_graph_t *g = zero.sle_p;
+	uint64_t i = 0;
+	while (i < sz) {
+		(void) slablist_rem(g->gr_edges, e[i], 0, NULL);
+		edge_free(g, e[i]);
+		i++;
+	}
+	return (zero);
+}
+
+static selem_t
+adopt_add_cb(selem_t zero, selem_t *e, uint64_t sz)
+{
+	lg_graph_t *g = zero.sle_p;
+	uint64_t i = 0;
+	while (i < sz) {
+		(void) slablist_add(g->gr_edges, e[i], 0);
+		i++;
+	}
+	return (zero);
+}
+
+/*
+ * Takes the shared edges back from the last graph that shares them, and
+ * applies its overlay to them.
+ */
+static void
+cow_adopt(lg_graph_t *g)
+{
+	cow_t *cw = g->gr_cow;
+	arena_merge(&g->gr_ar_edges, &cw->cw_ar);
+	lg_free(cw, sizeof (cow_t));
+	g->gr_cow = NULL;
+	if (g->gr_ov_add == NULL) {
+		return;
+	}
+	selem_t zero;
+	zero.sle_p = g;
+	slablist_foldr(g->gr_ov_rem, adopt_rem_cb, zero);
+	slablist_foldr(g->gr_ov_add, adopt_add_cb, zero);
+	ov_destroy(g);
+}
+
+/*
+ * Gets `g` ready for a change to its edges, which has to go to its overlay if
+ * `g` shares its edges, or to `gr_edges` otherwise. This is called only once
+ * it is known that the change will happen.
+ */
+void
+cow_write(lg_graph_t *g)
+{
+	cow_t *cw = g->gr_cow;
+	if (cw == NULL) {
+		return;
+	}
+	if (cw->cw_refs == 1) {
+		cow_adopt(g);
+		return;
+	}
+	if (g->gr_ov_add == NULL) {
+		ov_create(g);
+	}
+}
+
+/*
+ * Lets go of the shared edges of a graph that is about to be destroyed. The
+ * graph is left with an empty edge-list of its own.
+ */
+void
+cow_release(lg_graph_t *g)
+{
+	cow_t *cw = g->gr_cow;
+	if (cw == NULL) {
+		return;
+	}
+	if (cw->cw_refs == 1) {
+		cow_adopt(g);
+		return;
+	}
+	ov_destroy(g);
+	g->gr_edges = edges_create(g, NULL);
+	g->gr_dict = NULL;
+	cw->cw_refs--;
+	g->gr_cow = NULL;
+}
+
+/*
+ * Gives `g` edges of its own right away, if it shares them with a clone (see
+ * lg_clone), by copying the edges that it has into a new edge-list. This
+ * costs as much as lg_copy(), and makes reading `g` as cheap as reading a
+ * graph that was never cloned. If `g` is the last graph that shares its
+ * edges, it just takes them back, without copying them.
+ */
+void
+lg_compact(lg_graph_t *g)
+{
+	cow_t *cw = g->gr_cow;
+	if (cw == NULL) {
+		return;
+	}
+	if (cw->cw_refs == 1) {
+		cow_adopt(g);
+		return;
+	}
+	cow_copy_t cc;
+	cc.cc_g = g;
+	cc.cc_sl = edges_create(g, NULL);
+	cc.cc_own = 1;
+	selem_t zero;
+	zero.sle_p = &cc;
+	edges_foldr(g, cow_copy_cb, zero);
+	ov_destroy(g);
+	g->gr_edges = cc.cc_sl;
+	if (cw->cw_dict != NULL) {
+		g->gr_dict = dict_copy(cw->cw_dict);
+	}
+	if (!EDGE_PACKED(g) && g->gr_in_edges != NULL) {
+		slablist_destroy(g->gr_in_edges, NULL);
+		g->gr_in_edges = NULL;
+	}
+	cw->cw_refs--;
+	g->gr_cow = NULL;
+}
+
+/*
+ * Returns the number of edges of `g`, overlay included.
+ */
+uint64_t
+edges_nelems(lg_graph_t *g)
+{
+	uint64_t n = slablist_get_elems(g->gr_edges);
+	if (g->gr_ov_add != NULL) {
+		n -= slablist_get_elems(g->gr_ov_rem);
+		n += slablist_get_elems(g->gr_ov_add);
+	}
+	return (n);
+}
+
+/*
+ * Like slablist_find() on `gr_edges`, but with the overlay merged in.
+ */
+int
+edges_find(lg_graph_t *g, selem_t key, selem_t *found)
+{
+	if (g->gr_ov_add != NULL) {
+		if (slablist_get_elems(g->gr_ov_add) > 0 &&
+		    slablist_find(g->gr_ov_add, key, found) != SL_ENFOUND) {
+			return (SL_SUCCESS);
+		}
+		if (slablist_get_elems(g->gr_ov_rem) > 0 &&
+		    slablist_find(g->gr_ov_rem, key, found) != SL_ENFOUND) {
+			return (SL_ENFOUND);
+		}
+	}
+	if (slablist_get_elems(g->gr_edges) == 0) {
+		return (SL_ENFOUND);
+	}
+	return (slablist_find(g->gr_edges, key, found));
+}
+
+/*
+ * Adds the edge `e` to `g`, or returns SL_EDUP if `g` already has it.
+ */
+int
+edges_add(lg_graph_t *g, selem_t e)
+{
+	selem_t found;
+	if (g->gr_cow == NULL) {
+		return (slablist_add(g->gr_edges, e, 0));
+	}
+	if (edges_find(g, e, &found) != SL_ENFOUND) {
+		return (SL_EDUP);
+	}
+	cow_write(g);
+	if (g->gr_cow == NULL) {
+		return (slablist_add(g->gr_edges, e, 0));
+	}
+	return (slablist_add(g->gr_ov_add, e, 0));
+}
+
+/*
+ * Removes the edge `key` from `g`, or returns SL_ENFOUND if `g` doesn't have
+ * it. A shared edge is only hidden, and never passed to `cb`.
+ */
+int
+edges_rem(lg_graph_t *g, selem_t key, slablist_rem_cb_t *cb)
+{
+	selem_t found;
+	selem_t own;
+	if (g->gr_cow == NULL) {
+		return (slablist_rem(g->gr_edges, key, 0, cb));
+	}
+	if (edges_find(g, key, &found) == SL_ENFOUND) {
+		return (SL_ENFOUND);
+	}
+	cow_write(g);
+	if (g->gr_cow == NULL) {
+		return (slablist_rem(g->gr_edges, key, 0, cb));
+	}
+	if (slablist_get_elems(g->gr_ov_add) > 0 &&
+	    slablist_find(g->gr_ov_add, key, &own) != SL_ENFOUND) {
+		return (slablist_rem(g->gr_ov_add, key, 0, cb));
+	}
+	return (slablist_add(g->gr_ov_rem, found, 0));
+}
+
+static selem_t
+cow_collect_cb(selem_t zero, selem_t *e, uint64_t sz)
+{
+	cow_vec_t *cv = zero.sle_p;
+	if (cv->cv_n + sz > cv->cv_max) {
+		uint64_t nmax = cv->cv_max * 2;
+		if (nmax < cv->cv_n + sz) {
+			nmax = cv->cv_n + sz;
+		}
+		selem_t *ne = lg_zalloc(nmax * sizeof (selem_t));
+		if (cv->cv_n > 0) {
+			bcopy(cv->cv_e, ne, cv->cv_n * sizeof (selem_t));
+		}
+		lg_free(cv->cv_e, cv->cv_max * sizeof (selem_t));
+		cv->cv_e = ne;
+		cv->cv_max = nmax;
+	}
+	bcopy(e, cv->cv_e + cv->cv_n, sz * sizeof (selem_t));
+	cv->cv_n += sz;
+	return (zero);
+}
+
+/*
+ * Collects the edges of `sl` between `min` and `max` (or all of them, if `min`
+ * is NULL) into `cv`, which is only allocated if there are any.
+ */
+static void
+cow_collect(slablist_t *sl, cow_vec_t *cv, selem_t *min, selem_t *max)
+{
+	bzero(cv, sizeof (cow_vec_t));
+	if (slablist_get_elems(sl) == 0) {
+		return;
+	}
+	selem_t zero;
+	zero.sle_p = cv;
+	if (min == NULL) {
+		slablist_foldr(sl, cow_collect_cb, zero);
+	} else {
+		slablist_foldr_range(sl, cow_collect_cb, *min, *max, zero);
+	}
+}
+
+static int
+cow_cmp(lg_graph_t *g, selem_t e1, selem_t e2)
+{
+	uint64_t kf1;
+	uint64_t kt1;
+	uint64_t kf2;
+	uint64_t kt2;
+	elem_keys(g, e1, &kf1, &kt1);
+	elem_keys(g, e2, &kf2, &kt2);
+	if (kf1 != kf2) {
+		return (kf1 < kf2 ? -1 : 1);
+	}
+	if (kt1 != kt2) {
+		return (kt1 < kt2 ? -1 : 1);
+	}
+	return (0);
+}
+
+static void
+cow_emit(cow_fold_t *cf, selem_t e)
+{
+	cf->cf_buf[cf->cf_nbuf++] = e;
+	if (cf->cf_nbuf == COW_BATCH) {
+		cf->cf_zero = cf->cf_cb(cf->cf_zero, cf->cf_buf, COW_BATCH);
+		cf->cf_nbuf = 0;
+	}
+}
+
+/*
+ * Called on the shared edges, in order. Every edge of `cf_add` that sorts
+ * before a shared edge is passed on ahead of it, and a shared edge that is in
+ * `cf_rem` isn't passed on at all. Since `cf_rem` only holds shared edges, it
+ * is walked in step with them.
+ */
+static selem_t
+cow_merge_cb(selem_t zero, selem_t *e, uint64_t sz)
+{
+	cow_fold_t *cf = zero.sle_p;
+	cow_vec_t *add = &cf->cf_add;
+	cow_vec_t *rem = &cf->cf_rem;
+	uint64_t i = 0;
+	while (i < sz) {
+		while (cf->cf_ai < add->cv_n &&
+		    cow_cmp(cf->cf_g, add->cv_e[cf->cf_ai], e[i]) < 0) {
+			cow_emit(cf, add->cv_e[cf->cf_ai]);
+			cf->cf_ai++;
+		}
+		if (cf->cf_ri < rem->cv_n &&
+		    cow_cmp(cf->cf_g, rem->cv_e[cf->cf_ri], e[i]) == 0) {
+			cf->cf_ri++;
+		} else {
+			cow_emit(cf, e[i]);
+		}
+		i++;
+	}
+	return (zero);
+}
+
+/*
+ * Folds over the edges of `g` between `min` and `max` (or all of them, if
+ * `min` is NULL), in order, with the overlay merged in. The callback gets at
+ * most COW_BATCH edges at a time, instead of whole slabs. Besides the walk of
+ * the shared edges, this costs a copy of the part of the overlay that is in
+ * range.
+ */
+static selem_t
+cow_fold(lg_graph_t *g, slablist_fold_t *cb, selem_t *min, selem_t *max,
+    selem_t zero)
+{
+	cow_fold_t cf;
+	if (g->gr_ov_add != NULL) {
+		cow_collect(g->gr_ov_add, &cf.cf_add, min, max);
+		cow_collect(g->gr_ov_rem, &cf.cf_rem, min, max);
+	}
+	if (g->gr_ov_add == NULL ||
+	    (cf.cf_add.cv_n == 0 && cf.cf_rem.cv_n == 0)) {
+		if (min == NULL) {
+			return (slablist_foldr(g->gr_edges, cb, zero));
+		}
+		return (slablist_foldr_range(g->gr_edges, cb, *min, *max,
+		    zero));
+	}
+	cf.cf_g = g;
+	cf.cf_cb = cb;
+	cf.cf_zero = zero;
+	cf.cf_ai = 0;
+	cf.cf_ri = 0;
+	cf.cf_nbuf = 0;
+	selem_t z;
+	z.sle_p = &cf;
+	if (min == NULL) {
+		slablist_foldr(g->gr_edges, cow_merge_cb, z);
+	} else {
+		slablist_foldr_range(g->gr_edges, cow_merge_cb, *min, *max, z);
+	}
+	while (cf.cf_ai < cf.cf_add.cv_n) {
+		cow_emit(&cf, cf.cf_add.cv_e[cf.cf_ai]);
+		cf.cf_ai++;
+	}
+	if (cf.cf_nbuf > 0) {
+		cf.cf_zero = cb(cf.cf_zero, cf.cf_buf, cf.cf_nbuf);
+	}
+	lg_free(cf.cf_add.cv_e, cf.cf_add.cv_max * sizeof (selem_t));
+	lg_free(cf.cf_rem.cv_e, cf.cf_rem.cv_max * sizeof (selem_t));
+	return (cf.cf_zero);
+}
+
+/*
+ * Like slablist_foldr() on `gr_edges`, but with the overlay merged in.
+ */
+selem_t
+edges_foldr(lg_graph_t *g, slablist_fold_t *cb, selem_t zero)
+{
+	return (cow_fold(g, cb, NULL, NULL, zero));
+}
+
+/*
+ * Like slablist_foldr_range() on `gr_edges`, but with the overlay merged in.
+ */
+selem_t
+edges_foldr_range(lg_graph_t *g, slablist_fold_t *cb, selem_t min,
+    selem_t max, selem_t zero)
+{
+	return (cow_fold(g, cb, &min, &max, zero));
+}
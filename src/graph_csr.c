@@ -0,0 +1,645 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2015, Nick Zivkovic
+ */
+
+/*
+ * This file implements the compressed-sparse-row (CSR) image that backs frozen
+ * graphs (see lg_freeze() in graph.c), and the traversal functions that walk
+ * over such an image.
+ *
+ * The traversals here are meant to be observably identical to their
+ * slablist-backed counterparts in graph.c: they call the same callbacks, in
+ * the same order, with the same arguments, and fire the same probes (except
+ * for the bookmark-probes, since there are no bookmarks). The only difference
+ * is that the queues, stacks, and visited-sets are flat arrays and bitmaps
+ * indexed by node-slot, instead of slablists.
+ */
+
+#include <stdlib.h>
+#include <strings.h>
+#include "graph_impl.h"
+#include "graph_provider.h"
+
+#define	BM_WORDS(n)	(((n) + 63) / 64)
+#define	BM_TEST(b, i)	((b)[(i) / 64] & (1ULL << ((i) % 64)))
+#define	BM_SET(b, i)	((b)[(i) / 64] |= (1ULL << ((i) % 64)))
+
+typedef struct csr_build_args {
+	lg_graph_t	*cba_g;
+	csr_t		*cba_csr;
+	uint64_t	*cba_ends;
+	uint64_t	cba_i;
+} csr_build_args_t;
+
+static int
+u64_cmp(const void *a, const void *b)
+{
+	uint64_t u1 = *(const uint64_t *)a;
+	uint64_t u2 = *(const uint64_t *)b;
+	if (u1 < u2) {
+		return (-1);
+	}
+	if (u1 > u2) {
+		return (1);
+	}
+	return (0);
+}
+
+/*
+ * First pass: collect both endpoints of every edge.
+ */
+static selem_t
+csr_collect_ends(selem_t z, selem_t *e, uint64_t sz)
+{
+	csr_build_args_t *a = z.sle_p;
+	gelem_t from;
+	gelem_t to;
+	gelem_t w;
+	uint64_t i = 0;
+	while (i < sz) {
+		edge_get(a->cba_g, e[i], &from, &to, &w);
+		a->cba_ends[a->cba_i++] = from.ge_u;
+		a->cba_ends[a->cba_i++] = to.ge_u;
+		i++;
+	}
+	return (z);
+}
+
+/*
+ * Second pass: count the length of each row.
+ */
+static selem_t
+csr_count_rows(selem_t z, selem_t *e, uint64_t sz)
+{
+	csr_build_args_t *a = z.sle_p;
+	csr_t *cs = a->cba_csr;
+	gelem_t from;
+	gelem_t to;
+	gelem_t w;
+	uint64_t i = 0;
+	while (i < sz) {
+		edge_get(a->cba_g, e[i], &from, &to, &w);
+		cs->cs_off[csr_find(cs, from) + 1]++;
+		if (GRAPH_UNDIRECTED(a->cba_g)) {
+			cs->cs_off[csr_find(cs, to) + 1]++;
+		}
+		i++;
+	}
+	return (z);
+}
+
+/*
+ * Third pass: translate every edge into node-slots, and append it to its row.
+ * In a dense graph the nodes aren't in slot order, and an undirected edge goes
+ * into two rows, which is why we keep a cursor per row.
+ */
+static selem_t
+csr_fill_rows(selem_t z, selem_t *e, uint64_t sz)
+{
+	csr_build_args_t *a = z.sle_p;
+	csr_t *cs = a->cba_csr;
+	gelem_t from;
+	gelem_t to;
+	gelem_t w;
+	uint64_t i = 0;
+	while (i < sz) {
+		edge_get(a->cba_g, e[i], &from, &to, &w);
+		uint64_t f = csr_find(cs, from);
+		uint64_t t = csr_find(cs, to);
+		uint64_t j = a->cba_ends[f]++;
+		cs->cs_adj[j] = t;
+		if (cs->cs_weights != NULL) {
+			cs->cs_weights[j] = w;
+		}
+		if (GRAPH_UNDIRECTED(a->cba_g)) {
+			j = a->cba_ends[t]++;
+			cs->cs_adj[j] = f;
+			if (cs->cs_weights != NULL) {
+				cs->cs_weights[j] = w;
+			}
+		}
+		i++;
+	}
+	return (z);
+}
+
+/*
+ * Builds a CSR image of the graph's current edge-list. This takes three passes
+ * over the edges and a sort of the endpoints, so it's O(E log E).
+ */
+csr_t *
+csr_build(lg_graph_t *g)
+{
+	csr_t *cs = lg_zalloc(sizeof (csr_t));
+	uint64_t nedges = edges_nelems(g);
+	/* the image holds both directions of an undirected edge */
+	cs->cs_nedges = nedges;
+	if (GRAPH_UNDIRECTED(g)) {
+		cs->cs_nedges *= 2;
+	}
+	csr_build_args_t args;
+	selem_t zero;
+	zero.sle_p = &args;
+	args.cba_g = g;
+	args.cba_csr = cs;
+	args.cba_i = 0;
+	args.cba_ends = NULL;
+
+	if (nedges > 0) {
+		args.cba_ends = lg_zalloc(2 * nedges * sizeof (uint64_t));
+		edges_foldr(g, csr_collect_ends, zero);
+		qsort(args.cba_ends, 2 * nedges, sizeof (uint64_t), u64_cmp);
+	}
+	uint64_t i = 0;
+	uint64_t nnodes = 0;
+	while (i < 2 * nedges) {
+		if (nnodes == 0 ||
+		    args.cba_ends[i] != args.cba_ends[nnodes - 1]) {
+			args.cba_ends[nnodes++] = args.cba_ends[i];
+		}
+		i++;
+	}
+	cs->cs_nnodes = nnodes;
+	cs->cs_nodes = lg_zalloc((nnodes + 1) * sizeof (gelem_t));
+	i = 0;
+	while (i < nnodes) {
+		cs->cs_nodes[i].ge_u = args.cba_ends[i];
+		i++;
+	}
+	lg_free(args.cba_ends, 2 * nedges * sizeof (uint64_t));
+
+	cs->cs_off = lg_zalloc((nnodes + 1) * sizeof (uint64_t));
+	cs->cs_adj = lg_zalloc((cs->cs_nedges + 1) * sizeof (uint64_t));
+	if (g->gr_type == GRAPH_WE || g->gr_type == DIGRAPH_WE) {
+		cs->cs_weights = lg_zalloc((cs->cs_nedges + 1) *
+		    sizeof (gelem_t));
+	}
+	if (nedges > 0) {
+		edges_foldr(g, csr_count_rows, zero);
+	}
+	i = 0;
+	while (i < nnodes) {
+		cs->cs_off[i + 1] += cs->cs_off[i];
+		i++;
+	}
+	/* `cba_ends` is reused as the per-row cursor */
+	args.cba_ends = lg_zalloc((nnodes + 1) * sizeof (uint64_t));
+	bcopy(cs->cs_off, args.cba_ends, (nnodes + 1) * sizeof (uint64_t));
+	if (nedges > 0) {
+		edges_foldr(g, csr_fill_rows, zero);
+	}
+	lg_free(args.cba_ends, (nnodes + 1) * sizeof (uint64_t));
+	return (cs);
+}
+
+void
+csr_destroy(csr_t *cs)
+{
+	lg_free(cs->cs_nodes, (cs->cs_nnodes + 1) * sizeof (gelem_t));
+	lg_free(cs->cs_off, (cs->cs_nnodes + 1) * sizeof (uint64_t));
+	lg_free(cs->cs_adj, (cs->cs_nedges + 1) * sizeof (uint64_t));
+	lg_free(cs->cs_weights, (cs->cs_nedges + 1) * sizeof (gelem_t));
+	lg_free(cs, sizeof (csr_t));
+}
+
+/*
+ * Returns the slot of `n`, or CSR_NONE if `n` isn't an endpoint of any edge.
+ */
+uint64_t
+csr_find(csr_t *cs, gelem_t n)
+{
+	uint64_t lo = 0;
+	uint64_t hi = cs->cs_nnodes;
+	while (lo < hi) {
+		uint64_t mid = lo + (hi - lo) / 2;
+		if (cs->cs_nodes[mid].ge_u < n.ge_u) {
+			lo = mid + 1;
+		} else if (cs->cs_nodes[mid].ge_u > n.ge_u) {
+			hi = mid;
+		} else {
+			return (mid);
+		}
+	}
+	return (CSR_NONE);
+}
+
+gelem_t
+csr_weight(csr_t *cs, uint64_t j)
+{
+	gelem_t w;
+	if (cs->cs_weights == NULL) {
+		w.ge_u = 0;
+		return (w);
+	}
+	return (cs->cs_weights[j]);
+}
+
+/*
+ * The CSR version of lg_bfs_fold(). Every node gets enqueued at most once, so
+ * the queue is just an array of `cs_nnodes` slots, and the visited-set is a
+ * bitmap.
+ */
+gelem_t
+csr_bfs_fold(lg_graph_t *g, csr_t *cs, gelem_t start, adj_cb_t *acb,
+    fold_cb_t *cb, gelem_t gzero)
+{
+	(void)g;
+	GRAPH_BFS_BEGIN(g);
+	if (cs->cs_nedges == 0) {
+		return (gzero);
+	}
+	gelem_t agg = gzero;
+	uint64_t s = csr_find(cs, start);
+	GRAPH_BFS_ENQ(start);
+	if (s == CSR_NONE) {
+		/* `start` has no edges, so it's the only node we visit */
+		GRAPH_BFS_DEQ(start);
+		if (cb != NULL) {
+			(void)cb(agg, start, &agg);
+		}
+		GRAPH_BFS_END(g);
+		return (agg);
+	}
+	uint64_t *Q = lg_zalloc(cs->cs_nnodes * sizeof (uint64_t));
+	uint64_t *V = lg_zalloc(BM_WORDS(cs->cs_nnodes) * sizeof (uint64_t));
+	uint64_t head = 0;
+	uint64_t tail = 0;
+	Q[tail++] = s;
+	BM_SET(V, s);
+	while (head < tail) {
+		uint64_t last = Q[head++];
+		gelem_t from = cs->cs_nodes[last];
+		GRAPH_BFS_DEQ(from);
+		if (cb != NULL && cb(agg, from, &agg)) {
+			break;
+		}
+		uint64_t j = cs->cs_off[last];
+		while (j < cs->cs_off[last + 1]) {
+			uint64_t adj = cs->cs_adj[j];
+			if (!BM_TEST(V, adj)) {
+				gelem_t to = cs->cs_nodes[adj];
+				if (acb != NULL) {
+					acb(to, from, csr_weight(cs, j), agg);
+				}
+				GRAPH_BFS_ENQ(to);
+				Q[tail++] = adj;
+				GRAPH_BFS_VISIT(to);
+				BM_SET(V, adj);
+			}
+			j++;
+		}
+	}
+	lg_free(Q, cs->cs_nnodes * sizeof (uint64_t));
+	lg_free(V, BM_WORDS(cs->cs_nnodes) * sizeof (uint64_t));
+	GRAPH_BFS_END(g);
+	return (agg);
+}
+
+/*
+ * The CSR version of lg_bfs_rdnt_fold(). Since nodes can be enqueued any number
+ * of times, the queue is an array that doubles in size when it fills up.
+ */
+gelem_t
+csr_bfs_rdnt_fold(lg_graph_t *g, csr_t *cs, gelem_t start, adj_cb_t *acb,
+    fold_cb_t *cb, gelem_t gzero)
+{
+	(void)g;
+	GRAPH_BFS_RDNT_BEGIN(g);
+	if (cs->cs_nedges == 0) {
+		return (gzero);
+	}
+	gelem_t agg = gzero;
+	uint64_t s = csr_find(cs, start);
+	GRAPH_BFS_RDNT_ENQ(start);
+	if (s == CSR_NONE) {
+		GRAPH_BFS_RDNT_DEQ(start);
+		if (cb != NULL) {
+			(void)cb(agg, start, &agg);
+		}
+		GRAPH_BFS_RDNT_END(g);
+		return (agg);
+	}
+	uint64_t cap = cs->cs_nnodes;
+	uint64_t *Q = lg_zalloc(cap * sizeof (uint64_t));
+	uint64_t head = 0;
+	uint64_t tail = 0;
+	Q[tail++] = s;
+	while (head < tail) {
+		uint64_t last = Q[head++];
+		gelem_t from = cs->cs_nodes[last];
+		GRAPH_BFS_RDNT_DEQ(from);
+		if (cb != NULL && cb(agg, from, &agg)) {
+			break;
+		}
+		uint64_t deg = cs->cs_off[last + 1] - cs->cs_off[last];
+		if (tail + deg > cap) {
+			/* slide the live part of the queue down, then grow */
+			uint64_t live = tail - head;
+			uint64_t ncap = cap;
+			while (live + deg > ncap) {
+				ncap *= 2;
+			}
+			uint64_t *nQ = lg_zalloc(ncap * sizeof (uint64_t));
+			bcopy(&Q[head], nQ, live * sizeof (uint64_t));
+			lg_free(Q, cap * sizeof (uint64_t));
+			Q = nQ;
+			cap = ncap;
+			head = 0;
+			tail = live;
+		}
+		uint64_t j = cs->cs_off[last];
+		while (j < cs->cs_off[last + 1]) {
+			gelem_t to = cs->cs_nodes[cs->cs_adj[j]];
+			if (acb != NULL) {
+				acb(to, from, csr_weight(cs, j), agg);
+			}
+			GRAPH_BFS_RDNT_ENQ(to);
+			Q[tail++] = cs->cs_adj[j];
+			j++;
+		}
+	}
+	lg_free(Q, cap * sizeof (uint64_t));
+	GRAPH_BFS_RDNT_END(g);
+	return (agg);
+}
+
+/*
+ * A DFS stack-frame: the node's slot, and the position in `cs_adj` of the next
+ * neighbor to try.
+ */
+typedef struct csr_frame {
+	uint64_t	cf_node;
+	uint64_t	cf_cur;
+} csr_frame_t;
+
+typedef struct csr_stack {
+	csr_frame_t	*cst_frames;
+	uint64_t	cst_depth;
+	uint64_t	cst_cap;
+} csr_stack_t;
+
+static void
+csr_push(csr_t *cs, csr_stack_t *S, uint64_t node)
+{
+	if (S->cst_depth == S->cst_cap) {
+		uint64_t ncap = S->cst_cap == 0 ? 64 : S->cst_cap * 2;
+		csr_frame_t *nf = lg_zalloc(ncap * sizeof (csr_frame_t));
+		if (S->cst_frames != NULL) {
+			bcopy(S->cst_frames, nf,
+			    S->cst_depth * sizeof (csr_frame_t));
+			lg_free(S->cst_frames,
+			    S->cst_cap * sizeof (csr_frame_t));
+		}
+		S->cst_frames = nf;
+		S->cst_cap = ncap;
+	}
+	S->cst_frames[S->cst_depth].cf_node = node;
+	S->cst_frames[S->cst_depth].cf_cur = cs->cs_off[node];
+	S->cst_depth++;
+}
+
+static void
+csr_stack_destroy(csr_stack_t *S)
+{
+	lg_free(S->cst_frames, S->cst_cap * sizeof (csr_frame_t));
+}
+
+/*
+ * Returns the next neighbor of the top frame that hasn't been visited (or the
+ * next neighbor, period, if `V` is NULL), and advances the frame's cursor past
+ * it. Returns CSR_NONE if the top frame has no neighbors left.
+ */
+static uint64_t
+csr_pushable(csr_t *cs, csr_stack_t *S, uint64_t *V)
+{
+	if (S->cst_depth == 0) {
+		return (CSR_NONE);
+	}
+	csr_frame_t *top = &S->cst_frames[S->cst_depth - 1];
+	uint64_t end = cs->cs_off[top->cf_node + 1];
+	while (top->cf_cur < end) {
+		uint64_t adj = cs->cs_adj[top->cf_cur++];
+		if (V == NULL || !BM_TEST(V, adj)) {
+			return (adj);
+		}
+	}
+	return (CSR_NONE);
+}
+
+/*
+ * The CSR version of lg_dfs_fold().
+ */
+gelem_t
+csr_dfs_fold(lg_graph_t *g, csr_t *cs, gelem_t start, pop_cb_t *pcb,
+    fold_cb_t *cb, gelem_t gzero)
+{
+	(void)g;
+	GRAPH_DFS_BEGIN(g);
+	if (cs->cs_nedges == 0) {
+		return (gzero);
+	}
+	gelem_t agg = gzero;
+	uint64_t s = csr_find(cs, start);
+	/*
+	 * `start` has no outgoing edges, so we just call `cb` on `start`, and
+	 * return.
+	 */
+	if (s == CSR_NONE || cs->cs_off[s] == cs->cs_off[s + 1]) {
+		(void)cb(agg, start, &agg);
+		return (agg);
+	}
+	uint64_t *V = lg_zalloc(BM_WORDS(cs->cs_nnodes) * sizeof (uint64_t));
+	csr_stack_t S;
+	bzero(&S, sizeof (S));
+
+	GRAPH_DFS_PUSH(g, start);
+	csr_push(cs, &S, s);
+	if (cb(agg, start, &agg)) {
+		goto done;
+	}
+	BM_SET(V, s);
+	uint64_t pushable;
+
+try_continue:;
+	while ((pushable = csr_pushable(cs, &S, V)) != CSR_NONE) {
+		gelem_t node = cs->cs_nodes[pushable];
+		GRAPH_DFS_PUSH(g, node);
+		csr_push(cs, &S, pushable);
+		/* we've met our terminating condition */
+		if (cb(agg, node, &agg)) {
+			goto done;
+		}
+		BM_SET(V, pushable);
+	}
+
+	/*
+	 * We've reached the bottom. We pop one element off of the stack, and
+	 * try to continue the search, until the stack is empty.
+	 */
+pop_again:;
+	if (S.cst_depth > 0) {
+		gelem_t popped = cs->cs_nodes[S.cst_frames[--S.cst_depth].cf_node];
+		GRAPH_DFS_POP(g, popped);
+		int popstat = 0;
+		if (pcb != NULL) {
+			popstat = pcb(popped, agg);
+		}
+		if (S.cst_depth > 0) {
+			if (popstat == 1) {
+				goto pop_again;
+			}
+			goto try_continue;
+		}
+	}
+done:
+	csr_stack_destroy(&S);
+	lg_free(V, BM_WORDS(cs->cs_nnodes) * sizeof (uint64_t));
+	GRAPH_DFS_END(g);
+	return (agg);
+}
+
+/*
+ * The CSR version of lg_dfs_rdnt_fold() and lg_dfs_br_rdnt_fold(). If `brcb`
+ * is NULL, we behave like the former, otherwise like the latter: nodes for
+ * which `brcb` is true get pushed to a second stack, and a pop-callback return
+ * value of 2 unwinds the main stack to the most recent such branching node.
+ */
+gelem_t
+csr_dfs_rdnt_fold(lg_graph_t *g, csr_t *cs, gelem_t start, br_cb_t *brcb,
+    pop_cb_t *pcb, fold_cb_t *cb, gelem_t gzero)
+{
+	(void)g;
+	GRAPH_DFS_RDNT_BEGIN(g);
+	if (cs->cs_nedges == 0) {
+		return (gzero);
+	}
+	gelem_t agg = gzero;
+	uint64_t s = csr_find(cs, start);
+	if (s == CSR_NONE || cs->cs_off[s] == cs->cs_off[s + 1]) {
+		(void)cb(agg, start, &agg);
+		return (agg);
+	}
+	csr_stack_t S;
+	csr_stack_t B;
+	bzero(&S, sizeof (S));
+	bzero(&B, sizeof (B));
+
+	GRAPH_DFS_RDNT_PUSH(g, start);
+	csr_push(cs, &S, s);
+	if (cb(agg, start, &agg)) {
+		goto done;
+	}
+	if (brcb != NULL && brcb(start)) {
+		csr_push(cs, &B, s);
+	}
+	uint64_t pushable;
+
+try_continue:;
+	while ((pushable = csr_pushable(cs, &S, NULL)) != CSR_NONE) {
+		gelem_t node = cs->cs_nodes[pushable];
+		GRAPH_DFS_RDNT_PUSH(g, node);
+		csr_push(cs, &S, pushable);
+		if (cb(agg, node, &agg)) {
+			goto done;
+		}
+		if (brcb != NULL && brcb(node)) {
+			csr_push(cs, &B, pushable);
+		}
+	}
+
+pop_again:;
+	if (S.cst_depth > 0) {
+		uint64_t pslot = S.cst_frames[--S.cst_depth].cf_node;
+		if (B.cst_depth > 0 &&
+		    B.cst_frames[B.cst_depth - 1].cf_node == pslot) {
+			B.cst_depth--;
+		}
+		gelem_t popped = cs->cs_nodes[pslot];
+		GRAPH_DFS_RDNT_POP(g, popped);
+		int popstat = 0;
+		if (pcb != NULL) {
+			popstat = pcb(popped, agg);
+		}
+		if (S.cst_depth == 0) {
+			goto done;
+		}
+		if (popstat == 1 || (brcb == NULL && popstat)) {
+			goto pop_again;
+		}
+		if (popstat == 2) {
+			/* pop to branch */
+			while (S.cst_depth > 0 && (B.cst_depth == 0 ||
+			    S.cst_frames[S.cst_depth - 1].cf_node !=
+			    B.cst_frames[B.cst_depth - 1].cf_node)) {
+				pslot = S.cst_frames[--S.cst_depth].cf_node;
+				if (B.cst_depth > 0 && B.cst_frames[
+				    B.cst_depth - 1].cf_node == pslot) {
+					B.cst_depth--;
+				}
+				GRAPH_DFS_RDNT_POP(g, cs->cs_nodes[pslot]);
+			}
+		}
+		goto try_continue;
+	}
+done:
+	csr_stack_destroy(&S);
+	csr_stack_destroy(&B);
+	GRAPH_DFS_RDNT_END(g);
+	return (agg);
+}
+
+void
+csr_neighbors(csr_t *cs, gelem_t n, edges_cb_t *cb, edges_arg_cb_t *acb,
+    gelem_t arg)
+{
+	uint64_t s = csr_find(cs, n);
+	if (s == CSR_NONE) {
+		return;
+	}
+	uint64_t j = cs->cs_off[s];
+	while (j < cs->cs_off[s + 1]) {
+		gelem_t to = cs->cs_nodes[cs->cs_adj[j]];
+		if (acb != NULL) {
+			acb(n, to, csr_weight(cs, j), arg);
+		} else {
+			cb(n, to, csr_weight(cs, j));
+		}
+		j++;
+	}
+}
+
+/*
+ * Walks all of the edges in the image. For undirected graphs both directions
+ * of an edge are in the image, so we only report the one that goes from the
+ * smaller node to the larger one -- which, unless the graph is dense, is the
+ * same one that lg_edges() on the edge-list would report.
+ */
+void
+csr_edges(lg_graph_t *g, csr_t *cs, edges_cb_t *cb, edges_arg_cb_t *acb,
+    gelem_t arg)
+{
+	int uniq = (g->gr_type == GRAPH || g->gr_type == GRAPH_WE);
+	uint64_t i = 0;
+	while (i < cs->cs_nnodes) {
+		gelem_t from = cs->cs_nodes[i];
+		uint64_t j = cs->cs_off[i];
+		while (j < cs->cs_off[i + 1]) {
+			gelem_t to = cs->cs_nodes[cs->cs_adj[j]];
+			if (!uniq || from.ge_u < to.ge_u) {
+				if (acb != NULL) {
+					acb(from, to, csr_weight(cs, j), arg);
+				} else {
+					cb(from, to, csr_weight(cs, j));
+				}
+			}
+			j++;
+		}
+		i++;
+	}
+}
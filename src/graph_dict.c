@@ -0,0 +1,179 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2015, Nick Zivkovic
+ */
+
+/*
+ * This file implements the node dictionary used by graphs that store their
+ * edges with EDGE_DENSE (see lg_edgestrat). The dictionary hands out a dense
+ * 32-bit id to every node, the first time that node gets connected, and can
+ * map in both directions:
+ *
+ *	- node to id, through a slablist of dict_ent_t pointers, sorted by node.
+ *	- id to node, by indexing into an array of fixed-size chunks of
+ *	  dict_ent_t's.
+ *
+ * The entries live in the chunks, and the slablist points into them. Chunks
+ * are never moved or freed until the graph is destroyed, so the pointers stay
+ * valid as the dictionary grows, and we don't need one allocation per node.
+ *
+ * Ids are never recycled. A node keeps its id even after its last edge is
+ * disconnected, so that rollbacks and snapshots never have to renumber
+ * anything. The id UINT32_MAX is reserved (see EDGE_NONE), so a dictionary
+ * holds at most UINT32_MAX nodes.
+ */
+
+#include <stdlib.h>
+#include <strings.h>
+#include "graph_impl.h"
+
+#define	DICT_SHIFT	12
+#define	DICT_CHUNK	(1ULL << DICT_SHIFT)
+#define	DICT_MASK	(DICT_CHUNK - 1)
+
+static int
+dict_ent_cmp(selem_t e1, selem_t e2)
+{
+	dict_ent_t *d1 = e1.sle_p;
+	dict_ent_t *d2 = e2.sle_p;
+	if (d1->de_node.ge_u < d2->de_node.ge_u) {
+		return (-1);
+	}
+	if (d1->de_node.ge_u > d2->de_node.ge_u) {
+		return (1);
+	}
+	return (0);
+}
+
+static int
+dict_ent_bnd(selem_t e, selem_t min, selem_t max)
+{
+	if (dict_ent_cmp(e, min) < 0) {
+		return (-1);
+	}
+	if (dict_ent_cmp(e, max) > 0) {
+		return (1);
+	}
+	return (0);
+}
+
+dict_t *
+dict_create(void)
+{
+	dict_t *d = lg_zalloc(sizeof (dict_t));
+	d->di_sl = slablist_create("node_dict", dict_ent_cmp, dict_ent_bnd,
+	    SL_SORTED);
+	return (d);
+}
+
+void
+dict_destroy(dict_t *d)
+{
+	uint64_t i = 0;
+	if (d == NULL) {
+		return;
+	}
+	slablist_destroy(d->di_sl, NULL);
+	while (i < d->di_nchunks) {
+		lg_free(d->di_chunks[i], DICT_CHUNK * sizeof (dict_ent_t));
+		i++;
+	}
+	lg_free(d->di_chunks, d->di_maxchunks * sizeof (dict_ent_t *));
+	lg_free(d, sizeof (dict_t));
+}
+
+/*
+ * Looks up the id of `n`. Returns 0 if `n` has one, and -1 otherwise.
+ */
+int
+dict_find(dict_t *d, gelem_t n, uint32_t *id)
+{
+	dict_ent_t key;
+	selem_t skey;
+	selem_t found;
+	dict_ent_t *de;
+	key.de_node = n;
+	skey.sle_p = &key;
+	if (slablist_find(d->di_sl, skey, &found) == SL_ENFOUND) {
+		return (-1);
+	}
+	de = found.sle_p;
+	*id = de->de_id;
+	return (0);
+}
+
+/*
+ * Like dict_find, but gives `n` the next free id if it doesn't have one yet.
+ * Returns -1 if the dictionary is full.
+ */
+int
+dict_intern(dict_t *d, gelem_t n, uint32_t *id)
+{
+	if (dict_find(d, n, id) == 0) {
+		return (0);
+	}
+	if (d->di_n == UINT32_MAX) {
+		return (-1);
+	}
+	uint64_t c = d->di_n >> DICT_SHIFT;
+	if (c == d->di_nchunks) {
+		if (d->di_nchunks == d->di_maxchunks) {
+			uint64_t nmax = d->di_maxchunks * 2;
+			if (nmax == 0) {
+				nmax = 8;
+			}
+			dict_ent_t **nc = lg_zalloc(nmax * sizeof (dict_ent_t *));
+			if (d->di_nchunks > 0) {
+				bcopy(d->di_chunks, nc,
+				    d->di_nchunks * sizeof (dict_ent_t *));
+			}
+			lg_free(d->di_chunks,
+			    d->di_maxchunks * sizeof (dict_ent_t *));
+			d->di_chunks = nc;
+			d->di_maxchunks = nmax;
+		}
+		d->di_chunks[c] = lg_zalloc(DICT_CHUNK * sizeof (dict_ent_t));
+		d->di_nchunks++;
+	}
+	dict_ent_t *de = &d->di_chunks[c][d->di_n & DICT_MASK];
+	de->de_node = n;
+	de->de_id = d->di_n;
+	selem_t sde;
+	sde.sle_p = de;
+	(void) slablist_add(d->di_sl, sde, 0);
+	*id = de->de_id;
+	d->di_n++;
+	return (0);
+}
+
+/*
+ * Returns the node that has the id `id`, which has to have been handed out by
+ * this dictionary.
+ */
+gelem_t
+dict_node(dict_t *d, uint32_t id)
+{
+	return (d->di_chunks[id >> DICT_SHIFT][id & DICT_MASK].de_node);
+}
+
+/*
+ * Returns a new dictionary that hands out the same ids as `d`.
+ */
+dict_t *
+dict_copy(dict_t *d)
+{
+	dict_t *c = dict_create();
+	uint32_t id;
+	uint64_t i = 0;
+	/* interning in id order hands out the same ids */
+	while (i < d->di_n) {
+		(void) dict_intern(c, dict_node(d, i), &id);
+		i++;
+	}
+	return (c);
+}
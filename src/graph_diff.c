@@ -0,0 +1,237 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2015, Nick Zivkovic
+ */
+
+/*
+ * This file implements lg_snap_diff(), which streams the net difference
+ * between the edges of a graph at two of its snapshots.
+ *
+ * The changes made between snapshots S1 and S2 are the ones logged in
+ * snapshots S1 through S2 - 1, which form a single range of the change-log
+ * under either strategy (see snaps_range()). That range is walked once, from
+ * the oldest change to the newest, and every edge that a change touches gets
+ * a diff_ent_t (see graph_impl.h). The first change of an edge records
+ * whether the edge existed at S1 (and with which weight), and every change of
+ * the edge records whether it exists after the change. Once the walk is done,
+ * the entries hold the state of every changed edge at S1 and at S2, no matter
+ * how often it changed in between, so an edge that was connected and then
+ * disconnected again cancels out. Neither the edges of the graph, nor the
+ * changes outside of the range are ever looked at.
+ */
+
+#include "graph_impl.h"
+
+typedef struct diff {
+	lg_graph_t	*df_g;
+	slablist_t	*df_ents;
+	arena_t		df_ar;
+	diff_cb_t	*df_cb;
+	diff_arg_cb_t	*df_acb;
+	gelem_t		df_arg;
+} diff_t;
+
+/*
+ * Notes that the edge from->to went from existing (or not) with weight `ow`
+ * to existing (or not) with weight `w`.
+ */
+static void
+diff_note(diff_t *d, gelem_t from, gelem_t to, int was, gelem_t ow, int is,
+    gelem_t w)
+{
+	lg_graph_t *g = d->df_g;
+	diff_ent_t *de;
+	w_edge_t k;
+	selem_t key;
+	selem_t found;
+	if (g->gr_type != GRAPH_WE && g->gr_type != DIGRAPH_WE) {
+		ow.ge_u = 0;
+		w.ge_u = 0;
+	}
+	if (GRAPH_UNDIRECTED(g) && from.ge_u > to.ge_u) {
+		gelem_t tmp = from;
+		from = to;
+		to = tmp;
+	}
+	k.wed_from = from;
+	k.wed_to = to;
+	key.sle_p = &k;
+	if (slablist_find(d->df_ents, key, &found) == SL_ENFOUND) {
+		de = arena_alloc(&d->df_ar);
+		de->de_edge.wed_from = from;
+		de->de_edge.wed_to = to;
+		de->de_was = was;
+		de->de_oweight = ow;
+		found.sle_p = de;
+		(void) slablist_add(d->df_ents, found, 0);
+	} else {
+		de = found.sle_p;
+	}
+	de->de_is = is;
+	de->de_edge.wed_weight = w;
+}
+
+static void
+diff_change(diff_t *d, change_t *c)
+{
+	gelem_t none;
+	uint64_t i = 0;
+	none.ge_u = 0;
+	switch (c->ch_op) {
+
+	case CONNECT:
+		diff_note(d, c->ch_from, c->ch_to, 0, none, 1, c->ch_weight);
+		break;
+
+	case DISCONNECT:
+		diff_note(d, c->ch_from, c->ch_to, 1, c->ch_weight, 0, none);
+		break;
+
+	case UPDATE:
+		diff_note(d, c->ch_from, c->ch_to, 1, c->ch_oweight, 1,
+		    c->ch_weight);
+		break;
+
+	case CONNECT_BATCH:
+		while (i < c->ch_nbatch) {
+			diff_note(d, c->ch_batch[i].wed_from,
+			    c->ch_batch[i].wed_to, 0, none, 1,
+			    c->ch_batch[i].wed_weight);
+			i++;
+		}
+		break;
+
+	case REMOVE_NODE:
+	case DROP:
+		while (i < c->ch_nbatch) {
+			diff_note(d, c->ch_batch[i].wed_from,
+			    c->ch_batch[i].wed_to, 1,
+			    c->ch_batch[i].wed_weight, 0, none);
+			i++;
+		}
+		break;
+	}
+}
+
+static selem_t
+diff_change_cb(selem_t zero, selem_t *e, uint64_t sz)
+{
+	diff_t *d = zero.sle_p;
+	uint64_t i = 0;
+	while (i < sz) {
+		diff_change(d, e[i].sle_p);
+		i++;
+	}
+	return (zero);
+}
+
+static void
+diff_emit(diff_t *d, uint8_t added, gelem_t from, gelem_t to, gelem_t w)
+{
+	if (d->df_cb != NULL) {
+		d->df_cb(added, from, to, w);
+	} else {
+		d->df_acb(added, from, to, w, d->df_arg);
+	}
+}
+
+/*
+ * An edge whose weight changed is reported as removed with its old weight,
+ * and then added with its new one.
+ */
+static selem_t
+diff_emit_cb(selem_t zero, selem_t *e, uint64_t sz)
+{
+	diff_t *d = zero.sle_p;
+	uint64_t i = 0;
+	while (i < sz) {
+		diff_ent_t *de = e[i].sle_p;
+		w_edge_t *we = &de->de_edge;
+		i++;
+		if (de->de_was && de->de_is &&
+		    de->de_oweight.ge_u == we->wed_weight.ge_u) {
+			continue;
+		}
+		if (de->de_was) {
+			diff_emit(d, 0, we->wed_from, we->wed_to,
+			    de->de_oweight);
+		}
+		if (de->de_is) {
+			diff_emit(d, 1, we->wed_from, we->wed_to,
+			    we->wed_weight);
+		}
+	}
+	return (zero);
+}
+
+static int
+snap_diff(lg_graph_t *g, uint64_t s1, uint64_t s2, diff_t *d)
+{
+	if (s1 > s2 || s2 >= g->gr_snap || g->gr_snaps == NULL ||
+	    g->gr_shards != NULL) {
+		return (-1);
+	}
+	if (s1 == s2) {
+		return (0);
+	}
+	change_t ch_min;
+	change_t ch_max;
+	selem_t s_min;
+	selem_t s_max;
+	selem_t zero;
+	d->df_g = g;
+	d->df_ents = slablist_create("graph_diff", w_edge_cmp, w_edge_bnd,
+	    SL_SORTED);
+	arena_init(&d->df_ar, sizeof (diff_ent_t));
+	snaps_range(g, s1, &ch_min, &ch_max);
+	ch_max.ch_snap = s2 - 1;
+	s_min.sle_p = &ch_min;
+	s_max.sle_p = &ch_max;
+	zero.sle_p = d;
+	slablist_foldr_range(g->gr_snaps, diff_change_cb, s_min, s_max, zero);
+	if (slablist_get_elems(d->df_ents) > 0) {
+		slablist_foldr(d->df_ents, diff_emit_cb, zero);
+	}
+	slablist_destroy(d->df_ents, NULL);
+	arena_destroy(&d->df_ar);
+	return (0);
+}
+
+/*
+ * Calls `cb` once for every edge that was removed, and once for every edge
+ * that was added, between snapshots `s1` and `s2` of `g` (`s1` <= `s2`), in
+ * edge order. The first argument of `cb` is 1 for an added edge and 0 for a
+ * removed one. An edge that is removed and then connected again in between
+ * isn't reported, unless its weight changed, in which case it is reported as
+ * removed with its weight at `s1`, and then added with its weight at `s2`.
+ * The edges of an undirected graph are reported once, with the smaller node
+ * first.
+ *
+ * This costs a walk of the changes made between `s1` and `s2`, and space
+ * proportional to the number of edges that they touched. Returns -1 if `g`
+ * has no snapshot `s1` or `s2`, if `s1` > `s2`, or if `g` is sharded.
+ */
+int
+lg_snap_diff(lg_graph_t *g, uint64_t s1, uint64_t s2, diff_cb_t *cb)
+{
+	diff_t d;
+	d.df_cb = cb;
+	d.df_acb = NULL;
+	return (snap_diff(g, s1, s2, &d));
+}
+
+int
+lg_snap_diff_arg(lg_graph_t *g, uint64_t s1, uint64_t s2, diff_arg_cb_t *acb,
+    gelem_t arg)
+{
+	diff_t d;
+	d.df_cb = NULL;
+	d.df_acb = acb;
+	d.df_arg = arg;
+	return (snap_diff(g, s1, s2, &d));
+}
@@ -0,0 +1,313 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2015, Nick Zivkovic
+ */
+
+/*
+ * This file implements direction-optimizing BFS (lg_bfs_diropt_fold), as
+ * described by Beamer, Asanovic, and Patterson.
+ *
+ * The BFS visits the graph one level at a time. A level can be expanded in
+ * one of two ways. The usual, top-down, way is to walk the neighbors of every
+ * node in the frontier, and to visit the ones that haven't been visited yet.
+ * The bottom-up way is to walk every node that hasn't been visited yet, and to
+ * visit it if one of its incoming edges comes from a node in the frontier. A
+ * bottom-up step can stop looking at a node's edges as soon as it finds such
+ * an edge, and never looks at the edges of nodes that have been visited, so it
+ * does much less work than a top-down step when the frontier is large. This
+ * is the case in the middle levels of a BFS over a graph with a small
+ * diameter, such as a social graph, where the frontier covers most of the
+ * graph.
+ *
+ * We start top-down, and switch to bottom-up when the edges that leave the
+ * frontier outnumber the edges that enter the unvisited nodes by more than
+ * 1/DOBFS_ALPHA, and back to top-down when the frontier shrinks below
+ * 1/DOBFS_BETA of the nodes. The degrees come from the node table (see
+ * graph_nodes.c), and the incoming edges from the mirror (see in_index_build).
+ *
+ * The callbacks are the same as those of lg_bfs_fold(), and nodes are passed
+ * to the fold-callback in the same level-order. As long as we stay top-down,
+ * we call both callbacks exactly as lg_bfs_fold() does. In a bottom-up step we
+ * call the fold-callback on every node in the frontier before we look for the
+ * next level, and a node's parent is the first node of the frontier found
+ * among its incoming edges, which may not be the one that lg_bfs_fold() would
+ * have found.
+ */
+
+#include <stdlib.h>
+#include <strings.h>
+#include "graph_impl.h"
+#include "graph_provider.h"
+
+#define	DOBFS_ALPHA	14
+#define	DOBFS_BETA	24
+
+/*
+ * One level of the BFS.
+ */
+typedef struct frontier {
+	gelem_t		*fr_nodes;
+	uint64_t	*fr_keys;
+	uint64_t	fr_n;
+	uint64_t	fr_cap;
+	uint64_t	fr_edges;	/* edges that leave the level */
+} frontier_t;
+
+typedef struct dobfs {
+	lg_graph_t	*db_g;
+	adj_cb_t	*db_acb;
+	gelem_t		db_agg;
+	vset_t		db_v;
+	lg_trav_ctx_t	*db_vtc;	/* backs db_v */
+	lg_trav_ctx_t	*db_ftc;	/* the frontier, in bottom-up steps */
+	frontier_t	db_next;
+	uint64_t	db_unvisited;	/* edges that enter unvisited nodes */
+	slablist_bm_t	*db_bm;
+} dobfs_t;
+
+static void
+frontier_add(frontier_t *f, gelem_t n, uint64_t k)
+{
+	if (f->fr_n == f->fr_cap) {
+		uint64_t ncap = f->fr_cap == 0 ? 64 : f->fr_cap * 2;
+		gelem_t *nnodes = lg_zalloc(ncap * sizeof (gelem_t));
+		uint64_t *nkeys = lg_zalloc(ncap * sizeof (uint64_t));
+		if (f->fr_cap > 0) {
+			bcopy(f->fr_nodes, nnodes, f->fr_n * sizeof (gelem_t));
+			bcopy(f->fr_keys, nkeys, f->fr_n * sizeof (uint64_t));
+			lg_free(f->fr_nodes, f->fr_cap * sizeof (gelem_t));
+			lg_free(f->fr_keys, f->fr_cap * sizeof (uint64_t));
+		}
+		f->fr_nodes = nnodes;
+		f->fr_keys = nkeys;
+		f->fr_cap = ncap;
+	}
+	f->fr_nodes[f->fr_n] = n;
+	f->fr_keys[f->fr_n] = k;
+	f->fr_n++;
+}
+
+static void
+frontier_destroy(frontier_t *f)
+{
+	if (f->fr_cap > 0) {
+		lg_free(f->fr_nodes, f->fr_cap * sizeof (gelem_t));
+		lg_free(f->fr_keys, f->fr_cap * sizeof (uint64_t));
+	}
+}
+
+/*
+ * Visits `to`, whose key is `k`, through the edge from `from`, and adds it to
+ * the next level.
+ */
+static void
+dobfs_visit(dobfs_t *db, gelem_t from, gelem_t to, uint64_t k, gelem_t w)
+{
+	if (db->db_acb != NULL) {
+		db->db_acb(to, from, w, db->db_agg);
+	}
+	GRAPH_BFS_ENQ(to);
+	GRAPH_BFS_VISIT(to);
+	vset_add(&db->db_v, k);
+	frontier_add(&db->db_next, to, k);
+	node_t *nd = node_find(db->db_g, to);
+	if (nd != NULL) {
+		db->db_next.fr_edges += nd->nd_out;
+		db->db_unvisited -= nd->nd_in;
+	}
+}
+
+/*
+ * Called on the neighbors of a node in the frontier, in a top-down step.
+ */
+static void
+dobfs_td_cb(gelem_t n, gelem_t adj, uint64_t k, gelem_t w, void *arg)
+{
+	dobfs_t *db = arg;
+	if (!vset_test(&db->db_v, k)) {
+		dobfs_visit(db, n, adj, k, w);
+	}
+}
+
+/*
+ * Walks the entries of the mirror (or of `gr_edges`, if `mirror` is 0) that
+ * connect `v` to its neighbors, until it finds one in the frontier, which it
+ * visits `v` from. Returns 1 if it found one.
+ */
+static int
+dobfs_bu_scan(dobfs_t *db, int mirror, gelem_t v, uint64_t k)
+{
+	lg_graph_t *g = db->db_g;
+	slablist_t *edges = mirror ? g->gr_in_edges : g->gr_edges;
+	ekey_t kmin;
+	ekey_t kmax;
+	selem_t min;
+	selem_t max;
+	selem_t cur;
+	int r = mirror ? mirror_range(g, v, &kmin, &kmax, &min, &max) :
+	    edge_range(g, v, &kmin, &kmax, &min, &max);
+	if (r != 0 ||
+	    slablist_range_min(edges, db->db_bm, min, max, &cur) != 0) {
+		return (0);
+	}
+	while (1) {
+		gelem_t n;
+		gelem_t adj;
+		gelem_t w;
+		uint64_t ak = nbr_get(g, mirror, cur, &n, &adj, &w);
+		if (n.ge_u != v.ge_u) {
+			return (0);
+		}
+		if (trav_test(db->db_ftc, ak)) {
+			dobfs_visit(db, adj, v, k, w);
+			return (1);
+		}
+		if (slablist_next(edges, db->db_bm, &cur)) {
+			return (0);
+		}
+	}
+}
+
+/*
+ * Called on the node table, in a bottom-up step.
+ */
+static selem_t
+dobfs_bu_cb(selem_t zero, selem_t *e, uint64_t sz)
+{
+	dobfs_t *db = zero.sle_p;
+	lg_graph_t *g = db->db_g;
+	uint64_t i = 0;
+	while (i < sz) {
+		node_t *nd = e[i].sle_p;
+		uint64_t k;
+		i++;
+		if (nd->nd_in == 0 || node_key(g, nd->nd_node, &k) != 0 ||
+		    vset_test(&db->db_v, k)) {
+			continue;
+		}
+		if (!dobfs_bu_scan(db, 1, nd->nd_node, k) &&
+		    GRAPH_UNDIRECTED(g)) {
+			(void) dobfs_bu_scan(db, 0, nd->nd_node, k);
+		}
+	}
+	return (zero);
+}
+
+/*
+ * Like lg_bfs_fold(), but switches between top-down and bottom-up steps, as
+ * explained at the top of this file. Frozen, concurrent, and sharded graphs
+ * are walked by lg_bfs_fold(): the first two over their CSR image, and sharded
+ * graphs shard by shard, since they keep neither a node table nor a mirror.
+ * So are graphs whose edges have an overlay (see graph_cow.c), which the
+ * bottom-up step can't scan in place.
+ */
+gelem_t
+lg_bfs_diropt_fold(lg_graph_t *g, gelem_t start, adj_cb_t *acb, fold_cb_t *cb,
+    gelem_t gzero)
+{
+	if (g->gr_epoch != NULL || g->gr_csr != NULL || g->gr_shards != NULL ||
+	    g->gr_ov_add != NULL) {
+		return (lg_bfs_fold(g, start, acb, cb, gzero));
+	}
+	GRAPH_BFS_BEGIN(g);
+	uint64_t nedges = slablist_get_elems(g->gr_edges);
+	if (nedges == 0) {
+		return (gzero);
+	}
+	nodes_build(g);
+	in_index_build(g);
+	uint64_t nnodes = slablist_get_elems(g->gr_nodes);
+
+	dobfs_t db;
+	bzero(&db, sizeof (dobfs_t));
+	db.db_g = g;
+	db.db_acb = acb;
+	db.db_agg = gzero;
+	db.db_vtc = lg_trav_ctx_create();
+	db.db_ftc = lg_trav_ctx_create();
+	db.db_bm = slablist_bm_create();
+	db.db_unvisited = GRAPH_UNDIRECTED(g) ? 2 * nedges : nedges;
+	vset_init_ctx(g, &db.db_v, db.db_vtc);
+	frontier_t cur;
+	bzero(&cur, sizeof (frontier_t));
+
+	/*
+	 * The start node makes up the first level.
+	 */
+	GRAPH_BFS_ENQ(start);
+	uint64_t k;
+	if (node_key(g, start, &k) == 0) {
+		vset_add(&db.db_v, k);
+	} else {
+		/* `start` has no edges, so this key will never be tested */
+		k = UINT64_MAX;
+	}
+	frontier_add(&cur, start, k);
+	node_t *nd = node_find(g, start);
+	if (nd != NULL) {
+		cur.fr_edges = nd->nd_out;
+		db.db_unvisited -= nd->nd_in;
+	}
+
+	int bottomup = 0;
+	uint64_t prev_n = 0;
+	while (cur.fr_n > 0) {
+		if (!bottomup && cur.fr_n > prev_n &&
+		    cur.fr_edges > db.db_unvisited / DOBFS_ALPHA) {
+			bottomup = 1;
+		} else if (bottomup && cur.fr_n < prev_n &&
+		    cur.fr_n < nnodes / DOBFS_BETA) {
+			bottomup = 0;
+		}
+		if (bottomup) {
+			trav_reset(db.db_ftc, g);
+		}
+		uint64_t i = 0;
+		while (i < cur.fr_n) {
+			gelem_t last = cur.fr_nodes[i];
+			GRAPH_BFS_DEQ(last);
+			if (cb != NULL && cb(db.db_agg, last, &db.db_agg)) {
+				/*
+				 * The user should save what he's looking for
+				 * in db_agg.
+				 */
+				goto done;
+			}
+			if (bottomup) {
+				trav_add(db.db_ftc, cur.fr_keys[i]);
+			} else {
+				graph_nbrs(g, last, dobfs_td_cb, &db);
+			}
+			i++;
+		}
+		if (bottomup) {
+			selem_t zero;
+			zero.sle_p = &db;
+			slablist_foldr(g->gr_nodes, dobfs_bu_cb, zero);
+		}
+		/*
+		 * The next level becomes the current one, and we reuse the
+		 * current one's arrays for the level after that.
+		 */
+		frontier_t tmp = cur;
+		prev_n = cur.fr_n;
+		cur = db.db_next;
+		db.db_next = tmp;
+		db.db_next.fr_n = 0;
+		db.db_next.fr_edges = 0;
+	}
+done:
+	frontier_destroy(&cur);
+	frontier_destroy(&db.db_next);
+	vset_destroy(&db.db_v);
+	slablist_bm_destroy(db.db_bm);
+	lg_trav_ctx_destroy(db.db_vtc);
+	lg_trav_ctx_destroy(db.db_ftc);
+	GRAPH_BFS_END(g);
+	return (db.db_agg);
+}
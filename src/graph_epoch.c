@@ -0,0 +1,188 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2015, Nick Zivkovic
+ */
+
+/*
+ * This file implements the concurrent mode of a graph (see lg_concurrent), in
+ * which any number of threads can read the graph while a single thread changes
+ * it.
+ *
+ * The edge-list can't be read while it is being changed, so readers never
+ * touch it. Instead, the writer publishes an immutable CSR image of the edges
+ * (see csr_t in graph_impl.h) with lg_publish(), and lg_bfs_fold(),
+ * lg_dfs_fold() and friends, as well as lg_neighbors() and lg_edges(), walk
+ * over the most recently published image. Readers thus see the graph as it
+ * was at the last lg_publish(), and never wait for the writer, or for each
+ * other.
+ *
+ * When the writer publishes a new image, readers may still be walking the old
+ * one, so it is retired instead of destroyed, and reclaimed once no reader can
+ * hold it anymore. We find out when that is with epochs. The graph has a
+ * global epoch, which the writer advances every time it publishes. A reader
+ * stores the epoch it observed in a free slot, then loads the image, and
+ * clears the slot when it is done. An image that was replaced in epoch E can
+ * be destroyed once no slot holds an epoch <= E, since any reader that entered
+ * afterwards loaded a newer image.
+ *
+ * Each thread starts looking for a free slot at a different index, so that as
+ * long as there are fewer reading threads than slots, readers don't contend
+ * for slots, and the only shared memory that they write to is their own slot.
+ */
+
+#include <stdlib.h>
+#include <strings.h>
+#include <sched.h>
+#include "graph_impl.h"
+
+static uint64_t ep_nthreads;
+static __thread uint64_t ep_thread;	/* 1 + this thread's number */
+
+static uint64_t
+epoch_first_slot(void)
+{
+	if (ep_thread == 0) {
+		ep_thread = __atomic_add_fetch(&ep_nthreads, 1,
+		    __ATOMIC_RELAXED);
+	}
+	return ((ep_thread - 1) % EPOCH_SLOTS);
+}
+
+/*
+ * Claims a slot for the calling thread, and returns the published image of
+ * `g`, which stays valid until the slot is given back with epoch_exit().
+ */
+csr_t *
+epoch_enter(lg_graph_t *g, epoch_slot_t **esp)
+{
+	epoch_t *ep = g->gr_epoch;
+	uint64_t first = epoch_first_slot();
+	uint64_t i = first;
+	while (1) {
+		epoch_slot_t *es = &ep->ep_slots[i];
+		uint64_t e = __atomic_load_n(&ep->ep_epoch, __ATOMIC_SEQ_CST);
+		uint64_t free = 0;
+		if (__atomic_compare_exchange_n(&es->es_epoch, &free, e, 0,
+		    __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+			*esp = es;
+			return (__atomic_load_n(&ep->ep_csr, __ATOMIC_SEQ_CST));
+		}
+		i = (i + 1) % EPOCH_SLOTS;
+		if (i == first) {
+			/* every slot is taken */
+			(void) sched_yield();
+		}
+	}
+}
+
+void
+epoch_exit(epoch_slot_t *es)
+{
+	__atomic_store_n(&es->es_epoch, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * Destroys the retired images that no reader can hold anymore.
+ */
+static void
+epoch_reclaim(epoch_t *ep)
+{
+	uint64_t min = UINT64_MAX;
+	uint64_t i = 0;
+	while (i < EPOCH_SLOTS) {
+		uint64_t e = __atomic_load_n(&ep->ep_slots[i].es_epoch,
+		    __ATOMIC_SEQ_CST);
+		if (e != 0 && e < min) {
+			min = e;
+		}
+		i++;
+	}
+	retired_t **rp = &ep->ep_retired;
+	while (*rp != NULL) {
+		retired_t *r = *rp;
+		if (r->rt_epoch < min) {
+			*rp = r->rt_next;
+			csr_destroy(r->rt_csr);
+			lg_free(r, sizeof (retired_t));
+		} else {
+			rp = &r->rt_next;
+		}
+	}
+}
+
+/*
+ * Puts `g` into concurrent mode, and publishes its current edges. From then on,
+ * lg_bfs_fold(), lg_bfs_rdnt_fold(), lg_dfs_fold(), lg_dfs_rdnt_fold(),
+ * lg_dfs_br_rdnt_fold(), lg_neighbors(), and lg_edges() (and their _arg
+ * variants) can be called by any number of threads at once, and see the edges
+ * as of the last call to lg_publish(). All other functions, including the ones
+ * that change the graph, must only be called by one thread (the writer).
+ *
+ * Entering concurrent mode is not itself thread-safe: it has to be done before
+ * the readers are started. Returns -1 if the graph is sharded.
+ */
+int
+lg_concurrent(lg_graph_t *g)
+{
+	if (g->gr_epoch != NULL) {
+		return (0);
+	}
+	if (g->gr_shards != NULL) {
+		return (-1);
+	}
+	epoch_t *ep = lg_zalloc(sizeof (epoch_t));
+	ep->ep_epoch = 1;
+	ep->ep_csr = csr_build(g);
+	g->gr_epoch = ep;
+	return (0);
+}
+
+/*
+ * Makes the changes made to `g` since the last publication visible to readers.
+ * Publishing builds a new image from scratch, so a writer that makes many
+ * changes should publish once after all of them, not after each one.
+ */
+void
+lg_publish(lg_graph_t *g)
+{
+	epoch_t *ep = g->gr_epoch;
+	if (ep == NULL) {
+		return;
+	}
+	csr_t *ncs = csr_build(g);
+	retired_t *r = lg_zalloc(sizeof (retired_t));
+	r->rt_csr = ep->ep_csr;
+	__atomic_store_n(&ep->ep_csr, ncs, __ATOMIC_SEQ_CST);
+	r->rt_epoch = __atomic_fetch_add(&ep->ep_epoch, 1, __ATOMIC_SEQ_CST);
+	r->rt_next = ep->ep_retired;
+	ep->ep_retired = r;
+	epoch_reclaim(ep);
+}
+
+/*
+ * Takes `g` out of concurrent mode, and discards the published image. All of
+ * the readers have to be done with `g` before this is called.
+ */
+void
+lg_sequential(lg_graph_t *g)
+{
+	epoch_t *ep = g->gr_epoch;
+	if (ep == NULL) {
+		return;
+	}
+	epoch_reclaim(ep);
+	csr_destroy(ep->ep_csr);
+	lg_free(ep, sizeof (epoch_t));
+	g->gr_epoch = NULL;
+}
+
+int
+lg_is_concurrent(lg_graph_t *g)
+{
+	return (g->gr_epoch != NULL);
+}
@@ -11,6 +11,7 @@
 #include "graph.h"
 #include <slablist.h>
 #include <stdio.h>
+#include <pthread.h>
 
 /*
  * The user can create 4 kinds of graphs:
@@ -47,17 +48,20 @@ typedef enum gtype {
  * left digit is greater than the other, there is no need to compare the right
  * digits.
  *
- * Weighted edges are compared just like unweighted edges, except we compare
- * the double, too. So it's like a 3-digit number, the double is the right-most
- * digit.
+ * Weighted edges are compared just like unweighted edges. The weight is not
+ * part of the key, so there can be at most one edge from->to regardless of its
+ * weight, and the weight can be updated in place (see lg_wupdate).
  *
- * Both directed and undirected graphs are stored in the same way. The only
- * difference is that when we connect FOO to BAR in an undirected graph, we
- * connect FOO -> BAR and BAR -> FOO, implicitly.
- *
- * In other words: under the hood, undirected graphs are basically directed
- * graphs, in which the edges must point in both directions, and must have the
- * same weight in both directions.
+ * An undirected graph stores each edge only once, in canonical order: the
+ * endpoint with the smaller key (see node_key) is the `from` node. When we
+ * connect FOO to BAR, or BAR to FOO, we store the same edge. The other
+ * direction is answered by the mirror, which is the incoming-edge index
+ * (`gr_in_edges`) of the undirected graph: it shares its edges with
+ * `gr_edges`, but sorts them by `to` first. The neighbors of a node are thus
+ * the `from` nodes of its range in the mirror (all of which are smaller than
+ * the node), followed by the `to` nodes of its range in `gr_edges` (all of
+ * which are larger), which is ascending order. graph_nbrs() hides this from
+ * the rest of the code.
  *
  * This representation allows us to use libslablist's ranged_fold feature to
  * visit all the neighbors of any single node. Which, if done repeatedly, is
@@ -67,6 +71,36 @@ typedef enum gtype {
  * DFS is facilitated by libslablist's bookmark feature, which allows one to
  * iteratively visit elements (edges) in sequence.
  */
+/*
+ * Unweighted graphs can instead be told to store their edges inline (see
+ * lg_edgestrat). With EDGE_INLINE, the `from` and `to` nodes are packed into
+ * the upper and lower 32 bits of the slablist element itself, so that no
+ * edge_t has to be allocated, and no pointer has to be chased when comparing
+ * edges. Since `from` occupies the upper half, sorting the packed values as
+ * unsigned integers yields the same order as graph_edge_cmp, and all of the
+ * ranged folds and bookmarks work unchanged. The price is that nodes larger
+ * than UINT32_MAX can't be stored in such a graph.
+ *
+ * EDGE_DENSE lifts that restriction: it packs edges the same way, but instead
+ * of the nodes themselves, it packs the dense 32-bit ids that the node
+ * dictionary (see graph_dict.c) hands out to nodes when they are first
+ * connected. Edges are then sorted by id, so neighbors are visited in the
+ * order in which they joined the graph, rather than in node order. In
+ * exchange, traversals can use flat bitmaps indexed by id as visited-sets.
+ *
+ * Code that walks `gr_edges` should decode elements with edge_get(), and build
+ * search keys with edge_key() and edge_range(), instead of casting `sle_p`.
+ */
+#define	EDGE_PACKED(g)	((g)->gr_edgestrat != EDGE_PTR)
+#define	EDGE_PACK(f, t)	(((uint64_t)(f) << 32) | ((uint64_t)(t) & UINT32_MAX))
+#define	EDGE_PFROM(e)	((uint64_t)(e) >> 32)
+#define	EDGE_PTO(e)	((uint64_t)(e) & UINT32_MAX)
+/* A packed self-edge, which can never be stored, so it matches nothing. */
+#define	EDGE_NONE	EDGE_PACK(UINT32_MAX, UINT32_MAX)
+
+#define	GRAPH_UNDIRECTED(g)	\
+	((g)->gr_type == GRAPH || (g)->gr_type == GRAPH_WE)
+
 typedef struct edge {
 	gelem_t		ed_from;
 	gelem_t		ed_to;
@@ -78,26 +112,163 @@ typedef struct w_edge {
 	gelem_t		wed_weight;
 } w_edge_t;
 
+/*
+ * Stack-allocated backing storage for the keys returned by edge_key().
+ */
+typedef union ekey {
+	edge_t		ek_e;
+	w_edge_t	ek_we;
+} ekey_t;
+
 typedef enum graph_op {
 	CONNECT,
-	DISCONNECT
+	DISCONNECT,
+	UPDATE,
+	CONNECT_BATCH,
+	REMOVE_NODE,
+	DROP
 } graph_op_t;
 
 /*
  * This represents a change to a graph, after a snapshot was taken. All changes
- * act on edges and either involve the creation of a new edge or destruction of
- * an old one. A change with `ch_snap=S`, means that `ch_op` was done on edge
- * `ch_edge` after snapshot S was taken.
+ * act on edges and either involve the creation of a new edge, destruction of
+ * an old one, or an update of an edge's weight. A change with `ch_snap=S`,
+ * means that `ch_op` was done on edge `ch_edge` after snapshot S was taken.
+ *
+ * A CONNECT_BATCH change records all of the edges that were added by one call
+ * to lg_connect_batch() or lg_wconnect_batch(), in `ch_batch`. Its `ch_from`,
+ * `ch_to`, and `ch_weight` are those of the first edge in the batch. A
+ * REMOVE_NODE change records all of the edges that lg_remove_node() removed,
+ * in `ch_batch`, and the removed node in `ch_from`. A DROP change records all
+ * of the edges that lg_drop() removed, in `ch_batch`, and the `from` node of
+ * the first one in `ch_from`.
  */
 typedef struct change {
 	uint64_t	ch_snap;
+	uint64_t	ch_seq; /* the order of the change, under SNAP_FAST */
 	graph_op_t	ch_op;
 	lg_graph_t	*ch_graph;
 	gelem_t		ch_from;
 	gelem_t		ch_to;
 	gelem_t		ch_weight;
+	gelem_t		ch_oweight; /* weight before an UPDATE */
+	w_edge_t	*ch_batch;
+	uint64_t	ch_nbatch;
 } change_t;
 
+/*
+ * A frozen graph carries an immutable compressed-sparse-row (CSR) image of its
+ * edge-list. Every node that appears in an edge (as either endpoint) gets a
+ * slot in `cs_nodes`, which is sorted by the node's bits, so that the slot of
+ * a node can be found with a binary search. The neighbors of the node in slot
+ * `i` are the node-slots `cs_adj[cs_off[i]]` through `cs_adj[cs_off[i+1] - 1]`
+ * (in the same order in which graph_nbrs() visits them), and their weights (if
+ * the graph is weighted) are in the same positions of `cs_weights`. Both
+ * directions of an undirected edge are in the image.
+ *
+ * Because nodes are reduced to dense slot-numbers, the traversal code can use
+ * flat arrays for queues and stacks, and bitmaps for visited-sets, instead of
+ * slablists.
+ */
+typedef struct csr {
+	uint64_t	cs_nnodes;
+	uint64_t	cs_nedges;
+	gelem_t		*cs_nodes;
+	uint64_t	*cs_off;
+	uint64_t	*cs_adj;
+	gelem_t		*cs_weights;
+} csr_t;
+
+#define	CSR_NONE	UINT64_MAX
+
+/*
+ * The state of a graph in concurrent mode. See graph_epoch.c.
+ *
+ * A reader announces the epoch it observed in a slot of its own. Every slot
+ * fills a cache line, so that readers on different cores never write to the
+ * same line.
+ */
+#define	EPOCH_SLOTS	128
+
+typedef struct epoch_slot {
+	uint64_t	es_epoch;	/* 0 iff no reader holds the slot */
+	char		es_pad[56];
+} epoch_slot_t;
+
+typedef struct retired {
+	csr_t		*rt_csr;
+	uint64_t	rt_epoch;	/* the epoch in which it was replaced */
+	struct retired	*rt_next;
+} retired_t;
+
+typedef struct epoch {
+	csr_t		*ep_csr;	/* the published image */
+	uint64_t	ep_epoch;
+	retired_t	*ep_retired;	/* only touched by the writer */
+	char		ep_pad[40];
+	epoch_slot_t	ep_slots[EPOCH_SLOTS];
+} epoch_t;
+
+/*
+ * The node dictionary of an EDGE_DENSE graph. See graph_dict.c.
+ */
+typedef struct dict_ent {
+	gelem_t		de_node;
+	uint32_t	de_id;
+} dict_ent_t;
+
+typedef struct dict {
+	slablist_t	*di_sl;		/* dict_ent_t's, sorted by node */
+	dict_ent_t	**di_chunks;	/* dict_ent_t's, indexed by id */
+	uint64_t	di_nchunks;
+	uint64_t	di_maxchunks;
+	uint64_t	di_n;		/* ids handed out so far */
+} dict_t;
+
+/*
+ * A per-graph arena of fixed-size objects. See graph_arena.c.
+ */
+typedef struct arena {
+	size_t		ar_size;	/* object size */
+	void		*ar_free;	/* free list, linked through objects */
+	char		*ar_bump;	/* next fresh object in newest slab */
+	char		*ar_end;	/* end of the newest slab */
+	void		*ar_slabs;
+	uint64_t	ar_nslabs;
+} arena_t;
+
+/*
+ * A shard of a sharded graph. See graph_shard.c.
+ */
+typedef struct shard {
+	pthread_mutex_t	sh_lock;
+	slablist_t	*sh_edges;	/* sorted like gr_edges */
+	arena_t		sh_ar;		/* the edges connected while sharded */
+} shard_t;
+
+/*
+ * The edges of a graph that it shares with its copy-on-write clones. Every
+ * graph that points to a cow_t keeps the changes it made since in its own
+ * overlay (`gr_ov_add` and `gr_ov_rem`). See graph_cow.c.
+ */
+typedef struct cow {
+	uint64_t	cw_refs;	/* the graphs that share the edges */
+	slablist_t	*cw_edges;
+	dict_t		*cw_dict;
+	arena_t		cw_ar;		/* the shared edge_t's or w_edge_t's */
+} cow_t;
+
+/*
+ * An image of the edges of a graph as of one of its snapshots. See
+ * graph_ckpt.c.
+ */
+typedef struct ckpt {
+	uint64_t	ck_snap;
+	uint64_t	ck_gen;		/* the `gr_gen` when it was taken */
+	w_edge_t	*ck_edges;	/* sorted by w_edge_cmp() */
+	uint64_t	ck_nedges;
+} ckpt_t;
+
 /*
  * The graph is essentially a slablist of edges. It also contains an integer
  * representing the current generation or snapshot. Snapshotting of graphs can
@@ -108,17 +279,22 @@ typedef struct change {
  * 	-DEDUP
  *
  * The FAST strategy implements the snapshot as a simple list of change_t's,
- * where the change_t is appended on every change. This strategy induced the
- * lowest overhead on the lg_[w]connect/lg_[w]disconnect operations. However,
- * it will store duplicate changes (i.e. if you add/remove the same edge
- * multiple times). It will also walk the entire change-list from left to
- * right, when cloning or rolling back.
- *
- * The DEDUP strategy is like the above, except that the changes are stored as
- * a sorted set, which results in higher overhead (i.e. O(logN) insertions instead
- * of O(1)). On the flip side, it uses the minimal amount of memory, and can do
- * a ranged left fold, which means it will only walk the part of the list that
- * it has to. TODO: This is not implemented yet.
+ * where the change_t is appended on every change (it is sorted by snapshot and
+ * sequence number, which is the order in which changes are appended). This
+ * strategy induced the lowest overhead on the lg_[w]connect/lg_[w]disconnect
+ * operations. However, it will store duplicate changes (i.e. if you add/remove
+ * the same edge multiple times).
+ *
+ * The DEDUP strategy is like the above, except that the changes are sorted by
+ * edge within each snapshot, which results in higher overhead, since every
+ * change has to be looked up. On the flip side, it uses the minimal amount of
+ * memory. It keeps only the net change of each edge in each snapshot, so
+ * connecting and disconnecting the same edge over and over doesn't grow the
+ * list (see snap_add() in graph.c).
+ *
+ * Under either strategy, the changes made since a snapshot form a range at
+ * the end of the list, so cloning or rolling back only walks that range, and
+ * a rollback removes it in one go.
  *
  * FAST is good for use on graphs with small amounts of changes. DEDUP is good
  * for use on graps with large amounts of changes.
@@ -128,35 +304,249 @@ struct lg_graph {
 	snap_strat_t	gr_snapstrat;
 	uint64_t	gr_snap;
 	uint8_t		gr_rollingback; /* bool */
-	uint64_t	gr_rollback_to;
-	uint64_t	gr_chs_rolled;
 	snap_cb_t	*gr_snap_cb;
 	slablist_t	*gr_edges;
 	slablist_t	*gr_snaps;
+	csr_t		*gr_csr; /* non-NULL iff frozen */
+	edge_strat_t	gr_edgestrat;
+	slablist_t	*gr_in_edges; /* sorted by (to, from), built lazily */
+	slablist_t	*gr_nodes; /* node table, built lazily */
+	dict_t		*gr_dict; /* non-NULL iff EDGE_DENSE */
+	arena_t		gr_ar_edges; /* edge_t's or w_edge_t's */
+	arena_t		gr_ar_changes;
+	arena_t		gr_ar_nodes;
+	epoch_t		*gr_epoch; /* non-NULL iff concurrent */
+	shard_t		*gr_shards; /* non-NULL iff sharded */
+	uint64_t	gr_nshards;
+	cow_t		*gr_cow; /* non-NULL iff gr_edges is shared */
+	slablist_t	*gr_ov_add; /* edges added while shared */
+	slablist_t	*gr_ov_rem; /* shared edges removed while shared */
+	uint64_t	gr_gen; /* bumped whenever the change-log changes */
+	slablist_t	*gr_ckpts; /* checkpoints, sorted by snapshot */
+	uint64_t	gr_ckpt_snaps; /* snapshots between checkpoints */
+	uint64_t	gr_ckpt_changes; /* changes between checkpoints */
 };
 
 /*
- * This structure is used to implement the stack for DFS.
+ * A read-only view of a graph as of one of its snapshots. See graph_view.c.
  *
- * TODO: Describe DFS algorithm, in terms of our slablist-backed graph, and why
- * the bookmark is and so on.
+ * For every edge that changed since the snapshot, `vw_ents` holds a view_ent_t
+ * that records whether the edge existed when the snapshot was taken, and with
+ * which weight. Every other edge is read from the graph. The entries of an
+ * undirected graph are kept in both directions, so that the entries of a node
+ * form one range; `ve_mirror` is set on the direction whose `from` node is the
+ * larger one.
+ */
+typedef struct view_ent {
+	w_edge_t	ve_edge;	/* first, so that w_edge_cmp works */
+	uint8_t		ve_present;	/* bool */
+	uint8_t		ve_mirror;	/* bool */
+} view_ent_t;
+
+struct lg_view {
+	lg_graph_t	*vw_g;
+	uint64_t	vw_snap;
+	uint64_t	vw_gen;		/* the `gr_gen` of `vw_ents` */
+	uint64_t	vw_nedges;	/* the edges `g` had at `vw_snap` */
+	slablist_t	*vw_ents;
+	arena_t		vw_ar;		/* the view_ent_t's */
+};
+
+/*
+ * The net change of an edge between two snapshots. See graph_diff.c.
+ */
+typedef struct diff_ent {
+	w_edge_t	de_edge;	/* with the weight at the later snap */
+	gelem_t		de_oweight;	/* weight at the earlier snapshot */
+	uint8_t		de_was;		/* bool: existed at the earlier snap */
+	uint8_t		de_is;		/* bool: exists at the later snap */
+} diff_ent_t;
+
+/*
+ * An entry in the node table of a graph (see graph_nodes.c). The table is
+ * sorted by `nd_node`, and records how many edges leave and enter each node.
  */
-typedef struct stack_elem {
-	int		se_end;
-	gelem_t		se_node;
-	slablist_bm_t	*se_bm;
-} stack_elem_t;
+typedef struct node {
+	gelem_t		nd_node;
+	uint64_t	nd_out;
+	uint64_t	nd_in;
+} node_t;
+
+/*
+ * The visited-set of a BFS or DFS. It is keyed by node_key(), and is a sorted
+ * slablist, unless the graph is dense, in which case it is a bitmap indexed by
+ * node-id. A traversal that is given a workspace uses the visited-set of the
+ * workspace instead (see graph_trav.c).
+ */
+typedef struct vset {
+	slablist_t	*vs_sl;
+	uint64_t	*vs_bm;
+	uint64_t	vs_bits;
+	lg_trav_ctx_t	*vs_ctx;
+} vset_t;
+
+/*
+ * The stack of a DFS is an array of frames, one for each node on the stack.
+ * When a node is pushed, all of its neighbors are appended to `ds_nbrs`, in the
+ * order of graph_nbrs(), and its frame's cursor walks over them: `df_cur` is
+ * the next neighbor to try, and the frame's neighbors end at `df_end`. Popping
+ * a frame truncates `ds_nbrs` back to the frame's `df_base`. Both arrays grow
+ * geometrically and are never shrunk, so that a stack that is reused (see
+ * lg_trav_ctx_t) doesn't allocate at all once it is deep enough.
+ */
+typedef struct dfs_nbr {
+	gelem_t		dn_node;
+	uint64_t	dn_key;		/* see node_key */
+} dfs_nbr_t;
+
+typedef struct dfs_frame {
+	gelem_t		df_node;
+	uint64_t	df_base;
+	uint64_t	df_cur;
+	uint64_t	df_end;
+} dfs_frame_t;
+
+typedef struct dfs_stack {
+	dfs_frame_t	*ds_frames;
+	uint64_t	ds_depth;
+	uint64_t	ds_cap;
+	dfs_nbr_t	*ds_nbrs;
+	uint64_t	ds_nn;
+	uint64_t	ds_ncap;
+} dfs_stack_t;
+
+/*
+ * A reusable traversal workspace. See graph_trav.c.
+ */
+struct lg_trav_ctx {
+	uint64_t	tc_epoch;	/* slots stamped with it are set */
+	uint64_t	tc_n;		/* keys set in the hash table */
+	int		tc_dense;	/* bool: slots are indexed by node-id */
+	uint64_t	tc_bits;	/* node-ids when the epoch began */
+	uint64_t	*tc_dstamps;	/* indexed by node-id */
+	uint64_t	tc_dcap;
+	uint64_t	*tc_hstamps;	/* hash table */
+	uint64_t	*tc_hkeys;
+	uint64_t	tc_hcap;	/* a power of 2 */
+	gelem_t		*tc_q;		/* ring-buffer */
+	uint64_t	tc_qcap;	/* a power of 2 */
+	uint64_t	tc_qhead;
+	uint64_t	tc_qn;
+	dfs_stack_t	tc_stack;	/* DFS stack */
+};
+
+/*
+ * Called by graph_nbrs() on every neighbor `adj` of `n`. `k` is the key of
+ * `adj` (see node_key), and `w` is the weight of the edge between them.
+ */
+typedef void nbrs_cb_t(gelem_t n, gelem_t adj, uint64_t k, gelem_t w,
+    void *arg);
 
 typedef void *bfs_fold_cb_t(void *);
 typedef void bfs_map_cb_t(void *);
 
 lg_graph_t *lg_mk_graph();
 void lg_rm_graph(lg_graph_t *);
-edge_t *lg_mk_edge();
-stack_elem_t *lg_mk_stack_elem();
+edge_t *lg_mk_edge(lg_graph_t *);
 void lg_rm_edge(edge_t *);
-w_edge_t *lg_mk_w_edge();
+w_edge_t *lg_mk_w_edge(lg_graph_t *);
 void lg_rm_w_edge(w_edge_t *);
-void lg_rm_stack_elem(stack_elem_t *);
-change_t *lg_mk_change();
+change_t *lg_mk_change(lg_graph_t *);
 void lg_rm_change(change_t *);
+node_t *lg_mk_node(lg_graph_t *);
+void lg_rm_node(node_t *);
+void arena_init(arena_t *, size_t);
+void *arena_alloc(arena_t *);
+void arena_free(void *);
+void arena_give(arena_t *, void *);
+int arena_owns(arena_t *, void *);
+void arena_merge(arena_t *, arena_t *);
+void arena_destroy(arena_t *);
+void *lg_zalloc(size_t);
+void lg_free(void *, size_t);
+
+int w_edge_cmp(selem_t, selem_t);
+int w_edge_bnd(selem_t, selem_t, selem_t);
+int node_key(lg_graph_t *, gelem_t, uint64_t *);
+gelem_t key_node(lg_graph_t *, uint64_t);
+void edge_get(lg_graph_t *, selem_t, gelem_t *, gelem_t *, gelem_t *);
+selem_t edge_key(lg_graph_t *, ekey_t *, gelem_t, gelem_t, gelem_t);
+int edge_range(lg_graph_t *, gelem_t, ekey_t *, ekey_t *, selem_t *,
+    selem_t *);
+int mirror_range(lg_graph_t *, gelem_t, ekey_t *, ekey_t *, selem_t *,
+    selem_t *);
+uint64_t nbr_get(lg_graph_t *, int, selem_t, gelem_t *, gelem_t *, gelem_t *);
+slablist_t *edges_create(lg_graph_t *, char *);
+void elem_keys(lg_graph_t *, selem_t, uint64_t *, uint64_t *);
+void edge_free(lg_graph_t *, selem_t);
+void in_index_build(lg_graph_t *);
+void graph_nbrs(lg_graph_t *, gelem_t, nbrs_cb_t *, void *);
+void vset_init(lg_graph_t *, vset_t *, char *);
+void vset_destroy(vset_t *);
+int vset_test(vset_t *, uint64_t);
+void vset_add(vset_t *, uint64_t);
+void vset_init_ctx(lg_graph_t *, vset_t *, lg_trav_ctx_t *);
+void vset_gadd(lg_graph_t *, vset_t *, gelem_t);
+void trav_reset(lg_trav_ctx_t *, lg_graph_t *);
+int trav_test(lg_trav_ctx_t *, uint64_t);
+void trav_add(lg_trav_ctx_t *, uint64_t);
+void trav_enq(lg_trav_ctx_t *, gelem_t);
+gelem_t trav_deq(lg_trav_ctx_t *);
+void dfs_push(lg_graph_t *, dfs_stack_t *, gelem_t);
+dfs_frame_t *dfs_top(dfs_stack_t *);
+int dfs_pushable(dfs_stack_t *, vset_t *, gelem_t *);
+gelem_t dfs_pop(dfs_stack_t *);
+void dfs_stack_destroy(dfs_stack_t *);
+void snaps_range(lg_graph_t *, uint64_t, change_t *, change_t *);
+dict_t *dict_create(void);
+void dict_destroy(dict_t *);
+int dict_find(dict_t *, gelem_t, uint32_t *);
+int dict_intern(dict_t *, gelem_t, uint32_t *);
+gelem_t dict_node(dict_t *, uint32_t);
+dict_t *dict_copy(dict_t *);
+void nodes_build(lg_graph_t *);
+node_t *node_find(lg_graph_t *, gelem_t);
+void nodes_destroy(lg_graph_t *);
+void nodes_edge_add(lg_graph_t *, selem_t);
+void nodes_edge_rem(lg_graph_t *, gelem_t, gelem_t);
+csr_t *csr_build(lg_graph_t *);
+void csr_destroy(csr_t *);
+uint64_t csr_find(csr_t *, gelem_t);
+gelem_t csr_weight(csr_t *, uint64_t);
+gelem_t csr_bfs_fold(lg_graph_t *, csr_t *, gelem_t, adj_cb_t *, fold_cb_t *,
+    gelem_t);
+gelem_t csr_bfs_rdnt_fold(lg_graph_t *, csr_t *, gelem_t, adj_cb_t *,
+    fold_cb_t *, gelem_t);
+gelem_t csr_dfs_fold(lg_graph_t *, csr_t *, gelem_t, pop_cb_t *, fold_cb_t *,
+    gelem_t);
+gelem_t csr_dfs_rdnt_fold(lg_graph_t *, csr_t *, gelem_t, br_cb_t *,
+    pop_cb_t *, fold_cb_t *, gelem_t);
+void csr_neighbors(csr_t *, gelem_t, edges_cb_t *, edges_arg_cb_t *, gelem_t);
+void csr_edges(lg_graph_t *, csr_t *, edges_cb_t *, edges_arg_cb_t *, gelem_t);
+csr_t *epoch_enter(lg_graph_t *, epoch_slot_t **);
+void epoch_exit(epoch_slot_t *);
+slablist_t *shard_lock(lg_graph_t *, gelem_t, shard_t **);
+void shard_unlock(shard_t *);
+int shard_connect(lg_graph_t *, gelem_t, gelem_t, gelem_t);
+int shard_disconnect(lg_graph_t *, gelem_t, gelem_t);
+int shard_wupdate(lg_graph_t *, gelem_t, gelem_t, gelem_t);
+uint64_t shard_nedges(lg_graph_t *);
+void cow_share(lg_graph_t *, lg_graph_t *);
+void cow_write(lg_graph_t *);
+void cow_release(lg_graph_t *);
+int edge_shared(lg_graph_t *, selem_t);
+uint64_t edges_nelems(lg_graph_t *);
+int edges_find(lg_graph_t *, selem_t, selem_t *);
+int edges_add(lg_graph_t *, selem_t);
+int edges_rem(lg_graph_t *, selem_t, slablist_rem_cb_t *);
+selem_t edges_foldr(lg_graph_t *, slablist_fold_t *, selem_t);
+selem_t edges_foldr_range(lg_graph_t *, slablist_fold_t *, selem_t, selem_t,
+    selem_t);
+void ckpt_snapshot(lg_graph_t *, uint64_t);
+int ckpt_clone(lg_graph_t *, lg_graph_t *, uint64_t);
+void ckpt_rollback(lg_graph_t *, uint64_t);
+void ckpt_destroy_snapshot(lg_graph_t *, uint64_t);
+void ckpt_copy(lg_graph_t *, lg_graph_t *);
+void ckpt_destroy(lg_graph_t *);
+uint64_t connect_batch(lg_graph_t *, gelem_t *, gelem_t *, gelem_t *,
+    uint64_t);
@@ -0,0 +1,403 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2015, Nick Zivkovic
+ */
+
+/*
+ * This file implements the node table of a graph (see node_t in
+ * graph_impl.h), and the functions that query it.
+ *
+ * libgraph doesn't otherwise know about nodes; a node exists for as long as
+ * some edge refers to it. The table is built the first time it is needed, by
+ * folding over the edges. From then on, edge_add() and edge_rem() in graph.c
+ * call nodes_edge_add() and nodes_edge_rem(), so that every connect,
+ * disconnect, and rollback keeps the degrees current. A node whose degree
+ * drops to zero is removed from the table.
+ *
+ * An undirected graph stores every edge once, but the edge counts towards both
+ * the in and out degrees of both of its endpoints, so that the two degrees of
+ * a node are always equal.
+ */
+
+#include <stdlib.h>
+#include <strings.h>
+#include "graph_impl.h"
+
+static int
+node_cmp(selem_t e1, selem_t e2)
+{
+	node_t *n1 = e1.sle_p;
+	node_t *n2 = e2.sle_p;
+	if (n1->nd_node.ge_u < n2->nd_node.ge_u) {
+		return (-1);
+	}
+	if (n1->nd_node.ge_u > n2->nd_node.ge_u) {
+		return (1);
+	}
+	return (0);
+}
+
+static int
+node_bnd(selem_t e, selem_t min, selem_t max)
+{
+	if (node_cmp(e, min) < 0) {
+		return (-1);
+	}
+	if (node_cmp(e, max) > 0) {
+		return (1);
+	}
+	return (0);
+}
+
+static void
+free_node_cb(selem_t e)
+{
+	lg_rm_node(e.sle_p);
+}
+
+node_t *
+node_find(lg_graph_t *g, gelem_t n)
+{
+	node_t key;
+	selem_t skey;
+	selem_t found;
+	key.nd_node = n;
+	skey.sle_p = &key;
+	if (slablist_find(g->gr_nodes, skey, &found) == SL_ENFOUND) {
+		return (NULL);
+	}
+	return (found.sle_p);
+}
+
+static void
+node_inc(lg_graph_t *g, gelem_t n, int out)
+{
+	node_t *nd = node_find(g, n);
+	selem_t snd;
+	if (nd == NULL) {
+		nd = lg_mk_node(g);
+		nd->nd_node = n;
+		nd->nd_out = 0;
+		nd->nd_in = 0;
+		snd.sle_p = nd;
+		(void) slablist_add(g->gr_nodes, snd, 0);
+	}
+	if (out) {
+		nd->nd_out++;
+	} else {
+		nd->nd_in++;
+	}
+}
+
+static void
+node_dec(lg_graph_t *g, gelem_t n, int out)
+{
+	node_t *nd = node_find(g, n);
+	selem_t snd;
+	if (nd == NULL) {
+		return;
+	}
+	if (out) {
+		nd->nd_out--;
+	} else {
+		nd->nd_in--;
+	}
+	if (nd->nd_out == 0 && nd->nd_in == 0) {
+		snd.sle_p = nd;
+		(void) slablist_rem(g->gr_nodes, snd, 0, free_node_cb);
+	}
+}
+
+void
+nodes_edge_add(lg_graph_t *g, selem_t e)
+{
+	gelem_t from;
+	gelem_t to;
+	gelem_t w;
+	edge_get(g, e, &from, &to, &w);
+	node_inc(g, from, 1);
+	node_inc(g, to, 0);
+	if (GRAPH_UNDIRECTED(g)) {
+		node_inc(g, to, 1);
+		node_inc(g, from, 0);
+	}
+}
+
+void
+nodes_edge_rem(lg_graph_t *g, gelem_t from, gelem_t to)
+{
+	node_dec(g, from, 1);
+	node_dec(g, to, 0);
+	if (GRAPH_UNDIRECTED(g)) {
+		node_dec(g, to, 1);
+		node_dec(g, from, 0);
+	}
+}
+
+static selem_t
+nodes_build_cb(selem_t zero, selem_t *e, uint64_t sz)
+{
+	lg_graph_t *g = zero.sle_p;
+	uint64_t i = 0;
+	while (i < sz) {
+		nodes_edge_add(g, e[i]);
+		i++;
+	}
+	return (zero);
+}
+
+void
+nodes_build(lg_graph_t *g)
+{
+	if (g->gr_nodes != NULL) {
+		return;
+	}
+	g->gr_nodes = slablist_create("nodes", node_cmp, node_bnd, SL_SORTED);
+	selem_t zero;
+	zero.sle_p = g;
+	edges_foldr(g, nodes_build_cb, zero);
+}
+
+void
+nodes_destroy(lg_graph_t *g)
+{
+	if (g->gr_nodes == NULL) {
+		return;
+	}
+	slablist_destroy(g->gr_nodes, free_node_cb);
+	g->gr_nodes = NULL;
+}
+
+/*
+ * Returns the number of nodes that are the endpoint of at least one edge.
+ *
+ * Sharded graphs have no node table (see lg_shard), so this function and the
+ * other ones that read the node table return 0, or call no callback, on them.
+ */
+uint64_t
+lg_nnodes(lg_graph_t *g)
+{
+	if (g->gr_shards != NULL) {
+		return (0);
+	}
+	nodes_build(g);
+	return (slablist_get_elems(g->gr_nodes));
+}
+
+/*
+ * Returns the number of edges that originate from `n`. In an undirected graph,
+ * this is the number of neighbors of `n`.
+ */
+uint64_t
+lg_degree(lg_graph_t *g, gelem_t n)
+{
+	if (g->gr_shards != NULL) {
+		return (0);
+	}
+	nodes_build(g);
+	node_t *nd = node_find(g, n);
+	if (nd == NULL) {
+		return (0);
+	}
+	return (nd->nd_out);
+}
+
+/*
+ * Returns the number of edges that point to `n`.
+ */
+uint64_t
+lg_in_degree(lg_graph_t *g, gelem_t n)
+{
+	if (g->gr_shards != NULL) {
+		return (0);
+	}
+	nodes_build(g);
+	node_t *nd = node_find(g, n);
+	if (nd == NULL) {
+		return (0);
+	}
+	return (nd->nd_in);
+}
+
+typedef struct nodes_args {
+	nodes_cb_t	*na_cb;
+	nodes_arg_cb_t	*na_acb;
+	gelem_t		na_arg;
+} nodes_args_t;
+
+static selem_t
+nodes_fold_cb(selem_t zero, selem_t *e, uint64_t sz)
+{
+	nodes_args_t *a = zero.sle_p;
+	uint64_t i = 0;
+	while (i < sz) {
+		node_t *nd = e[i].sle_p;
+		if (a->na_acb != NULL) {
+			a->na_acb(nd->nd_node, nd->nd_out, nd->nd_in,
+			    a->na_arg);
+		} else {
+			a->na_cb(nd->nd_node, nd->nd_out, nd->nd_in);
+		}
+		i++;
+	}
+	return (zero);
+}
+
+/*
+ * Calls `cb` on every node in the graph, in ascending order, passing it the
+ * node's out-degree and in-degree.
+ */
+void
+lg_nodes(lg_graph_t *g, nodes_cb_t *cb)
+{
+	nodes_args_t args;
+	if (g->gr_shards != NULL) {
+		return;
+	}
+	args.na_cb = cb;
+	args.na_acb = NULL;
+	nodes_build(g);
+	selem_t zero;
+	zero.sle_p = &args;
+	slablist_foldr(g->gr_nodes, nodes_fold_cb, zero);
+}
+
+void
+lg_nodes_arg(lg_graph_t *g, nodes_arg_cb_t *cb, gelem_t arg)
+{
+	nodes_args_t args;
+	if (g->gr_shards != NULL) {
+		return;
+	}
+	args.na_cb = NULL;
+	args.na_acb = cb;
+	args.na_arg = arg;
+	nodes_build(g);
+	selem_t zero;
+	zero.sle_p = &args;
+	slablist_foldr(g->gr_nodes, nodes_fold_cb, zero);
+}
+
+/*
+ * The top-k query keeps the k best nodes seen so far in a min-heap, ordered by
+ * out-degree, so that the root is always the node to evict. Ties are broken in
+ * favor of the smaller node, which makes the result deterministic.
+ */
+typedef struct topk {
+	node_t		**tk_heap;
+	uint64_t	tk_k;
+	uint64_t	tk_n;
+} topk_t;
+
+/* Returns non-zero if `a` ranks below `b`. */
+static int
+topk_below(node_t *a, node_t *b)
+{
+	if (a->nd_out != b->nd_out) {
+		return (a->nd_out < b->nd_out);
+	}
+	return (a->nd_node.ge_u > b->nd_node.ge_u);
+}
+
+static void
+topk_sift_down(node_t **h, uint64_t n, uint64_t i)
+{
+	while (1) {
+		uint64_t l = 2 * i + 1;
+		uint64_t r = l + 1;
+		uint64_t m = i;
+		if (l < n && topk_below(h[l], h[m])) {
+			m = l;
+		}
+		if (r < n && topk_below(h[r], h[m])) {
+			m = r;
+		}
+		if (m == i) {
+			return;
+		}
+		node_t *tmp = h[i];
+		h[i] = h[m];
+		h[m] = tmp;
+		i = m;
+	}
+}
+
+static void
+topk_sift_up(node_t **h, uint64_t i)
+{
+	while (i > 0) {
+		uint64_t p = (i - 1) / 2;
+		if (!topk_below(h[i], h[p])) {
+			return;
+		}
+		node_t *tmp = h[i];
+		h[i] = h[p];
+		h[p] = tmp;
+		i = p;
+	}
+}
+
+static selem_t
+topk_fold_cb(selem_t zero, selem_t *e, uint64_t sz)
+{
+	topk_t *tk = zero.sle_p;
+	uint64_t i = 0;
+	while (i < sz) {
+		node_t *nd = e[i].sle_p;
+		if (tk->tk_n < tk->tk_k) {
+			tk->tk_heap[tk->tk_n] = nd;
+			topk_sift_up(tk->tk_heap, tk->tk_n);
+			tk->tk_n++;
+		} else if (topk_below(tk->tk_heap[0], nd)) {
+			tk->tk_heap[0] = nd;
+			topk_sift_down(tk->tk_heap, tk->tk_n, 0);
+		}
+		i++;
+	}
+	return (zero);
+}
+
+/*
+ * Writes the (up to) `k` nodes with the highest out-degree into `out`, highest
+ * first, and returns how many were written.
+ */
+uint64_t
+lg_top_degree(lg_graph_t *g, uint64_t k, gelem_t *out)
+{
+	topk_t tk;
+	if (k == 0 || g->gr_shards != NULL) {
+		return (0);
+	}
+	nodes_build(g);
+	uint64_t nn = slablist_get_elems(g->gr_nodes);
+	if (k > nn) {
+		k = nn;
+	}
+	if (k == 0) {
+		return (0);
+	}
+	tk.tk_heap = lg_zalloc(k * sizeof (node_t *));
+	tk.tk_k = k;
+	tk.tk_n = 0;
+	selem_t zero;
+	zero.sle_p = &tk;
+	slablist_foldr(g->gr_nodes, topk_fold_cb, zero);
+	/*
+	 * Popping the root of the min-heap yields the lowest-ranked node, so we
+	 * fill `out` from the back.
+	 */
+	uint64_t n = tk.tk_n;
+	while (n > 0) {
+		out[n - 1] = tk.tk_heap[0]->nd_node;
+		n--;
+		tk.tk_heap[0] = tk.tk_heap[n];
+		topk_sift_down(tk.tk_heap, n, 0);
+	}
+	lg_free(tk.tk_heap, k * sizeof (node_t *));
+	return (tk.tk_n);
+}
@@ -0,0 +1,410 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2015, Nick Zivkovic
+ */
+
+/*
+ * This file implements parallel BFS (lg_par_bfs).
+ *
+ * The BFS runs over a CSR image of the graph (see graph_csr.c): the image of a
+ * frozen graph, the published image of a concurrent graph, or, for any other
+ * graph, an image that is built for this one traversal. Graphs that are
+ * traversed this way many times should be frozen first.
+ *
+ * The BFS is level-synchronous. The calling thread folds over the current
+ * level, and then every thread in the pool expands a share of it: it walks the
+ * neighbors of its nodes, claims the unvisited ones by setting their bit in a
+ * shared visited-bitmap with an atomic or, and appends the ones it claimed to
+ * a frontier of its own. Once all threads are done, the calling thread
+ * concatenates their frontiers into the next level.
+ *
+ * A level is split by edges, not by nodes: the calling thread sums up the
+ * degrees of the level's nodes, and cuts the level's edges into chunks, which
+ * the threads take turns grabbing. A node with a large degree is therefore
+ * spread over many chunks, instead of being expanded by a single thread while
+ * the others wait for the level to end.
+ *
+ * The callbacks mean the same as those of lg_bfs_fold(), but ordering is
+ * relaxed in the following ways:
+ *
+ *	- The fold-callback is only ever called by the calling thread, and on
+ *	  every node of a level before any node of the next level, but the order
+ *	  of nodes within a level is arbitrary. If the fold-callback terminates
+ *	  the traversal, the rest of the level is neither folded nor expanded.
+ *
+ *	- The adjacency-callback is called exactly once for every node that gets
+ *	  visited, with a parent that is in the previous level, but it is called
+ *	  from any of the threads, concurrently, and so must be thread-safe. The
+ *	  aggregate it is passed is the one from the end of the previous level's
+ *	  fold.
+ */
+
+#include <stdlib.h>
+#include <strings.h>
+#include <unistd.h>
+#include "graph_impl.h"
+#include "graph_provider.h"
+
+#define	PAR_CHUNK	1024	/* the fewest edges in a chunk */
+#define	PAR_CHUNKS	8	/* chunks per thread, in big levels */
+#define	PAR_MAXTHREADS	256
+
+#define	BM_WORDS(n)	(((n) + 63) / 64)
+
+/*
+ * The frontier of one thread. Every thread appends to its own, so each of them
+ * fills a cache line.
+ */
+typedef struct par_local {
+	uint64_t	*pl_slots;
+	uint64_t	pl_n;
+	uint64_t	pl_cap;
+	char		pl_pad[40];
+} par_local_t;
+
+typedef struct par_bfs {
+	lg_graph_t	*pb_g;
+	csr_t		*pb_cs;
+	adj_cb_t	*pb_acb;
+	gelem_t		pb_agg;
+	uint64_t	pb_nthreads;
+	uint64_t	*pb_visited;	/* atomic bitmap of node-slots */
+	uint64_t	*pb_level;	/* node-slots of the current level */
+	uint64_t	pb_nlevel;
+	uint64_t	*pb_degsum;	/* edges before each level node */
+	uint64_t	pb_chunk;	/* edges per chunk */
+	uint64_t	pb_nchunks;
+	uint64_t	pb_next_chunk;	/* the next chunk to be grabbed */
+	int		pb_done;
+	int		pb_ready;	/* pb_barrier has been initialized */
+	pthread_mutex_t	pb_lock;	/* protects pb_ready */
+	pthread_cond_t	pb_cv;
+	pthread_barrier_t pb_barrier;
+	par_local_t	*pb_locals;
+} par_bfs_t;
+
+typedef struct par_worker {
+	par_bfs_t	*pw_pb;
+	uint64_t	pw_id;
+} par_worker_t;
+
+/*
+ * Claims the slot `s`, returning 1 if it wasn't visited yet.
+ */
+static int
+par_claim(uint64_t *V, uint64_t s)
+{
+	uint64_t bit = 1ULL << (s % 64);
+	if (__atomic_load_n(&V[s / 64], __ATOMIC_RELAXED) & bit) {
+		return (0);
+	}
+	uint64_t old = __atomic_fetch_or(&V[s / 64], bit, __ATOMIC_RELAXED);
+	return ((old & bit) == 0);
+}
+
+static void
+par_local_add(par_local_t *pl, uint64_t s)
+{
+	if (pl->pl_n == pl->pl_cap) {
+		uint64_t ncap = pl->pl_cap == 0 ? 256 : pl->pl_cap * 2;
+		uint64_t *ns = lg_zalloc(ncap * sizeof (uint64_t));
+		if (pl->pl_cap > 0) {
+			bcopy(pl->pl_slots, ns, pl->pl_n * sizeof (uint64_t));
+			lg_free(pl->pl_slots, pl->pl_cap * sizeof (uint64_t));
+		}
+		pl->pl_slots = ns;
+		pl->pl_cap = ncap;
+	}
+	pl->pl_slots[pl->pl_n++] = s;
+}
+
+/*
+ * Expands the edges [`e`, `end`) of the current level, where `e` is an offset
+ * into the concatenation of the rows of the level's nodes.
+ */
+static void
+par_expand_chunk(par_bfs_t *pb, par_local_t *pl, uint64_t e, uint64_t end)
+{
+	csr_t *cs = pb->pb_cs;
+	/*
+	 * Find the node that the chunk starts in: the last one that has no more
+	 * than `e` edges before it.
+	 */
+	uint64_t lo = 0;
+	uint64_t hi = pb->pb_nlevel;
+	while (hi - lo > 1) {
+		uint64_t mid = lo + (hi - lo) / 2;
+		if (pb->pb_degsum[mid] <= e) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+	uint64_t i = lo;
+	while (e < end) {
+		uint64_t last = pb->pb_level[i];
+		gelem_t from = cs->cs_nodes[last];
+		uint64_t j = cs->cs_off[last] + (e - pb->pb_degsum[i]);
+		uint64_t jend = cs->cs_off[last + 1];
+		if (jend - j > end - e) {
+			jend = j + (end - e);
+		}
+		e += jend - j;
+		while (j < jend) {
+			uint64_t adj = cs->cs_adj[j];
+			if (par_claim(pb->pb_visited, adj)) {
+				gelem_t to = cs->cs_nodes[adj];
+				if (pb->pb_acb != NULL) {
+					pb->pb_acb(to, from, csr_weight(cs, j),
+					    pb->pb_agg);
+				}
+				GRAPH_BFS_ENQ(to);
+				par_local_add(pl, adj);
+				GRAPH_BFS_VISIT(to);
+			}
+			j++;
+		}
+		i++;
+	}
+}
+
+/*
+ * Grabs chunks of the current level until there are none left.
+ */
+static void
+par_expand(par_bfs_t *pb, uint64_t id)
+{
+	par_local_t *pl = &pb->pb_locals[id];
+	uint64_t total = pb->pb_degsum[pb->pb_nlevel];
+	while (1) {
+		uint64_t c = __atomic_fetch_add(&pb->pb_next_chunk, 1,
+		    __ATOMIC_RELAXED);
+		if (c >= pb->pb_nchunks) {
+			return;
+		}
+		uint64_t e = c * pb->pb_chunk;
+		uint64_t end = e + pb->pb_chunk;
+		if (end > total) {
+			end = total;
+		}
+		par_expand_chunk(pb, pl, e, end);
+	}
+}
+
+static void *
+par_worker(void *arg)
+{
+	par_worker_t *pw = arg;
+	par_bfs_t *pb = pw->pw_pb;
+	(void) pthread_mutex_lock(&pb->pb_lock);
+	while (!pb->pb_ready) {
+		(void) pthread_cond_wait(&pb->pb_cv, &pb->pb_lock);
+	}
+	(void) pthread_mutex_unlock(&pb->pb_lock);
+	while (1) {
+		(void) pthread_barrier_wait(&pb->pb_barrier);
+		if (pb->pb_done) {
+			return (NULL);
+		}
+		par_expand(pb, pw->pw_id);
+		(void) pthread_barrier_wait(&pb->pb_barrier);
+	}
+}
+
+/*
+ * Sums up the degrees of the current level, and cuts its edges into chunks.
+ */
+static void
+par_plan_level(par_bfs_t *pb)
+{
+	csr_t *cs = pb->pb_cs;
+	uint64_t i = 0;
+	uint64_t total = 0;
+	while (i < pb->pb_nlevel) {
+		uint64_t s = pb->pb_level[i];
+		pb->pb_degsum[i] = total;
+		total += cs->cs_off[s + 1] - cs->cs_off[s];
+		i++;
+	}
+	pb->pb_degsum[i] = total;
+	uint64_t chunk = total / (pb->pb_nthreads * PAR_CHUNKS);
+	if (chunk < PAR_CHUNK) {
+		chunk = PAR_CHUNK;
+	}
+	pb->pb_chunk = chunk;
+	pb->pb_nchunks = (total + chunk - 1) / chunk;
+	pb->pb_next_chunk = 0;
+}
+
+/*
+ * Makes the concatenation of the threads' frontiers the current level.
+ */
+static void
+par_next_level(par_bfs_t *pb)
+{
+	uint64_t n = 0;
+	uint64_t t = 0;
+	while (t < pb->pb_nthreads) {
+		par_local_t *pl = &pb->pb_locals[t];
+		if (pl->pl_n > 0) {
+			bcopy(pl->pl_slots, &pb->pb_level[n],
+			    pl->pl_n * sizeof (uint64_t));
+		}
+		n += pl->pl_n;
+		pl->pl_n = 0;
+		t++;
+	}
+	pb->pb_nlevel = n;
+}
+
+static gelem_t
+par_bfs(lg_graph_t *g, csr_t *cs, uint64_t nthreads, gelem_t start,
+    adj_cb_t *acb, fold_cb_t *cb, gelem_t gzero)
+{
+	GRAPH_BFS_BEGIN(g);
+	if (cs->cs_nedges == 0) {
+		return (gzero);
+	}
+	gelem_t agg = gzero;
+	uint64_t s = csr_find(cs, start);
+	GRAPH_BFS_ENQ(start);
+	if (s == CSR_NONE) {
+		/* `start` has no edges, so it's the only node we visit */
+		GRAPH_BFS_DEQ(start);
+		if (cb != NULL) {
+			(void)cb(agg, start, &agg);
+		}
+		GRAPH_BFS_END(g);
+		return (agg);
+	}
+
+	par_bfs_t pb;
+	bzero(&pb, sizeof (par_bfs_t));
+	pb.pb_g = g;
+	pb.pb_cs = cs;
+	pb.pb_acb = acb;
+	pb.pb_visited = lg_zalloc(BM_WORDS(cs->cs_nnodes) * sizeof (uint64_t));
+	pb.pb_level = lg_zalloc(cs->cs_nnodes * sizeof (uint64_t));
+	pb.pb_degsum = lg_zalloc((cs->cs_nnodes + 1) * sizeof (uint64_t));
+	pb.pb_locals = lg_zalloc(nthreads * sizeof (par_local_t));
+	par_worker_t *pw = lg_zalloc(nthreads * sizeof (par_worker_t));
+	pthread_t *tids = lg_zalloc(nthreads * sizeof (pthread_t));
+	(void) pthread_mutex_init(&pb.pb_lock, NULL);
+	(void) pthread_cond_init(&pb.pb_cv, NULL);
+	/*
+	 * The barrier can only be sized once we know how many threads we
+	 * managed to create, so they wait for it to be initialized.
+	 */
+	uint64_t t = 1;
+	while (t < nthreads) {
+		pw[t].pw_pb = &pb;
+		pw[t].pw_id = t;
+		if (pthread_create(&tids[t], NULL, par_worker, &pw[t]) != 0) {
+			break;
+		}
+		t++;
+	}
+	pb.pb_nthreads = t;
+	(void) pthread_barrier_init(&pb.pb_barrier, NULL, (unsigned)t);
+	(void) pthread_mutex_lock(&pb.pb_lock);
+	pb.pb_ready = 1;
+	(void) pthread_cond_broadcast(&pb.pb_cv);
+	(void) pthread_mutex_unlock(&pb.pb_lock);
+
+	pb.pb_level[0] = s;
+	pb.pb_nlevel = 1;
+	pb.pb_visited[s / 64] |= 1ULL << (s % 64);
+	while (1) {
+		uint64_t i = 0;
+		while (i < pb.pb_nlevel && !pb.pb_done) {
+			gelem_t n = cs->cs_nodes[pb.pb_level[i]];
+			GRAPH_BFS_DEQ(n);
+			if (cb != NULL && cb(agg, n, &agg)) {
+				pb.pb_done = 1;
+			}
+			i++;
+		}
+		if (pb.pb_nlevel == 0) {
+			pb.pb_done = 1;
+		}
+		pb.pb_agg = agg;
+		par_plan_level(&pb);
+		(void) pthread_barrier_wait(&pb.pb_barrier);
+		if (pb.pb_done) {
+			break;
+		}
+		par_expand(&pb, 0);
+		(void) pthread_barrier_wait(&pb.pb_barrier);
+		par_next_level(&pb);
+	}
+
+	t = 1;
+	while (t < pb.pb_nthreads) {
+		(void) pthread_join(tids[t], NULL);
+		t++;
+	}
+	(void) pthread_barrier_destroy(&pb.pb_barrier);
+	(void) pthread_cond_destroy(&pb.pb_cv);
+	(void) pthread_mutex_destroy(&pb.pb_lock);
+	t = 0;
+	while (t < nthreads) {
+		if (pb.pb_locals[t].pl_cap > 0) {
+			lg_free(pb.pb_locals[t].pl_slots,
+			    pb.pb_locals[t].pl_cap * sizeof (uint64_t));
+		}
+		t++;
+	}
+	lg_free(tids, nthreads * sizeof (pthread_t));
+	lg_free(pw, nthreads * sizeof (par_worker_t));
+	lg_free(pb.pb_locals, nthreads * sizeof (par_local_t));
+	lg_free(pb.pb_degsum, (cs->cs_nnodes + 1) * sizeof (uint64_t));
+	lg_free(pb.pb_level, cs->cs_nnodes * sizeof (uint64_t));
+	lg_free(pb.pb_visited, BM_WORDS(cs->cs_nnodes) * sizeof (uint64_t));
+	GRAPH_BFS_END(g);
+	return (agg);
+}
+
+/*
+ * A BFS from `start`, which expands each level with `nthreads` threads (or as
+ * many threads as there are online CPUs, if `nthreads` is 0), the calling
+ * thread included. The callbacks are those of lg_bfs_fold(), with the ordering
+ * relaxations described at the top of this file. Sharded graphs can't be
+ * turned into a CSR image while other threads connect edges into them, so they
+ * are walked by lg_bfs_fold(), on the calling thread alone. It reads the
+ * neighbors of each node from the edge-list of the node's shard, with the shard
+ * locked.
+ */
+gelem_t
+lg_par_bfs(lg_graph_t *g, uint64_t nthreads, gelem_t start, adj_cb_t *acb,
+    fold_cb_t *cb, gelem_t gzero)
+{
+	if (g->gr_shards != NULL) {
+		return (lg_bfs_fold(g, start, acb, cb, gzero));
+	}
+	if (nthreads == 0) {
+		long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+		nthreads = ncpus > 0 ? (uint64_t)ncpus : 1;
+	}
+	if (nthreads > PAR_MAXTHREADS) {
+		nthreads = PAR_MAXTHREADS;
+	}
+	if (g->gr_epoch != NULL) {
+		epoch_slot_t *es;
+		csr_t *cs = epoch_enter(g, &es);
+		gelem_t r = par_bfs(g, cs, nthreads, start, acb, cb, gzero);
+		epoch_exit(es);
+		return (r);
+	}
+	if (g->gr_csr != NULL) {
+		return (par_bfs(g, g->gr_csr, nthreads, start, acb, cb, gzero));
+	}
+	csr_t *cs = csr_build(g);
+	gelem_t r = par_bfs(g, cs, nthreads, start, acb, cb, gzero);
+	csr_destroy(cs);
+	return (r);
+}
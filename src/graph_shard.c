@@ -0,0 +1,287 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2015, Nick Zivkovic
+ */
+
+/*
+ * This file implements sharded graphs (see lg_shard), which many threads can
+ * connect edges into at the same time.
+ *
+ * A sharded graph partitions its edges by their `from` node into a number of
+ * shards, each of which is a sorted slablist of edges, protected by its own
+ * lock. All of the edges that leave a node are in the same shard, so
+ * connecting, disconnecting, or updating an edge, and visiting the neighbors
+ * of a node, only ever lock one shard, and threads that work on nodes in
+ * different shards don't wait for each other.
+ *
+ * The arena that a graph allocates its edges from isn't thread-safe, so every
+ * shard has an arena of its own. Edges that get disconnected while the graph is
+ * sharded go to the free list of their shard's arena, even if they were
+ * allocated before the graph was sharded. When the graph is unsharded, the
+ * edges are moved back into `gr_edges`, and the shard arenas are merged into
+ * the graph's edge arena.
+ *
+ * Only directed graphs can be sharded: the edges of an undirected graph are
+ * stored under their smaller endpoint (see edge_canon), so the neighbors of a
+ * node would be spread over all of the shards. Dense graphs can't be sharded
+ * either, since every connect may have to add to the node dictionary.
+ */
+
+#include <stdlib.h>
+#include <strings.h>
+#include "graph_impl.h"
+
+static shard_t *
+shard_of(lg_graph_t *g, gelem_t from)
+{
+	uint64_t h = (from.ge_u * 0x9E3779B97F4A7C15ULL) >> 32;
+	return (&g->gr_shards[h % g->gr_nshards]);
+}
+
+/*
+ * Locks the shard that holds the edges leaving `from`, and returns its
+ * edge-list.
+ */
+slablist_t *
+shard_lock(lg_graph_t *g, gelem_t from, shard_t **shp)
+{
+	shard_t *sh = shard_of(g, from);
+	(void) pthread_mutex_lock(&sh->sh_lock);
+	*shp = sh;
+	return (sh->sh_edges);
+}
+
+void
+shard_unlock(shard_t *sh)
+{
+	(void) pthread_mutex_unlock(&sh->sh_lock);
+}
+
+/*
+ * The sharded versions of lg_connect() and lg_wconnect(). The weight is
+ * ignored in unweighted graphs.
+ */
+int
+shard_connect(lg_graph_t *g, gelem_t from, gelem_t to, gelem_t w)
+{
+	shard_t *sh;
+	selem_t se;
+	uint64_t kf;
+	uint64_t kt;
+	edge_t *e = NULL;
+	w_edge_t *we = NULL;
+	slablist_t *edges = shard_lock(g, from, &sh);
+	if (EDGE_PACKED(g)) {
+		(void) node_key(g, from, &kf);
+		(void) node_key(g, to, &kt);
+		se.sle_u = EDGE_PACK(kf, kt);
+	} else if (g->gr_type == DIGRAPH_WE) {
+		we = arena_alloc(&sh->sh_ar);
+		we->wed_from = from;
+		we->wed_to = to;
+		we->wed_weight = w;
+		se.sle_p = we;
+	} else {
+		e = arena_alloc(&sh->sh_ar);
+		e->ed_from = from;
+		e->ed_to = to;
+		se.sle_p = e;
+	}
+	if (slablist_add(edges, se, 0) == SL_EDUP) {
+		if (!EDGE_PACKED(g)) {
+			arena_give(&sh->sh_ar, se.sle_p);
+		}
+		shard_unlock(sh);
+		return (G_ERR_EDGE_EXISTS);
+	}
+	shard_unlock(sh);
+	return (0);
+}
+
+/*
+ * The sharded version of lg_disconnect() and lg_wdisconnect().
+ */
+int
+shard_disconnect(lg_graph_t *g, gelem_t from, gelem_t to)
+{
+	shard_t *sh;
+	ekey_t k;
+	gelem_t w;
+	selem_t found;
+	w.ge_u = 0;
+	selem_t key = edge_key(g, &k, from, to, w);
+	slablist_t *edges = shard_lock(g, from, &sh);
+	if (slablist_find(edges, key, &found) == SL_ENFOUND) {
+		shard_unlock(sh);
+		return (G_ERR_NFOUND_DISCONNECT);
+	}
+	(void) slablist_rem(edges, key, 0, NULL);
+	if (!EDGE_PACKED(g)) {
+		arena_give(&sh->sh_ar, found.sle_p);
+	}
+	shard_unlock(sh);
+	return (0);
+}
+
+/*
+ * The sharded version of lg_wupdate().
+ */
+int
+shard_wupdate(lg_graph_t *g, gelem_t from, gelem_t to, gelem_t weight)
+{
+	shard_t *sh;
+	ekey_t k;
+	selem_t found;
+	selem_t key = edge_key(g, &k, from, to, weight);
+	slablist_t *edges = shard_lock(g, from, &sh);
+	if (slablist_find(edges, key, &found) == SL_ENFOUND) {
+		shard_unlock(sh);
+		return (G_ERR_NFOUND_UPDATE);
+	}
+	w_edge_t *stored = found.sle_p;
+	stored->wed_weight = weight;
+	shard_unlock(sh);
+	return (0);
+}
+
+uint64_t
+shard_nedges(lg_graph_t *g)
+{
+	uint64_t n = 0;
+	uint64_t i = 0;
+	while (i < g->gr_nshards) {
+		shard_t *sh = &g->gr_shards[i];
+		(void) pthread_mutex_lock(&sh->sh_lock);
+		n += slablist_get_elems(sh->sh_edges);
+		(void) pthread_mutex_unlock(&sh->sh_lock);
+		i++;
+	}
+	return (n);
+}
+
+static selem_t
+shard_move_cb(selem_t zero, selem_t *e, uint64_t sz)
+{
+	lg_graph_t *g = zero.sle_p;
+	gelem_t from;
+	gelem_t to;
+	gelem_t w;
+	uint64_t i = 0;
+	while (i < sz) {
+		edge_get(g, e[i], &from, &to, &w);
+		(void) slablist_add(shard_of(g, from)->sh_edges, e[i], 0);
+		i++;
+	}
+	return (zero);
+}
+
+static selem_t
+unshard_move_cb(selem_t zero, selem_t *e, uint64_t sz)
+{
+	lg_graph_t *g = zero.sle_p;
+	uint64_t i = 0;
+	while (i < sz) {
+		(void) slablist_add(g->gr_edges, e[i], 0);
+		i++;
+	}
+	return (zero);
+}
+
+/*
+ * Splits the edges of `g` into `nshards` shards. While the graph is sharded,
+ * lg_connect(), lg_disconnect(), lg_wconnect(), lg_wdisconnect(),
+ * lg_wupdate(), lg_neighbors(), lg_neighbors_arg() and lg_nedges() can be
+ * called by many threads at once. The neighbor callbacks run with the shard of
+ * the node locked, so they must not change the graph. The BFS and DFS folds
+ * walk the shards in the same way, locking the shard of each node while they
+ * read its neighbors, so their adjacency callbacks are under the same
+ * restriction. Functions that would rebuild the edge-list, such as
+ * lg_edgestrat(), lg_freeze() and lg_concurrent(), return -1. The node table
+ * and the incoming-edge index aren't kept while sharded, so lg_nnodes(),
+ * lg_degree(), lg_in_degree(), lg_top_degree() and lg_nodes() return 0 (or
+ * call no callback), as does lg_in_neighbors(), and lg_remove_node() returns
+ * -1. No other function may be called on the graph until it is unsharded with
+ * lg_unshard(), and changes made while sharded aren't recorded in any snapshot.
+ *
+ * Returns 0 on success, and -1 if the graph is undirected, dense, frozen,
+ * concurrent, or has snapshots, or if `nshards` is 0. Sharding an already
+ * sharded graph does nothing.
+ */
+int
+lg_shard(lg_graph_t *g, uint64_t nshards)
+{
+	if (g->gr_shards != NULL) {
+		return (0);
+	}
+	if (nshards == 0 || GRAPH_UNDIRECTED(g) ||
+	    g->gr_edgestrat == EDGE_DENSE || g->gr_csr != NULL ||
+	    g->gr_epoch != NULL || g->gr_snaps != NULL) {
+		return (-1);
+	}
+	lg_compact(g);
+	/* these can't be kept in sync by many threads, and get rebuilt later */
+	if (g->gr_in_edges != NULL) {
+		slablist_destroy(g->gr_in_edges, NULL);
+		g->gr_in_edges = NULL;
+	}
+	nodes_destroy(g);
+	g->gr_shards = lg_zalloc(nshards * sizeof (shard_t));
+	g->gr_nshards = nshards;
+	uint64_t i = 0;
+	while (i < nshards) {
+		shard_t *sh = &g->gr_shards[i];
+		(void) pthread_mutex_init(&sh->sh_lock, NULL);
+		sh->sh_edges = edges_create(g, "shard_edges");
+		arena_init(&sh->sh_ar, g->gr_ar_edges.ar_size);
+		i++;
+	}
+	selem_t zero;
+	zero.sle_p = g;
+	slablist_foldr(g->gr_edges, shard_move_cb, zero);
+	slablist_destroy(g->gr_edges, NULL);
+	g->gr_edges = edges_create(g, NULL);
+	return (0);
+}
+
+/*
+ * Moves the edges of a sharded graph back into a single edge-list. All of the
+ * threads have to be done with `g` before this is called.
+ */
+void
+lg_unshard(lg_graph_t *g)
+{
+	if (g->gr_shards == NULL) {
+		return;
+	}
+	/* as in lg_shard(), these are rebuilt from the merged edges later */
+	if (g->gr_in_edges != NULL) {
+		slablist_destroy(g->gr_in_edges, NULL);
+		g->gr_in_edges = NULL;
+	}
+	nodes_destroy(g);
+	selem_t zero;
+	zero.sle_p = g;
+	uint64_t i = 0;
+	while (i < g->gr_nshards) {
+		shard_t *sh = &g->gr_shards[i];
+		slablist_foldr(sh->sh_edges, unshard_move_cb, zero);
+		slablist_destroy(sh->sh_edges, NULL);
+		arena_merge(&g->gr_ar_edges, &sh->sh_ar);
+		(void) pthread_mutex_destroy(&sh->sh_lock);
+		i++;
+	}
+	lg_free(g->gr_shards, g->gr_nshards * sizeof (shard_t));
+	g->gr_shards = NULL;
+	g->gr_nshards = 0;
+}
+
+int
+lg_is_sharded(lg_graph_t *g)
+{
+	return (g->gr_shards != NULL);
+}
@@ -0,0 +1,321 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2015, Nick Zivkovic
+ */
+
+/*
+ * This file implements traversal workspaces (lg_trav_ctx_t), which hold the
+ * queue and the visited-set of a traversal, and can be reused by any number
+ * of traversals (see lg_bfs_fold_ctx and lg_dfs_fold_ctx). A plain traversal
+ * creates a slablist for its queue and another one for its visited-set, and
+ * destroys them when it's done, which dominates the cost of a short
+ * traversal. A workspace keeps its memory from one traversal to the next, and
+ * is reset in constant time.
+ *
+ * The visited-set is a table of slots, each of which is stamped with the
+ * epoch in which it was last set. Every reset starts a new epoch, which
+ * empties every slot at once, without touching any of them. If the graph is
+ * dense, the slots are indexed by node-id, like the bitmap of a vset_t (see
+ * vset_init). Otherwise, they form an open-addressing hash table of node keys,
+ * with linear probing, in which a slot of an older epoch counts as empty. The
+ * table doubles when it becomes half full.
+ *
+ * The queue is a ring-buffer of nodes, that doubles when it fills up.
+ *
+ * This file also implements the DFS stack (dfs_stack_t), which is used by all
+ * of the DFS variants, and which a workspace keeps as well. It is a pair of
+ * arrays: one of frames, and one of the neighbors of the nodes in the frames
+ * (see the comment above dfs_stack_t in graph_impl.h). A frame's cursor is an
+ * index into the latter, so pushing and popping a node only allocates memory
+ * when the stack is deeper (or the nodes on it have more neighbors) than it has
+ * ever been.
+ *
+ * A workspace can be used with any graph, but only by one thread at a time.
+ */
+
+#include <stdlib.h>
+#include <strings.h>
+#include "graph_impl.h"
+
+lg_trav_ctx_t *
+lg_trav_ctx_create(void)
+{
+	return (lg_zalloc(sizeof (lg_trav_ctx_t)));
+}
+
+void
+lg_trav_ctx_destroy(lg_trav_ctx_t *tc)
+{
+	if (tc->tc_dcap > 0) {
+		lg_free(tc->tc_dstamps, tc->tc_dcap * sizeof (uint64_t));
+	}
+	if (tc->tc_hcap > 0) {
+		lg_free(tc->tc_hstamps, tc->tc_hcap * sizeof (uint64_t));
+		lg_free(tc->tc_hkeys, tc->tc_hcap * sizeof (uint64_t));
+	}
+	if (tc->tc_qcap > 0) {
+		lg_free(tc->tc_q, tc->tc_qcap * sizeof (gelem_t));
+	}
+	dfs_stack_destroy(&tc->tc_stack);
+	lg_free(tc, sizeof (lg_trav_ctx_t));
+}
+
+/*
+ * Empties the workspace, for a traversal of `g`.
+ */
+void
+trav_reset(lg_trav_ctx_t *tc, lg_graph_t *g)
+{
+	tc->tc_epoch++;
+	tc->tc_n = 0;
+	tc->tc_qhead = 0;
+	tc->tc_qn = 0;
+	tc->tc_stack.ds_depth = 0;
+	tc->tc_stack.ds_nn = 0;
+	tc->tc_bits = 0;
+	tc->tc_dense = (g->gr_edgestrat == EDGE_DENSE);
+	if (!tc->tc_dense) {
+		return;
+	}
+	tc->tc_bits = g->gr_dict->di_n;
+	if (tc->tc_bits > tc->tc_dcap) {
+		uint64_t ncap = tc->tc_dcap == 0 ? 64 : tc->tc_dcap;
+		while (ncap < tc->tc_bits) {
+			ncap *= 2;
+		}
+		if (tc->tc_dcap > 0) {
+			lg_free(tc->tc_dstamps,
+			    tc->tc_dcap * sizeof (uint64_t));
+		}
+		tc->tc_dstamps = lg_zalloc(ncap * sizeof (uint64_t));
+		tc->tc_dcap = ncap;
+	}
+}
+
+static uint64_t
+trav_hash(uint64_t k)
+{
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	return (k);
+}
+
+/*
+ * Returns the slot of the hash table that holds `k`, or the empty slot that
+ * would hold it.
+ */
+static uint64_t
+trav_slot(lg_trav_ctx_t *tc, uint64_t k)
+{
+	uint64_t mask = tc->tc_hcap - 1;
+	uint64_t i = trav_hash(k) & mask;
+	while (tc->tc_hstamps[i] == tc->tc_epoch && tc->tc_hkeys[i] != k) {
+		i = (i + 1) & mask;
+	}
+	return (i);
+}
+
+static void
+trav_rehash(lg_trav_ctx_t *tc, uint64_t ncap)
+{
+	uint64_t *ostamps = tc->tc_hstamps;
+	uint64_t *okeys = tc->tc_hkeys;
+	uint64_t ocap = tc->tc_hcap;
+	uint64_t i = 0;
+	tc->tc_hstamps = lg_zalloc(ncap * sizeof (uint64_t));
+	tc->tc_hkeys = lg_zalloc(ncap * sizeof (uint64_t));
+	tc->tc_hcap = ncap;
+	while (i < ocap) {
+		if (ostamps[i] == tc->tc_epoch) {
+			uint64_t s = trav_slot(tc, okeys[i]);
+			tc->tc_hstamps[s] = tc->tc_epoch;
+			tc->tc_hkeys[s] = okeys[i];
+		}
+		i++;
+	}
+	if (ocap > 0) {
+		lg_free(ostamps, ocap * sizeof (uint64_t));
+		lg_free(okeys, ocap * sizeof (uint64_t));
+	}
+}
+
+/*
+ * Like vset_test(): nodes that were given an id after the reset count as
+ * visited.
+ */
+int
+trav_test(lg_trav_ctx_t *tc, uint64_t k)
+{
+	if (tc->tc_dense) {
+		if (k >= tc->tc_bits) {
+			return (1);
+		}
+		return (tc->tc_dstamps[k] == tc->tc_epoch);
+	}
+	if (tc->tc_n == 0) {
+		return (0);
+	}
+	uint64_t s = trav_slot(tc, k);
+	return (tc->tc_hstamps[s] == tc->tc_epoch);
+}
+
+void
+trav_add(lg_trav_ctx_t *tc, uint64_t k)
+{
+	if (tc->tc_dense) {
+		if (k < tc->tc_bits) {
+			tc->tc_dstamps[k] = tc->tc_epoch;
+		}
+		return;
+	}
+	if ((tc->tc_n + 1) * 2 > tc->tc_hcap) {
+		trav_rehash(tc, tc->tc_hcap == 0 ? 64 : tc->tc_hcap * 2);
+	}
+	uint64_t s = trav_slot(tc, k);
+	if (tc->tc_hstamps[s] != tc->tc_epoch) {
+		tc->tc_hstamps[s] = tc->tc_epoch;
+		tc->tc_hkeys[s] = k;
+		tc->tc_n++;
+	}
+}
+
+void
+trav_enq(lg_trav_ctx_t *tc, gelem_t n)
+{
+	if (tc->tc_qn == tc->tc_qcap) {
+		uint64_t ncap = tc->tc_qcap == 0 ? 64 : tc->tc_qcap * 2;
+		gelem_t *nq = lg_zalloc(ncap * sizeof (gelem_t));
+		uint64_t mask = tc->tc_qcap - 1;
+		uint64_t i = 0;
+		while (i < tc->tc_qn) {
+			nq[i] = tc->tc_q[(tc->tc_qhead + i) & mask];
+			i++;
+		}
+		if (tc->tc_qcap > 0) {
+			lg_free(tc->tc_q, tc->tc_qcap * sizeof (gelem_t));
+		}
+		tc->tc_q = nq;
+		tc->tc_qcap = ncap;
+		tc->tc_qhead = 0;
+	}
+	tc->tc_q[(tc->tc_qhead + tc->tc_qn) & (tc->tc_qcap - 1)] = n;
+	tc->tc_qn++;
+}
+
+gelem_t
+trav_deq(lg_trav_ctx_t *tc)
+{
+	gelem_t n = tc->tc_q[tc->tc_qhead];
+	tc->tc_qhead = (tc->tc_qhead + 1) & (tc->tc_qcap - 1);
+	tc->tc_qn--;
+	return (n);
+}
+
+static void
+dfs_nbr_cb(gelem_t n, gelem_t adj, uint64_t k, gelem_t w, void *arg)
+{
+	dfs_stack_t *S = arg;
+	(void)n;
+	(void)w;
+	if (S->ds_nn == S->ds_ncap) {
+		uint64_t ncap = S->ds_ncap == 0 ? 64 : S->ds_ncap * 2;
+		dfs_nbr_t *nn = lg_zalloc(ncap * sizeof (dfs_nbr_t));
+		if (S->ds_nbrs != NULL) {
+			bcopy(S->ds_nbrs, nn, S->ds_nn * sizeof (dfs_nbr_t));
+			lg_free(S->ds_nbrs, S->ds_ncap * sizeof (dfs_nbr_t));
+		}
+		S->ds_nbrs = nn;
+		S->ds_ncap = ncap;
+	}
+	S->ds_nbrs[S->ds_nn].dn_node = adj;
+	S->ds_nbrs[S->ds_nn].dn_key = k;
+	S->ds_nn++;
+}
+
+/*
+ * Pushes a frame for `n`, followed by its neighbors in `g`. If `g` is NULL,
+ * the frame has no neighbors (the branch-stack of lg_dfs_br_rdnt_fold only
+ * needs the nodes).
+ */
+void
+dfs_push(lg_graph_t *g, dfs_stack_t *S, gelem_t n)
+{
+	if (S->ds_depth == S->ds_cap) {
+		uint64_t ncap = S->ds_cap == 0 ? 64 : S->ds_cap * 2;
+		dfs_frame_t *nf = lg_zalloc(ncap * sizeof (dfs_frame_t));
+		if (S->ds_frames != NULL) {
+			bcopy(S->ds_frames, nf,
+			    S->ds_depth * sizeof (dfs_frame_t));
+			lg_free(S->ds_frames, S->ds_cap * sizeof (dfs_frame_t));
+		}
+		S->ds_frames = nf;
+		S->ds_cap = ncap;
+	}
+	dfs_frame_t *f = &S->ds_frames[S->ds_depth++];
+	f->df_node = n;
+	f->df_base = S->ds_nn;
+	f->df_cur = S->ds_nn;
+	if (g != NULL) {
+		graph_nbrs(g, n, dfs_nbr_cb, S);
+	}
+	f->df_end = S->ds_nn;
+}
+
+/*
+ * Returns the top frame, or NULL if the stack is empty.
+ */
+dfs_frame_t *
+dfs_top(dfs_stack_t *S)
+{
+	if (S->ds_depth == 0) {
+		return (NULL);
+	}
+	return (&S->ds_frames[S->ds_depth - 1]);
+}
+
+/*
+ * Finds the next neighbor of the top frame that isn't in `V` (or the next
+ * neighbor, period, if `V` is NULL), and advances the frame's cursor past it.
+ * Returns 0 if there is no such neighbor.
+ */
+int
+dfs_pushable(dfs_stack_t *S, vset_t *V, gelem_t *adjp)
+{
+	dfs_frame_t *top = dfs_top(S);
+	if (top == NULL) {
+		return (0);
+	}
+	while (top->df_cur < top->df_end) {
+		dfs_nbr_t *nb = &S->ds_nbrs[top->df_cur++];
+		if (V == NULL || !vset_test(V, nb->dn_key)) {
+			*adjp = nb->dn_node;
+			return (1);
+		}
+	}
+	return (0);
+}
+
+gelem_t
+dfs_pop(dfs_stack_t *S)
+{
+	dfs_frame_t *f = &S->ds_frames[--S->ds_depth];
+	S->ds_nn = f->df_base;
+	return (f->df_node);
+}
+
+void
+dfs_stack_destroy(dfs_stack_t *S)
+{
+	if (S->ds_cap > 0) {
+		lg_free(S->ds_frames, S->ds_cap * sizeof (dfs_frame_t));
+	}
+	if (S->ds_ncap > 0) {
+		lg_free(S->ds_nbrs, S->ds_ncap * sizeof (dfs_nbr_t));
+	}
+}
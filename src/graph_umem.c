@@ -19,11 +19,12 @@
 #define UNUSED(x) (void)(x)
 #define CTOR_HEAD       UNUSED(ignored); UNUSED(flags)
 
+/*
+ * Only the graphs themselves come from a global cache. Everything a graph
+ * allocates per edge or per change comes from the graph's own arenas (see
+ * graph_arena.c).
+ */
 umem_cache_t *cache_lg_graph;
-umem_cache_t *cache_edge;
-umem_cache_t *cache_w_edge;
-umem_cache_t *cache_stack_elem;
-umem_cache_t *cache_change;
 
 #ifdef UMEM
 //constructors...
@@ -37,41 +38,6 @@ lg_graph_ctor(void *buf, void *ignored, int flags)
 	return (0);
 }
 
-int
-edge_ctor(void *buf, void *ignored, int flags)
-{
-	CTOR_HEAD;
-	edge_t *r = buf;
-	bzero(r, sizeof (edge_t));
-	return (0);
-}
-
-int
-w_edge_ctor(void *buf, void *ignored, int flags)
-{
-	CTOR_HEAD;
-	w_edge_t *r = buf;
-	bzero(r, sizeof (w_edge_t));
-	return (0);
-}
-
-int
-stack_elem_ctor(void *buf, void *ignored, int flags)
-{
-	CTOR_HEAD;
-	stack_elem_t *r = buf;
-	bzero(r, sizeof (stack_elem_t));
-	return (0);
-}
-
-int
-change_ctor(void *buf, void *ignored, int flags)
-{
-	CTOR_HEAD;
-	w_edge_t *r = buf;
-	bzero(r, sizeof (change_t));
-	return (0);
-}
 #endif
 
 int
@@ -87,47 +53,6 @@ graph_umem_init()
 		NULL,
 		NULL,
 		0);
-
-	cache_edge = umem_cache_create("edge",
-		sizeof (edge_t),
-		0,
-		edge_ctor,
-		NULL,
-		NULL,
-		NULL,
-		NULL,
-		0);
-
-	cache_w_edge = umem_cache_create("w_edge",
-		sizeof (w_edge_t),
-		0,
-		w_edge_ctor,
-		NULL,
-		NULL,
-		NULL,
-		NULL,
-		0);
-
-	cache_stack_elem = umem_cache_create("stack_elem",
-		sizeof (stack_elem_t),
-		0,
-		stack_elem_ctor,
-		NULL,
-		NULL,
-		NULL,
-		NULL,
-		0);
-
-	cache_change = umem_cache_create("change",
-		sizeof (change_t),
-		0,
-		change_ctor,
-		NULL,
-		NULL,
-		NULL,
-		NULL,
-		0);
-
 #endif
 	return (0);
 
@@ -156,89 +81,78 @@ lg_rm_graph(lg_graph_t *g)
 }
 
 edge_t *
-lg_mk_edge()
+lg_mk_edge(lg_graph_t *g)
 {
-#ifdef UMEM
-	return (umem_cache_alloc(cache_edge, UMEM_NOFAIL));
-#else
-	return (calloc(1, sizeof (edge_t)));
-#endif
+	return (arena_alloc(&g->gr_ar_edges));
 }
 
 void
 lg_rm_edge(edge_t *e)
 {
-#ifdef UMEM
-	bzero(e, sizeof (edge_t));
-	umem_cache_free(cache_edge, e);
-#else
-	bzero(e, sizeof (edge_t));
-	free(e);
-#endif
+	arena_free(e);
 }
 
 w_edge_t *
-lg_mk_w_edge()
+lg_mk_w_edge(lg_graph_t *g)
 {
-#ifdef UMEM
-	return (umem_cache_alloc(cache_w_edge, UMEM_NOFAIL));
-#else
-	return (calloc(1, sizeof (w_edge_t)));
-#endif
+	return (arena_alloc(&g->gr_ar_edges));
 }
 
 void
 lg_rm_w_edge(w_edge_t *w)
 {
-#ifdef UMEM
-	bzero(w, sizeof (w_edge_t));
-	umem_cache_free(cache_w_edge, w);
-#else
-	bzero(w, sizeof (w_edge_t));
-	free(w);
-#endif
+	arena_free(w);
 }
 
-stack_elem_t *
-lg_mk_stack_elem()
+change_t *
+lg_mk_change(lg_graph_t *g)
 {
-#ifdef UMEM
-	return (umem_cache_alloc(cache_stack_elem, UMEM_NOFAIL));
-#else
-	return (calloc(1, sizeof (stack_elem_t)));
-#endif
+	return (arena_alloc(&g->gr_ar_changes));
 }
 
 void
-lg_rm_stack_elem(stack_elem_t *s)
+lg_rm_change(change_t *c)
 {
-#ifdef UMEM
-	bzero(s, sizeof (stack_elem_t));
-	umem_cache_free(cache_stack_elem, s);
-#else
-	bzero(s, sizeof (stack_elem_t));
-	free(s);
-#endif
+	arena_free(c);
 }
 
-change_t *
-lg_mk_change()
+node_t *
+lg_mk_node(lg_graph_t *g)
+{
+	return (arena_alloc(&g->gr_ar_nodes));
+}
+
+void
+lg_rm_node(node_t *n)
+{
+	arena_free(n);
+}
+
+/*
+ * Variable-sized, zeroed allocations, for things like the arrays of a frozen
+ * graph's CSR image. Unlike the functions above, the caller has to remember the
+ * size of the allocation.
+ */
+void *
+lg_zalloc(size_t sz)
 {
 #ifdef UMEM
-	return (umem_cache_alloc(cache_change, UMEM_NOFAIL));
+	return (umem_zalloc(sz, UMEM_NOFAIL));
 #else
-	return (calloc(1, sizeof (change_t)));
+	return (calloc(1, sz));
 #endif
 }
 
 void
-lg_rm_change(change_t *c)
+lg_free(void *p, size_t sz)
 {
+	if (p == NULL) {
+		return;
+	}
 #ifdef UMEM
-	bzero(c, sizeof (change_t));
-	umem_cache_free(cache_change, c);
+	umem_free(p, sz);
 #else
-	bzero(c, sizeof (change_t));
-	free(c);
+	(void)sz;
+	free(p);
 #endif
 }
@@ -0,0 +1,686 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public License,
+ * v. 2.0. If a copy of the MPL was not distributed with this file, You can
+ * obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Copyright (c) 2015, Nick Zivkovic
+ */
+
+/*
+ * This file implements read-only views of a graph as of one of its snapshots
+ * (see lg_view_at), which can be traversed without rolling the graph back,
+ * and without copying its edges.
+ *
+ * The edges of a graph as of snapshot S are its current edges, minus the
+ * edges that were connected since S, plus the edges that were disconnected
+ * since S, with the weights that they had at S. A view doesn't materialize
+ * this. Instead, it walks the change-log from the newest change back to the
+ * first change made after S, and for every edge that a change touches, it
+ * records whether the edge existed before the change, and with which weight.
+ * The last record written for an edge is thus its state at S. These records
+ * are kept in a sorted list (see view_ent_t in graph_impl.h), which has one
+ * entry per changed edge, no matter how often the edge changed. Reads then
+ * merge the current edges of the graph with the records: an edge that has a
+ * record is taken from the record, and every other edge is taken as is.
+ *
+ * The graph can go on changing while a view exists. Every change to the
+ * change-log bumps the graph's `gr_gen`, and a view that finds `gr_gen`
+ * different from the one it was built at rebuilds its records before it is
+ * read, which costs a walk of the changes made since S.
+ */
+
+#include <stdlib.h>
+#include <strings.h>
+#include "graph_impl.h"
+#include "graph_provider.h"
+
+static int
+view_weighted(lg_graph_t *g)
+{
+	return (g->gr_type == GRAPH_WE || g->gr_type == DIGRAPH_WE);
+}
+
+/*
+ * Returns the record of the edge from->to, or NULL if it has none.
+ */
+static view_ent_t *
+view_find(lg_view_t *v, gelem_t from, gelem_t to)
+{
+	w_edge_t k;
+	selem_t key;
+	selem_t found;
+	if (slablist_get_elems(v->vw_ents) == 0) {
+		return (NULL);
+	}
+	k.wed_from = from;
+	k.wed_to = to;
+	key.sle_p = &k;
+	if (slablist_find(v->vw_ents, key, &found) == SL_ENFOUND) {
+		return (NULL);
+	}
+	return (found.sle_p);
+}
+
+/*
+ * Records that the edge from->to existed (or didn't) before a change after
+ * which it existed (or didn't) as given by `after`. Since the changes are
+ * undone from the newest to the oldest, the first record of an edge sees its
+ * current state as `after`, and the last one sees its state at the snapshot as
+ * `present`, which keeps `vw_nedges` up to date. The mirror direction of an
+ * undirected edge isn't counted.
+ */
+static void
+view_put(lg_view_t *v, gelem_t from, gelem_t to, gelem_t w, int present,
+    int after, int mirror)
+{
+	view_ent_t *ve = view_find(v, from, to);
+	if (ve == NULL) {
+		selem_t se;
+		ve = arena_alloc(&v->vw_ar);
+		ve->ve_edge.wed_from = from;
+		ve->ve_edge.wed_to = to;
+		se.sle_p = ve;
+		(void) slablist_add(v->vw_ents, se, 0);
+	} else {
+		after = ve->ve_present;
+	}
+	if (!mirror) {
+		v->vw_nedges -= after;
+		v->vw_nedges += present;
+	}
+	ve->ve_edge.wed_weight = w;
+	ve->ve_present = present;
+	ve->ve_mirror = mirror;
+}
+
+/*
+ * Records that the edge from->to existed (or didn't) before the change that is
+ * being undone, and existed (or didn't) after it.
+ */
+static void
+view_set(lg_view_t *v, gelem_t from, gelem_t to, gelem_t w, int present,
+    int after)
+{
+	if (!view_weighted(v->vw_g)) {
+		w.ge_u = 0;
+	}
+	if (!GRAPH_UNDIRECTED(v->vw_g)) {
+		view_put(v, from, to, w, present, after, 0);
+		return;
+	}
+	if (from.ge_u > to.ge_u) {
+		gelem_t tmp = from;
+		from = to;
+		to = tmp;
+	}
+	view_put(v, from, to, w, present, after, 0);
+	view_put(v, to, from, w, present, after, 1);
+}
+
+/*
+ * Records the state that the edges of `c` were in before `c` was made.
+ */
+static void
+view_undo(lg_view_t *v, change_t *c)
+{
+	uint64_t i = 0;
+	switch (c->ch_op) {
+
+	case CONNECT:
+		view_set(v, c->ch_from, c->ch_to, c->ch_weight, 0, 1);
+		break;
+
+	case DISCONNECT:
+		view_set(v, c->ch_from, c->ch_to, c->ch_weight, 1, 0);
+		break;
+
+	case UPDATE:
+		view_set(v, c->ch_from, c->ch_to, c->ch_oweight, 1, 1);
+		break;
+
+	case CONNECT_BATCH:
+		while (i < c->ch_nbatch) {
+			view_set(v, c->ch_batch[i].wed_from,
+			    c->ch_batch[i].wed_to, c->ch_batch[i].wed_weight,
+			    0, 1);
+			i++;
+		}
+		break;
+
+	case REMOVE_NODE:
+	case DROP:
+		while (i < c->ch_nbatch) {
+			view_set(v, c->ch_batch[i].wed_from,
+			    c->ch_batch[i].wed_to, c->ch_batch[i].wed_weight,
+			    1, 0);
+			i++;
+		}
+		break;
+	}
+}
+
+/*
+ * Used with a left fold over the changes made since the snapshot, which walks
+ * them from the newest to the oldest.
+ */
+static selem_t
+view_undo_cb(selem_t zero, selem_t *e, uint64_t sz)
+{
+	lg_view_t *v = zero.sle_p;
+	uint64_t i = sz;
+	while (i > 0) {
+		i--;
+		view_undo(v, e[i].sle_p);
+	}
+	return (zero);
+}
+
+/*
+ * (Re)builds the records of `v` from the change-log. If the snapshot of the
+ * view no longer exists (because the graph was rolled back past it, or its
+ * snapshots were destroyed), the view has no records, and sees the graph as
+ * it is.
+ */
+static void
+view_build(lg_view_t *v)
+{
+	lg_graph_t *g = v->vw_g;
+	if (v->vw_ents != NULL) {
+		slablist_destroy(v->vw_ents, NULL);
+	}
+	arena_destroy(&v->vw_ar);
+	v->vw_ents = slablist_create("graph_view", w_edge_cmp, w_edge_bnd,
+	    SL_SORTED);
+	v->vw_gen = g->gr_gen;
+	v->vw_nedges = edges_nelems(g);
+	if (g->gr_snaps == NULL || v->vw_snap >= g->gr_snap) {
+		return;
+	}
+	change_t ch_min;
+	change_t ch_max;
+	selem_t s_min;
+	selem_t s_max;
+	selem_t zero;
+	snaps_range(g, v->vw_snap, &ch_min, &ch_max);
+	s_min.sle_p = &ch_min;
+	s_max.sle_p = &ch_max;
+	zero.sle_p = v;
+	slablist_foldl_range(g->gr_snaps, view_undo_cb, s_min, s_max, zero);
+}
+
+static void
+view_sync(lg_view_t *v)
+{
+	if (v->vw_gen != v->vw_g->gr_gen) {
+		view_build(v);
+	}
+}
+
+typedef struct view_nbrs {
+	lg_view_t	*vn_v;
+	nbrs_cb_t	*vn_cb;
+	void		*vn_arg;
+} view_nbrs_t;
+
+static void
+view_live_cb(gelem_t n, gelem_t adj, uint64_t k, gelem_t w, void *arg)
+{
+	view_nbrs_t *a = arg;
+	if (view_find(a->vn_v, n, adj) == NULL) {
+		a->vn_cb(n, adj, k, w, a->vn_arg);
+	}
+}
+
+static selem_t
+view_ents_cb(selem_t zero, selem_t *e, uint64_t sz)
+{
+	view_nbrs_t *a = zero.sle_p;
+	uint64_t k;
+	uint64_t i = 0;
+	while (i < sz) {
+		view_ent_t *ve = e[i].sle_p;
+		if (ve->ve_present &&
+		    node_key(a->vn_v->vw_g, ve->ve_edge.wed_to, &k) == 0) {
+			a->vn_cb(ve->ve_edge.wed_from, ve->ve_edge.wed_to, k,
+			    ve->ve_edge.wed_weight, a->vn_arg);
+		}
+		i++;
+	}
+	return (zero);
+}
+
+/*
+ * The view version of graph_nbrs(). The neighbors of `n` that didn't change
+ * since the snapshot come first, in the order in which graph_nbrs() visits
+ * them, followed by the ones that did, in node order.
+ */
+static void
+view_nbrs(lg_view_t *v, gelem_t n, nbrs_cb_t *cb, void *arg)
+{
+	view_nbrs_t a;
+	w_edge_t kmin;
+	w_edge_t kmax;
+	selem_t min;
+	selem_t max;
+	selem_t zero;
+	a.vn_v = v;
+	a.vn_cb = cb;
+	a.vn_arg = arg;
+	graph_nbrs(v->vw_g, n, view_live_cb, &a);
+	if (slablist_get_elems(v->vw_ents) == 0) {
+		return;
+	}
+	kmin.wed_from = n;
+	kmin.wed_to.ge_u = 0;
+	kmax.wed_from = n;
+	kmax.wed_to.ge_u = UINT64_MAX;
+	min.sle_p = &kmin;
+	max.sle_p = &kmax;
+	zero.sle_p = &a;
+	slablist_foldr_range(v->vw_ents, view_ents_cb, min, max, zero);
+}
+
+/*
+ * Creates a view of `g` as of snapshot `snap`. The view can be read with
+ * lg_view_bfs_fold(), lg_view_dfs_fold(), lg_view_neighbors(), and
+ * lg_view_edges() (and their _arg variants), which behave like their
+ * counterparts, except that they see the edges that `g` had when `snap` was
+ * taken. Creating a view costs a walk of the changes made since `snap`, and
+ * its size is proportional to the number of edges that they touched.
+ *
+ * `g` can go on changing while the view exists, and the view keeps seeing the
+ * graph as of `snap`, until `g` is rolled back past `snap`, or `snap` is
+ * destroyed. Views aren't thread-safe: a view has to be read by the same
+ * thread that changes `g`. The view must be destroyed before `g`.
+ *
+ * Returns NULL if `g` has no snapshot `snap`, or is sharded.
+ */
+lg_view_t *
+lg_view_at(lg_graph_t *g, uint64_t snap)
+{
+	if (snap >= g->gr_snap || g->gr_snaps == NULL ||
+	    g->gr_shards != NULL) {
+		return (NULL);
+	}
+	lg_view_t *v = lg_zalloc(sizeof (lg_view_t));
+	v->vw_g = g;
+	v->vw_snap = snap;
+	arena_init(&v->vw_ar, sizeof (view_ent_t));
+	view_build(v);
+	return (v);
+}
+
+void
+lg_view_destroy(lg_view_t *v)
+{
+	slablist_destroy(v->vw_ents, NULL);
+	arena_destroy(&v->vw_ar);
+	lg_free(v, sizeof (lg_view_t));
+}
+
+typedef struct view_bfs {
+	lg_view_t	*vb_v;
+	adj_cb_t	*vb_acb;
+	gelem_t		vb_agg;
+	slablist_t	*vb_q;
+	vset_t		vb_vs;
+} view_bfs_t;
+
+/*
+ * The view version of visit_and_q().
+ */
+static void
+view_visit_cb(gelem_t from, gelem_t to, uint64_t k, gelem_t w, void *arg)
+{
+	view_bfs_t *b = arg;
+	selem_t enq;
+	if (vset_test(&b->vb_vs, k)) {
+		return;
+	}
+	if (b->vb_acb != NULL) {
+		b->vb_acb(to, from, w, b->vb_agg);
+	}
+	GRAPH_BFS_ENQ(to);
+	enq.sle_u = to.ge_u;
+	slablist_add(b->vb_q, enq, 0);
+	GRAPH_BFS_VISIT(to);
+	vset_add(&b->vb_vs, k);
+}
+
+/*
+ * The view version of lg_bfs_fold().
+ */
+gelem_t
+lg_view_bfs_fold(lg_view_t *v, gelem_t start, adj_cb_t *acb, fold_cb_t *cb,
+    gelem_t gzero)
+{
+	lg_graph_t *g = v->vw_g;
+	view_bfs_t b;
+	selem_t enq;
+	view_sync(v);
+	if (v->vw_nedges == 0) {
+		return (gzero);
+	}
+	GRAPH_BFS_BEGIN(g);
+	b.vb_v = v;
+	b.vb_acb = acb;
+	b.vb_agg = gzero;
+	b.vb_q = slablist_create("graph_view_bfs_queue", NULL, NULL,
+	    SL_ORDERED);
+	vset_init(g, &b.vb_vs, "graph_view_bfs_vset");
+	GRAPH_BFS_ENQ(start);
+	enq.sle_u = start.ge_u;
+	slablist_add(b.vb_q, enq, 0);
+	vset_gadd(g, &b.vb_vs, start);
+	while (slablist_get_elems(b.vb_q) > 0) {
+		selem_t first = slablist_head(b.vb_q);
+		slablist_rem(b.vb_q, first, 0, NULL);
+		gelem_t last;
+		last.ge_u = first.sle_u;
+		GRAPH_BFS_DEQ(last);
+		if (cb != NULL && cb(b.vb_agg, last, &b.vb_agg)) {
+			break;
+		}
+		view_nbrs(v, last, view_visit_cb, &b);
+	}
+	slablist_destroy(b.vb_q, NULL);
+	vset_destroy(&b.vb_vs);
+	GRAPH_BFS_END(g);
+	return (b.vb_agg);
+}
+
+/*
+ * A frame of the DFS stack of a view. Since there is no single list that the
+ * neighbors of a node can be bookmarked in, they are collected into the frame
+ * when the node is pushed.
+ */
+typedef struct view_frame {
+	gelem_t		vf_node;
+	gelem_t		*vf_adj;
+	uint64_t	*vf_keys;
+	uint64_t	vf_n;
+	uint64_t	vf_cap;
+	uint64_t	vf_cur;
+} view_frame_t;
+
+typedef struct view_stack {
+	view_frame_t	*vst_frames;
+	uint64_t	vst_depth;
+	uint64_t	vst_cap;
+} view_stack_t;
+
+static void
+view_frame_cb(gelem_t n, gelem_t adj, uint64_t k, gelem_t w, void *arg)
+{
+	view_frame_t *f = arg;
+	(void)n;
+	(void)w;
+	if (f->vf_n == f->vf_cap) {
+		uint64_t ncap = f->vf_cap == 0 ? 16 : f->vf_cap * 2;
+		gelem_t *nadj = lg_zalloc(ncap * sizeof (gelem_t));
+		uint64_t *nkeys = lg_zalloc(ncap * sizeof (uint64_t));
+		if (f->vf_adj != NULL) {
+			bcopy(f->vf_adj, nadj, f->vf_n * sizeof (gelem_t));
+			bcopy(f->vf_keys, nkeys, f->vf_n * sizeof (uint64_t));
+			lg_free(f->vf_adj, f->vf_cap * sizeof (gelem_t));
+			lg_free(f->vf_keys, f->vf_cap * sizeof (uint64_t));
+		}
+		f->vf_adj = nadj;
+		f->vf_keys = nkeys;
+		f->vf_cap = ncap;
+	}
+	f->vf_adj[f->vf_n] = adj;
+	f->vf_keys[f->vf_n] = k;
+	f->vf_n++;
+}
+
+static view_frame_t *
+view_push(lg_view_t *v, view_stack_t *S, gelem_t n)
+{
+	if (S->vst_depth == S->vst_cap) {
+		uint64_t ncap = S->vst_cap == 0 ? 64 : S->vst_cap * 2;
+		view_frame_t *nf = lg_zalloc(ncap * sizeof (view_frame_t));
+		if (S->vst_frames != NULL) {
+			bcopy(S->vst_frames, nf,
+			    S->vst_depth * sizeof (view_frame_t));
+			lg_free(S->vst_frames,
+			    S->vst_cap * sizeof (view_frame_t));
+		}
+		S->vst_frames = nf;
+		S->vst_cap = ncap;
+	}
+	view_frame_t *f = &S->vst_frames[S->vst_depth++];
+	bzero(f, sizeof (view_frame_t));
+	f->vf_node = n;
+	view_nbrs(v, n, view_frame_cb, f);
+	return (f);
+}
+
+static gelem_t
+view_pop(view_stack_t *S)
+{
+	view_frame_t *f = &S->vst_frames[--S->vst_depth];
+	if (f->vf_adj != NULL) {
+		lg_free(f->vf_adj, f->vf_cap * sizeof (gelem_t));
+		lg_free(f->vf_keys, f->vf_cap * sizeof (uint64_t));
+	}
+	return (f->vf_node);
+}
+
+static void
+view_stack_destroy(view_stack_t *S)
+{
+	while (S->vst_depth > 0) {
+		(void) view_pop(S);
+	}
+	lg_free(S->vst_frames, S->vst_cap * sizeof (view_frame_t));
+}
+
+/*
+ * Finds the next neighbor of the top frame that hasn't been visited, and
+ * advances the frame's cursor past it. Returns 0 if there is no such neighbor.
+ */
+static int
+view_pushable(view_stack_t *S, vset_t *V, gelem_t *adjp)
+{
+	view_frame_t *top = &S->vst_frames[S->vst_depth - 1];
+	while (top->vf_cur < top->vf_n) {
+		uint64_t i = top->vf_cur++;
+		if (!vset_test(V, top->vf_keys[i])) {
+			*adjp = top->vf_adj[i];
+			return (1);
+		}
+	}
+	return (0);
+}
+
+/*
+ * The view version of lg_dfs_fold().
+ */
+gelem_t
+lg_view_dfs_fold(lg_view_t *v, gelem_t start, pop_cb_t *pcb, fold_cb_t *cb,
+    gelem_t gzero)
+{
+	lg_graph_t *g = v->vw_g;
+	gelem_t agg = gzero;
+	gelem_t adj;
+	view_stack_t S;
+	vset_t V;
+	view_sync(v);
+	if (v->vw_nedges == 0) {
+		return (gzero);
+	}
+	GRAPH_DFS_BEGIN(g);
+	bzero(&S, sizeof (S));
+	vset_init(g, &V, "graph_view_dfs_vset");
+	view_frame_t *f = view_push(v, &S, start);
+	/*
+	 * `start` has no outgoing edges, so we just call `cb` on `start`, and
+	 * return.
+	 */
+	if (f->vf_n == 0) {
+		(void)cb(agg, start, &agg);
+		goto done;
+	}
+	GRAPH_DFS_PUSH(g, start);
+	if (cb(agg, start, &agg)) {
+		goto done;
+	}
+	vset_gadd(g, &V, start);
+
+try_continue:;
+	while (view_pushable(&S, &V, &adj)) {
+		GRAPH_DFS_PUSH(g, adj);
+		(void) view_push(v, &S, adj);
+		/* we've met our terminating condition */
+		if (cb(agg, adj, &agg)) {
+			goto done;
+		}
+		vset_gadd(g, &V, adj);
+	}
+
+	/*
+	 * We've reached the bottom. We pop one element off of the stack, and
+	 * try to continue the search, until the stack is empty.
+	 */
+pop_again:;
+	if (S.vst_depth > 0) {
+		gelem_t popped = view_pop(&S);
+		GRAPH_DFS_POP(g, popped);
+		int popstat = 0;
+		if (pcb != NULL) {
+			popstat = pcb(popped, agg);
+		}
+		if (S.vst_depth > 0) {
+			if (popstat == 1) {
+				goto pop_again;
+			}
+			goto try_continue;
+		}
+	}
+done:
+	view_stack_destroy(&S);
+	vset_destroy(&V);
+	GRAPH_DFS_END(g);
+	return (agg);
+}
+
+typedef struct view_edges {
+	lg_view_t	*ve_v;
+	edges_cb_t	*ve_cb;
+	edges_arg_cb_t	*ve_acb;
+	gelem_t		ve_arg;
+} view_edges_t;
+
+static void
+view_edge_emit(view_edges_t *a, gelem_t from, gelem_t to, gelem_t w)
+{
+	if (a->ve_acb != NULL) {
+		a->ve_acb(from, to, w, a->ve_arg);
+	} else {
+		a->ve_cb(from, to, w);
+	}
+}
+
+static void
+view_nbr_emit_cb(gelem_t n, gelem_t adj, uint64_t k, gelem_t w, void *arg)
+{
+	(void)k;
+	view_edge_emit(arg, n, adj, w);
+}
+
+void
+lg_view_neighbors(lg_view_t *v, gelem_t n, edges_cb_t *cb)
+{
+	view_edges_t a;
+	view_sync(v);
+	a.ve_v = v;
+	a.ve_cb = cb;
+	a.ve_acb = NULL;
+	view_nbrs(v, n, view_nbr_emit_cb, &a);
+}
+
+void
+lg_view_neighbors_arg(lg_view_t *v, gelem_t n, edges_arg_cb_t *cb,
+    gelem_t arg)
+{
+	view_edges_t a;
+	view_sync(v);
+	a.ve_v = v;
+	a.ve_cb = NULL;
+	a.ve_acb = cb;
+	a.ve_arg = arg;
+	view_nbrs(v, n, view_nbr_emit_cb, &a);
+}
+
+static selem_t
+view_live_edges_cb(selem_t zero, selem_t *e, uint64_t sz)
+{
+	view_edges_t *a = zero.sle_p;
+	gelem_t from;
+	gelem_t to;
+	gelem_t w;
+	uint64_t i = 0;
+	while (i < sz) {
+		edge_get(a->ve_v->vw_g, e[i], &from, &to, &w);
+		if (view_find(a->ve_v, from, to) == NULL) {
+			view_edge_emit(a, from, to, w);
+		}
+		i++;
+	}
+	return (zero);
+}
+
+static selem_t
+view_ents_edges_cb(selem_t zero, selem_t *e, uint64_t sz)
+{
+	view_edges_t *a = zero.sle_p;
+	uint64_t i = 0;
+	while (i < sz) {
+		view_ent_t *ve = e[i].sle_p;
+		if (ve->ve_present && !ve->ve_mirror) {
+			view_edge_emit(a, ve->ve_edge.wed_from,
+			    ve->ve_edge.wed_to, ve->ve_edge.wed_weight);
+		}
+		i++;
+	}
+	return (zero);
+}
+
+/*
+ * The edges that didn't change since the snapshot come first, in the order of
+ * lg_edges(), followed by the ones that did. An edge of an undirected graph is
+ * passed to `cb` once.
+ */
+static void
+view_edges(lg_view_t *v, view_edges_t *a)
+{
+	selem_t zero;
+	view_sync(v);
+	zero.sle_p = a;
+	edges_foldr(v->vw_g, view_live_edges_cb, zero);
+	slablist_foldr(v->vw_ents, view_ents_edges_cb, zero);
+}
+
+void
+lg_view_edges(lg_view_t *v, edges_cb_t *cb)
+{
+	view_edges_t a;
+	a.ve_v = v;
+	a.ve_cb = cb;
+	a.ve_acb = NULL;
+	view_edges(v, &a);
+}
+
+void
+lg_view_edges_arg(lg_view_t *v, edges_arg_cb_t *acb, gelem_t arg)
+{
+	view_edges_t a;
+	a.ve_v = v;
+	a.ve_cb = NULL;
+	a.ve_acb = acb;
+	a.ve_arg = arg;
+	view_edges(v, &a);
+}